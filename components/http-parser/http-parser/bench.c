@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
@@ -43,8 +44,68 @@ static const char data[] =
     "Connection: keep-alive\r\n"
     "Transfer-Encoding: chunked\r\n"
     "Cache-Control: max-age=0\r\n\r\nb\r\nhello world\r\n0\r\n";
+
 static const size_t data_len = sizeof(data) - 1;
 
+/* HomeKit traffic as seen by an accessory (requests from the controller) and
+ * by a controller (EVENT/1.0 notifications). Bodies are appended at startup
+ * so the binary TLV8 ones get a correct Content-Length. */
+struct hap_message {
+  const char *name;
+  enum http_parser_type type;
+  const char *head;
+  const char *body;
+  size_t body_len;
+};
+
+#define HAP_PUT_BODY                                                         \
+    "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":true},"          \
+    "{\"aid\":1,\"iid\":10,\"value\":75}]}"
+
+#define HAP_EVENT_BODY                                                       \
+    "{\"characteristics\":[{\"aid\":1,\"iid\":10,\"value\":42}]}"
+
+/* kTLVType_State=1, kTLVType_Method=0 (pair setup) */
+static const char tlv_pair_setup_m1[] = "\x06\x01\x01\x00\x01\x00";
+
+/* kTLVType_State=1, kTLVType_PublicKey=<32 byte Curve25519 key> */
+static const char tlv_pair_verify_m1[] =
+    "\x06\x01\x01\x03\x20"
+    "\x8f\x40\xc5\xad\xb6\x8f\x25\x62\x4a\xe5\xb2\x14\xea\x76\x7a\x6e"
+    "\xc9\x4d\x82\x9d\x3d\x7b\x5e\x1a\xd1\xba\x6f\x3e\x21\x38\x28\x5f";
+
+static const struct hap_message hap_corpus[] = {
+  { "get-characteristics", HTTP_REQUEST,
+    "GET /characteristics?id=1.9,1.10 HTTP/1.1\r\n"
+    "Host: Lightswitch-A1B2C3._hap._tcp.local\r\n"
+    "\r\n",
+    NULL, 0 },
+  { "put-characteristics", HTTP_REQUEST,
+    "PUT /characteristics HTTP/1.1\r\n"
+    "Host: Lightswitch-A1B2C3._hap._tcp.local\r\n"
+    "Content-Type: application/hap+json\r\n",
+    HAP_PUT_BODY, sizeof(HAP_PUT_BODY) - 1 },
+  { "pair-setup", HTTP_REQUEST,
+    "POST /pair-setup HTTP/1.1\r\n"
+    "Host: Lightswitch-A1B2C3._hap._tcp.local\r\n"
+    "Content-Type: application/pairing+tlv8\r\n",
+    tlv_pair_setup_m1, sizeof(tlv_pair_setup_m1) - 1 },
+  { "pair-verify", HTTP_REQUEST,
+    "POST /pair-verify HTTP/1.1\r\n"
+    "Host: Lightswitch-A1B2C3._hap._tcp.local\r\n"
+    "Content-Type: application/pairing+tlv8\r\n",
+    tlv_pair_verify_m1, sizeof(tlv_pair_verify_m1) - 1 },
+  { "event", HTTP_RESPONSE,
+    "EVENT/1.0 200 OK\r\n"
+    "Content-Type: application/hap+json\r\n",
+    HAP_EVENT_BODY, sizeof(HAP_EVENT_BODY) - 1 },
+};
+
+#define HAP_CORPUS_SIZE (sizeof(hap_corpus) / sizeof(hap_corpus[0]))
+
+/* 512 mb per message type */
+static const int64_t kHapBytes = 512LL << 20;
+
 static int on_info(http_parser* p) {
   return 0;
 }
@@ -114,9 +175,269 @@ int bench(int iter_count, int silent) {
   return 0;
 }
 
+static size_t hap_build(const struct hap_message *m, char *buf, size_t size) {
+  int n;
+
+  if (m->body == NULL) {
+    n = snprintf(buf, size, "%s", m->head);
+    assert(n > 0 && (size_t) n < size);
+    return n;
+  }
+
+  n = snprintf(buf, size, "%sContent-Length: %u\r\n\r\n",
+               m->head, (unsigned) m->body_len);
+  assert(n > 0 && (size_t) n + m->body_len <= size);
+  memcpy(buf + n, m->body, m->body_len);
+  return n + m->body_len;
+}
+
+/* Parse with http_parser_tokenize() and walk the tokens, the way a caller
+ * of the pull API would */
+static size_t tokenize(struct http_parser *parser, const char *buf,
+                       size_t len) {
+  struct http_token tokens[16];
+  size_t parsed = 0;
+  size_t sum = 0;
+
+  while (parsed < len) {
+    size_t n = sizeof(tokens) / sizeof(tokens[0]);
+    size_t i;
+
+    parsed += http_parser_tokenize(parser, buf + parsed, len - parsed,
+                                   tokens, &n);
+    assert(HTTP_PARSER_ERRNO(parser) == HPE_OK);
+    for (i = 0; i < n; i++)
+      sum += tokens[i].length;
+  }
+
+  assert(sum < len);
+  return parsed;
+}
+
+int bench_hap(int pull) {
+  struct http_parser parser;
+  char buf[512];
+  size_t i;
+  int err;
+
+  fprintf(stdout, "HAP corpus (%s):\n",
+          pull ? "http_parser_tokenize" : "callbacks");
+
+  for (i = 0; i < HAP_CORPUS_SIZE; i++) {
+    const struct hap_message *m = &hap_corpus[i];
+    size_t len = hap_build(m, buf, sizeof(buf));
+    int64_t iter_count = kHapBytes / (int64_t) len;
+    int64_t n;
+    struct timeval start;
+    struct timeval end;
+    double elapsed;
+
+    err = gettimeofday(&start, NULL);
+    assert(err == 0);
+
+    for (n = 0; n < iter_count; n++) {
+      size_t parsed;
+      http_parser_init(&parser, m->type);
+
+      if (pull)
+        parsed = tokenize(&parser, buf, len);
+      else
+        parsed = http_parser_execute(&parser, &settings, buf, len);
+      assert(parsed == len);
+    }
+
+    err = gettimeofday(&end, NULL);
+    assert(err == 0);
+
+    elapsed = (double) (end.tv_sec - start.tv_sec) +
+              (end.tv_usec - start.tv_usec) * 1e-6f;
+
+    fprintf(stdout, "%-20s %4d b | %8.2f mb/s | %11.2f req/sec | %7.2f ns/req\n",
+        m->name,
+        (int) len,
+        (double) iter_count * len / elapsed / (1024 * 1024),
+        (double) iter_count / elapsed,
+        elapsed * 1e9 / (double) iter_count);
+    fflush(stdout);
+  }
+
+  return 0;
+}
+
+static int on_message_complete_pause(http_parser* p) {
+  http_parser_pause(p, 1);
+  return 0;
+}
+
+/* N pipelined PUT /characteristics in one receive buffer, parsed either
+ * one message per http_parser_execute() call (pausing in
+ * on_message_complete, as a server handling one request per wakeup does)
+ * or all at once with http_parser_execute_batch() */
+#define PIPELINE_DEPTH 8
+
+int bench_pipeline(void) {
+  http_parser_settings one_settings = settings;
+  struct http_message_record records[PIPELINE_DEPTH];
+  struct http_parser parser;
+  char buf[PIPELINE_DEPTH * 256];
+  size_t len = 0;
+  int64_t iter_count;
+  int mode;
+  int err;
+  int i;
+
+  one_settings.on_message_complete = on_message_complete_pause;
+
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    len += hap_build(&hap_corpus[1], buf + len, sizeof(buf) - len);
+
+  iter_count = kHapBytes / (int64_t) len;
+  fprintf(stdout, "%d pipelined put-characteristics, %d b:\n",
+          PIPELINE_DEPTH, (int) len);
+
+  for (mode = 0; mode < 2; mode++) {
+    struct timeval start;
+    struct timeval end;
+    double elapsed;
+    int64_t n;
+
+    err = gettimeofday(&start, NULL);
+    assert(err == 0);
+
+    for (n = 0; n < iter_count; n++) {
+      size_t parsed = 0;
+      int messages = 0;
+
+      http_parser_init(&parser, HTTP_REQUEST);
+
+      if (mode == 0) {
+        while (parsed < len) {
+          parsed += http_parser_execute(&parser, &one_settings,
+                                        buf + parsed, len - parsed);
+          assert(HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+          http_parser_pause(&parser, 0);
+          messages++;
+        }
+      } else {
+        size_t num = PIPELINE_DEPTH;
+
+        parsed = http_parser_execute_batch(&parser, &settings, buf, len,
+                                           records, &num);
+        messages = (int) num;
+      }
+      assert(parsed == len && messages == PIPELINE_DEPTH);
+    }
+
+    err = gettimeofday(&end, NULL);
+    assert(err == 0);
+
+    elapsed = (double) (end.tv_sec - start.tv_sec) +
+              (end.tv_usec - start.tv_usec) * 1e-6f;
+
+    fprintf(stdout, "%-20s %11.2f msg/sec | %7.2f ns/msg\n",
+        mode == 0 ? "one per execute" : "execute_batch",
+        (double) iter_count * PIPELINE_DEPTH / elapsed,
+        elapsed * 1e9 / ((double) iter_count * PIPELINE_DEPTH));
+    fflush(stdout);
+  }
+
+  return 0;
+}
+
+/* HAP id lists: the sprintf/strlen and strtoul way against
+ * http_format_hap_ids() / http_parse_hap_ids() */
+#define ID_ITERATIONS 10000000
+
+static double now(void) {
+  struct timeval tv;
+  int err = gettimeofday(&tv, NULL);
+  assert(err == 0);
+  return (double) tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void report_ids(const char *name, double elapsed, size_t sum) {
+  fprintf(stdout, "%-26s %7.2f ns/op (%u)\n", name,
+          elapsed * 1e9 / ID_ITERATIONS, (unsigned) (sum & 0xff));
+  fflush(stdout);
+}
+
+int bench_ids(void) {
+  static const struct http_hap_id ids[] =
+    { { 1, 9 }, { 1, 10 }, { 2, 9 }, { 2, 10 } };
+  const size_t num_ids = sizeof(ids) / sizeof(ids[0]);
+  struct http_hap_id parsed[8];
+  char buf[64];
+  size_t sum;
+  double start;
+  int i;
+
+  sum = 0;
+  start = now();
+  for (i = 0; i < ID_ITERATIONS; i++) {
+    size_t j;
+    buf[0] = '\0';
+    for (j = 0; j < num_ids; j++) {
+      sprintf(buf + strlen(buf), "%u.", (unsigned) ids[j].aid);
+      sprintf(buf + strlen(buf), "%u,", (unsigned) (ids[j].iid + (i & 1)));
+    }
+    buf[strlen(buf) - 1] = '\0';
+    sum += strlen(buf);
+  }
+  report_ids("format sprintf/strlen", now() - start, sum);
+
+  sum = 0;
+  start = now();
+  for (i = 0; i < ID_ITERATIONS; i++) {
+    struct http_hap_id varied[4];
+    memcpy(varied, ids, sizeof(varied));
+    varied[0].iid += i & 1;
+    sum += http_format_hap_ids(buf, sizeof(buf), varied, num_ids);
+  }
+  report_ids("format http_format_hap_ids", now() - start, sum);
+
+  http_format_hap_ids(buf, sizeof(buf), ids, num_ids);
+
+  sum = 0;
+  start = now();
+  for (i = 0; i < ID_ITERATIONS; i++) {
+    const char *p = buf;
+    char *end;
+    size_t n = 0;
+    while (*p && n < 8) {
+      parsed[n].aid = strtoul(p, &end, 10);
+      assert(*end == '.');
+      parsed[n].iid = strtoul(end + 1, &end, 10);
+      n++;
+      p = *end == ',' ? end + 1 : end;
+    }
+    sum += n + parsed[n - 1].iid;
+  }
+  report_ids("parse strtoul", now() - start, sum);
+
+  sum = 0;
+  start = now();
+  for (i = 0; i < ID_ITERATIONS; i++) {
+    int n = http_parse_hap_ids(buf, strlen(buf), parsed, 8);
+    assert(n == (int) num_ids);
+    sum += n + parsed[n - 1].iid;
+  }
+  report_ids("parse http_parse_hap_ids", now() - start, sum);
+
+  return 0;
+}
+
 int main(int argc, char** argv) {
   int64_t iterations;
 
+  if (argc == 2 && strcmp(argv[1], "hap") == 0)
+    return bench_hap(0);
+  if (argc == 2 && strcmp(argv[1], "hap-tokens") == 0)
+    return bench_hap(1);
+  if (argc == 2 && strcmp(argv[1], "pipeline") == 0)
+    return bench_pipeline();
+  if (argc == 2 && strcmp(argv[1], "ids") == 0)
+    return bench_ids();
+
   iterations = kBytes / (int64_t) data_len;
   if (argc == 2 && strcmp(argv[1], "infinite") == 0) {
     for (;;)
@@ -132,6 +132,29 @@ do {                                                                 \
 #define CALLBACK_DATA_NOADVANCE(FOR)                                 \
     CALLBACK_DATA_(FOR, p - FOR##_mark, p - data)
 
+/* Note where a message starts, for http_parser_execute_batch() */
+#define MESSAGE_BEGIN()                                              \
+do {                                                                 \
+  message_mark = p;                                                  \
+  CALLBACK_NOTIFY(message_begin);                                    \
+} while (0)
+
+/* Record the message that ends with the current byte (if batching), run
+ * on_message_complete and consume the byte. Stop once the batch is full. */
+#define MESSAGE_COMPLETE()                                           \
+do {                                                                 \
+  if (batch) {                                                       \
+    batch_record(parser, batch, message_mark, data, p + 1);          \
+  }                                                                  \
+  message_mark = NULL;                                               \
+  CALLBACK_NOTIFY(message_complete);                                 \
+  if (batch && batch->count == batch->capacity) {                    \
+    batch->paused = 1;                                               \
+    SET_ERRNO(HPE_PAUSED);                                           \
+    RETURN(p - data + 1);                                            \
+  }                                                                  \
+} while (0)
+
 /* Set the mark FOR; non-destructive if mark is already set */
 #define MARK(FOR)                                                    \
 do {                                                                 \
@@ -286,6 +309,10 @@ enum state
   , s_res_HT
   , s_res_HTT
   , s_res_HTTP
+  , s_res_E
+  , s_res_EV
+  , s_res_EVE
+  , s_res_EVEN
   , s_res_http_major
   , s_res_http_dot
   , s_res_http_minor
@@ -449,6 +476,182 @@ enum http_host_state
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 
 
+#if HTTP_PARSER_FAST_SCAN
+/* Fast scanning of header values and URLs.
+ *
+ * Both functions return a pointer to the first byte in [p, pe) that needs
+ * the state machine's attention, or pe. They only have to be conservative:
+ * every byte they skip is plain, and the byte they stop at is re-checked
+ * exactly by the caller.
+ *
+ * header value: stops at CTLs (including CR, LF and HT) and DEL
+ * URL:          stops at SP, CTLs, DEL, '#', '?' (and bytes >= 0x80 when
+ *               strict), i.e. anything that is not an IS_URL_CHAR that
+ *               keeps s_req_path / s_req_query_string / s_req_fragment
+ */
+#define IS_PLAIN_HEADER_VALUE_CHAR(c)                                          \
+  ((unsigned char)(c) > 31 && (unsigned char)(c) != 127)
+
+#if HTTP_PARSER_STRICT
+#define IS_PLAIN_URL_CHAR(c)                                                   \
+  ((unsigned char)(c) > 32 && (unsigned char)(c) < 127 &&                      \
+   (c) != '#' && (c) != '?')
+#else
+#define IS_PLAIN_URL_CHAR(c)                                                   \
+  ((unsigned char)(c) > 32 && (unsigned char)(c) != 127 &&                     \
+   (c) != '#' && (c) != '?')
+#endif
+
+/* MSVC has no __SSE2__, but x64 always has it */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SCAN_SSE2                1
+#endif
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(SCAN_SSE2)
+# include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+typedef __m256i scan_vec_t;
+# define SCAN_VEC_SIZE            32
+# define SCAN_LOAD(p)             _mm256_loadu_si256((const __m256i *) (p))
+# define SCAN_SET1(c)             _mm256_set1_epi8((char) (c))
+# define SCAN_EQ(a, b)            _mm256_cmpeq_epi8((a), (b))
+# define SCAN_OR(a, b)            _mm256_or_si256((a), (b))
+# define SCAN_LE(a, b)            _mm256_cmpeq_epi8(_mm256_min_epu8((a), (b)), (a))
+# define SCAN_MASK(a)             ((uint32_t) _mm256_movemask_epi8(a))
+#elif defined(SCAN_SSE2)
+typedef __m128i scan_vec_t;
+# define SCAN_VEC_SIZE            16
+# define SCAN_LOAD(p)             _mm_loadu_si128((const __m128i *) (p))
+# define SCAN_SET1(c)             _mm_set1_epi8((char) (c))
+# define SCAN_EQ(a, b)            _mm_cmpeq_epi8((a), (b))
+# define SCAN_OR(a, b)            _mm_or_si128((a), (b))
+# define SCAN_LE(a, b)            _mm_cmpeq_epi8(_mm_min_epu8((a), (b)), (a))
+# define SCAN_MASK(a)             ((uint32_t) _mm_movemask_epi8(a))
+#else
+/* Word at a time (SWAR). size_t is 32 bits on the ESP8266/ESP32, 64 on
+ * most hosts. Only tells whether a word contains a stop byte, not where;
+ * the byte loop finds it.
+ */
+# ifdef __GNUC__
+typedef size_t __attribute__((__may_alias__)) scan_word_t;
+# else
+typedef size_t scan_word_t;
+# endif
+# define SWAR_ONES                ((size_t) -1 / 0xFF)
+# define SWAR_HIGHS               (SWAR_ONES * 0x80)
+/* any byte < n (n <= 128) */
+# define SWAR_HAS_LESS(x, n)      (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+/* any byte == n */
+# define SWAR_HAS_VALUE(x, n)     SWAR_HAS_LESS((x) ^ (SWAR_ONES * (n)), 1)
+# define SCAN_ALIGNED(p)                                                       \
+  (((uintptr_t) (p) & (sizeof(scan_word_t) - 1)) == 0)
+#endif
+
+/* index of the lowest set bit, m != 0 */
+#if defined(__GNUC__)
+# define SCAN_CTZ(m)              __builtin_ctz(m)
+#elif defined(_MSC_VER)
+# include <intrin.h>
+# pragma intrinsic(_BitScanForward)
+static __inline unsigned
+scan_ctz(uint32_t m)
+{
+  unsigned long i;
+  _BitScanForward(&i, m);
+  return (unsigned) i;
+}
+# define SCAN_CTZ(m)              scan_ctz(m)
+#elif defined(SCAN_VEC_SIZE)
+static unsigned
+scan_ctz(uint32_t m)
+{
+  unsigned i = 0;
+  for (; !(m & 1); m >>= 1)
+    i++;
+  return i;
+}
+# define SCAN_CTZ(m)              scan_ctz(m)
+#endif
+
+static const char *
+scan_header_value(const char *p, const char *pe)
+{
+#if defined(SCAN_VEC_SIZE)
+  const scan_vec_t ctl = SCAN_SET1(31);
+  const scan_vec_t del = SCAN_SET1(127);
+
+  for (; pe - p >= SCAN_VEC_SIZE; p += SCAN_VEC_SIZE) {
+    scan_vec_t v = SCAN_LOAD(p);
+    uint32_t m = SCAN_MASK(SCAN_OR(SCAN_LE(v, ctl), SCAN_EQ(v, del)));
+    if (m)
+      return p + SCAN_CTZ(m);
+  }
+#else
+  for (; p != pe && !SCAN_ALIGNED(p); p++) {
+    if (!IS_PLAIN_HEADER_VALUE_CHAR(*p))
+      return p;
+  }
+  for (; (size_t) (pe - p) >= sizeof(scan_word_t); p += sizeof(scan_word_t)) {
+    size_t w = *(const scan_word_t *) p;
+    if (SWAR_HAS_LESS(w, 32) | SWAR_HAS_VALUE(w, 127))
+      break;
+  }
+#endif
+  for (; p != pe; p++) {
+    if (!IS_PLAIN_HEADER_VALUE_CHAR(*p))
+      return p;
+  }
+  return pe;
+}
+
+static const char *
+scan_url(const char *p, const char *pe)
+{
+#if defined(SCAN_VEC_SIZE)
+  const scan_vec_t sp = SCAN_SET1(32);
+  const scan_vec_t del = SCAN_SET1(127);
+  const scan_vec_t hash = SCAN_SET1('#');
+  const scan_vec_t question = SCAN_SET1('?');
+
+  for (; pe - p >= SCAN_VEC_SIZE; p += SCAN_VEC_SIZE) {
+    scan_vec_t v = SCAN_LOAD(p);
+    uint32_t m = SCAN_MASK(SCAN_OR(SCAN_OR(SCAN_LE(v, sp), SCAN_EQ(v, del)),
+                                   SCAN_OR(SCAN_EQ(v, hash), SCAN_EQ(v, question))));
+#if HTTP_PARSER_STRICT
+    m |= SCAN_MASK(v);
+#endif
+    if (m)
+      return p + SCAN_CTZ(m);
+  }
+#else
+  for (; p != pe && !SCAN_ALIGNED(p); p++) {
+    if (!IS_PLAIN_URL_CHAR(*p))
+      return p;
+  }
+  for (; (size_t) (pe - p) >= sizeof(scan_word_t); p += sizeof(scan_word_t)) {
+    size_t w = *(const scan_word_t *) p;
+    size_t m = SWAR_HAS_LESS(w, 33) | SWAR_HAS_VALUE(w, 127) |
+               SWAR_HAS_VALUE(w, '#') | SWAR_HAS_VALUE(w, '?');
+#if HTTP_PARSER_STRICT
+    m |= w & SWAR_HIGHS;
+#endif
+    if (m)
+      break;
+  }
+#endif
+  for (; p != pe; p++) {
+    if (!IS_PLAIN_URL_CHAR(*p))
+      return p;
+  }
+  return pe;
+}
+#endif /* HTTP_PARSER_FAST_SCAN */
+
+
 #if HTTP_PARSER_STRICT
 # define STRICT_CHECK(cond)                                          \
 do {                                                                 \
@@ -635,10 +838,32 @@ parse_url_char(enum state s, const char ch)
   return s_dead;
 }
 
-size_t http_parser_execute (http_parser *parser,
-                            const http_parser_settings *settings,
-                            const char *data,
-                            size_t len)
+struct message_batch {
+  struct http_message_record *records;
+  size_t count;
+  size_t capacity;
+  int paused;   /* set when the batch itself paused the parser */
+};
+
+static void
+batch_record(const http_parser *parser, struct message_batch *batch,
+             const char *begin, const char *data, const char *end)
+{
+  struct http_message_record *r = &batch->records[batch->count++];
+
+  r->partial = (begin == NULL);
+  r->at = begin ? begin : data;
+  r->length = end - r->at;
+  r->method = parser->method;
+  r->status_code = parser->status_code;
+  r->keep_alive = http_should_keep_alive(parser);
+}
+
+static size_t execute (http_parser *parser,
+                       const http_parser_settings *settings,
+                       const char *data,
+                       size_t len,
+                       struct message_batch *batch)
 {
   char c, ch;
   int8_t unhex_val;
@@ -648,6 +873,7 @@ size_t http_parser_execute (http_parser *parser,
   const char *url_mark = 0;
   const char *body_mark = 0;
   const char *status_mark = 0;
+  const char *message_mark = 0;
   enum state p_state = (enum state) parser->state;
   const unsigned int lenient = parser->lenient_http_headers;
   uint32_t nread = parser->nread;
@@ -663,6 +889,9 @@ size_t http_parser_execute (http_parser *parser,
         /* Use of CALLBACK_NOTIFY() here would erroneously return 1 byte read if
          * we got paused.
          */
+        if (batch) {
+          batch_record(parser, batch, NULL, data, data);
+        }
         CALLBACK_NOTIFY_NOADVANCE(message_complete);
         return 0;
 
@@ -733,7 +962,7 @@ reexecute:
         if (ch == 'H') {
           UPDATE_STATE(s_res_or_resp_H);
 
-          CALLBACK_NOTIFY(message_begin);
+          MESSAGE_BEGIN();
         } else {
           parser->type = HTTP_REQUEST;
           UPDATE_STATE(s_start_req);
@@ -769,12 +998,15 @@ reexecute:
 
         if (ch == 'H') {
           UPDATE_STATE(s_res_H);
+        } else if (ch == 'E') {
+          /* HAP notifications: "EVENT/1.0 200 OK" */
+          UPDATE_STATE(s_res_E);
         } else {
           SET_ERRNO(HPE_INVALID_CONSTANT);
           goto error;
         }
 
-        CALLBACK_NOTIFY(message_begin);
+        MESSAGE_BEGIN();
         break;
       }
 
@@ -793,6 +1025,26 @@ reexecute:
         UPDATE_STATE(s_res_HTTP);
         break;
 
+      case s_res_E:
+        STRICT_CHECK(ch != 'V');
+        UPDATE_STATE(s_res_EV);
+        break;
+
+      case s_res_EV:
+        STRICT_CHECK(ch != 'E');
+        UPDATE_STATE(s_res_EVE);
+        break;
+
+      case s_res_EVE:
+        STRICT_CHECK(ch != 'N');
+        UPDATE_STATE(s_res_EVEN);
+        break;
+
+      case s_res_EVEN:
+        STRICT_CHECK(ch != 'T');
+        UPDATE_STATE(s_res_HTTP);
+        break;
+
       case s_res_HTTP:
         STRICT_CHECK(ch != '/');
         UPDATE_STATE(s_res_http_major);
@@ -955,7 +1207,7 @@ reexecute:
         }
         UPDATE_STATE(s_req_method);
 
-        CALLBACK_NOTIFY(message_begin);
+        MESSAGE_BEGIN();
 
         break;
       }
@@ -1082,6 +1334,21 @@ reexecute:
               SET_ERRNO(HPE_INVALID_URL);
               goto error;
             }
+#if HTTP_PARSER_FAST_SCAN
+            /* plain URL chars don't change these states; skip them. stay
+             * within max_header_size so overflow is reported on the same
+             * byte as the byte at a time loop would */
+            if (CURRENT_STATE() == s_req_path ||
+                CURRENT_STATE() == s_req_query_string ||
+                CURRENT_STATE() == s_req_fragment) {
+              const char* q = p + 1;
+              size_t left = data + len - q;
+              const char* pe = q + MIN(left, (size_t) (max_header_size - nread));
+              q = scan_url(q, pe);
+              COUNT_HEADER_SIZE(q - (p + 1));
+              p = q - 1;
+            }
+#endif
         }
         break;
       }
@@ -1221,6 +1488,53 @@ reexecute:
         parser->index = 0;
         UPDATE_STATE(s_header_field);
 
+        /* Usually the whole name is in this buffer: classify it once with
+         * http_header_lookup() and skip to the ':'. Names split across
+         * buffers fall back to the h_C / h_matching_* states below. */
+        {
+          size_t left = data + len - p;
+          const char* pe = p + MIN(left, max_header_size);
+          const char* q = p + 1;
+          const char* end;
+
+          while (q != pe && TOKEN(*q))
+            q++;
+
+          if (q != pe) {
+            /* non-strict TOKEN() lets trailing spaces in, "Upgrade :" */
+            end = q;
+            while (end - 1 > p && end[-1] == ' ')
+              end--;
+
+            switch (http_header_lookup(p, end - p)) {
+              case HTTP_HEADER_CONNECTION:
+              case HTTP_HEADER_PROXY_CONNECTION:
+                parser->header_state = h_connection;
+                break;
+
+              case HTTP_HEADER_CONTENT_LENGTH:
+                parser->header_state = h_content_length;
+                break;
+
+              case HTTP_HEADER_TRANSFER_ENCODING:
+                parser->header_state = h_transfer_encoding;
+                break;
+
+              case HTTP_HEADER_UPGRADE:
+                parser->header_state = h_upgrade;
+                break;
+
+              default:
+                parser->header_state = h_general;
+                break;
+            }
+
+            COUNT_HEADER_SIZE(q - 1 - p);
+            p = q - 1;
+            break;
+          }
+        }
+
         switch (c) {
           case 'c':
             parser->header_state = h_C;
@@ -1501,6 +1815,11 @@ reexecute:
                 const char* pe = p + MIN(left, max_header_size);
 
                 for (; p != pe; p++) {
+#if HTTP_PARSER_FAST_SCAN
+                  p = scan_header_value(p, pe);
+                  if (p == pe)
+                    break;
+#endif
                   ch = *p;
                   if (ch == CR || ch == LF) {
                     --p;
@@ -1837,13 +2156,13 @@ reexecute:
                                 (parser->flags & F_SKIPBODY) || !hasBody)) {
           /* Exit, the rest of the message is in a different protocol. */
           UPDATE_STATE(NEW_MESSAGE());
-          CALLBACK_NOTIFY(message_complete);
+          MESSAGE_COMPLETE();
           RETURN((p - data) + 1);
         }
 
         if (parser->flags & F_SKIPBODY) {
           UPDATE_STATE(NEW_MESSAGE());
-          CALLBACK_NOTIFY(message_complete);
+          MESSAGE_COMPLETE();
         } else if (parser->flags & F_CHUNKED) {
           /* chunked encoding - ignore Content-Length header */
           UPDATE_STATE(s_chunk_size_start);
@@ -1851,7 +2170,7 @@ reexecute:
           if (parser->content_length == 0) {
             /* Content-Length header given but zero: Content-Length: 0\r\n */
             UPDATE_STATE(NEW_MESSAGE());
-            CALLBACK_NOTIFY(message_complete);
+            MESSAGE_COMPLETE();
           } else if (parser->content_length != ULLONG_MAX) {
             /* Content-Length header given and non-zero */
             UPDATE_STATE(s_body_identity);
@@ -1859,7 +2178,7 @@ reexecute:
             if (!http_message_needs_eof(parser)) {
               /* Assume content-length 0 - read the next */
               UPDATE_STATE(NEW_MESSAGE());
-              CALLBACK_NOTIFY(message_complete);
+              MESSAGE_COMPLETE();
             } else {
               /* Read body until EOF */
               UPDATE_STATE(s_body_identity_eof);
@@ -1915,7 +2234,7 @@ reexecute:
 
       case s_message_done:
         UPDATE_STATE(NEW_MESSAGE());
-        CALLBACK_NOTIFY(message_complete);
+        MESSAGE_COMPLETE();
         if (parser->upgrade) {
           /* Exit, the rest of the message is in a different protocol. */
           RETURN((p - data) + 1);
@@ -2465,6 +2784,312 @@ http_parser_parse_url(const char *buf, size_t buflen, int is_connect,
   return 0;
 }
 
+/* Parse the decimal number at *p (advancing it), no sign, no overflow */
+static int
+parse_hap_id_part(const char **p, const char *end, uint32_t *out)
+{
+  const char *q = *p;
+  uint32_t v = 0;
+
+  if (q == end || !IS_NUM(*q)) {
+    return -1;
+  }
+
+  for (; q != end && IS_NUM(*q); q++) {
+    if (v > (UINT32_MAX - (uint32_t) (*q - '0')) / 10) {
+      return -1;
+    }
+    v = v * 10 + (uint32_t) (*q - '0');
+  }
+
+  *p = q;
+  *out = v;
+  return 0;
+}
+
+int
+http_parse_hap_ids(const char *buf, size_t buflen,
+                   struct http_hap_id *ids, size_t max_ids)
+{
+  const char *p = buf;
+  const char *end = buf + buflen;
+  size_t n = 0;
+
+  if (buflen == 0) {
+    return 0;
+  }
+
+  for (;;) {
+    if (n == max_ids) {
+      return -1;
+    }
+
+    if (parse_hap_id_part(&p, end, &ids[n].aid) != 0 ||
+        p == end || *p++ != '.' ||
+        parse_hap_id_part(&p, end, &ids[n].iid) != 0) {
+      return -1;
+    }
+    n++;
+
+    if (p == end) {
+      return (int) n;
+    }
+
+    if (*p++ != ',') {
+      return -1;
+    }
+  }
+}
+
+/* Append v in decimal at buf[pos]; returns the new pos or 0 if it
+ * would not leave room for the terminating NUL */
+static size_t
+format_hap_id_part(char *buf, size_t size, size_t pos, uint32_t v)
+{
+  char digits[10];
+  size_t n = 0;
+
+  do {
+    digits[n++] = (char) ('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+
+  if (pos + n >= size) {
+    return 0;
+  }
+
+  while (n > 0) {
+    buf[pos++] = digits[--n];
+  }
+  return pos;
+}
+
+int
+http_format_hap_ids(char *buf, size_t size,
+                    const struct http_hap_id *ids, size_t num_ids)
+{
+  size_t pos = 0;
+  size_t i;
+
+  if (size == 0) {
+    return -1;
+  }
+
+  for (i = 0; i < num_ids; i++) {
+    if (i > 0) {
+      if (pos + 1 >= size) {
+        goto overflow;
+      }
+      buf[pos++] = ',';
+    }
+
+    pos = format_hap_id_part(buf, size, pos, ids[i].aid);
+    if (pos == 0 || pos + 1 >= size) {
+      goto overflow;
+    }
+    buf[pos++] = '.';
+
+    pos = format_hap_id_part(buf, size, pos, ids[i].iid);
+    if (pos == 0) {
+      goto overflow;
+    }
+  }
+
+  buf[pos] = '\0';
+  return (int) pos;
+
+overflow:
+  buf[0] = '\0';
+  return -1;
+}
+
+/* Perfect hash for HTTP_HEADER_MAP; the designated initializers below
+ * trip -Woverride-init if two names ever land in the same slot */
+#define HEADER_SLOT(len, first, last)                                \
+  (((len) * 3 + (unsigned char) (first) + (unsigned char) (last) * 3) & 15)
+
+static const struct {
+  const char *name;
+  uint8_t len;
+  uint8_t id;
+} header_names[16] = {
+#define XX(id, name, len, first, last)                               \
+  [HEADER_SLOT(len, first, last)] = { name, len, HTTP_HEADER_##id },
+  HTTP_HEADER_MAP(XX)
+#undef XX
+};
+
+enum http_header
+http_header_lookup(const char *name, size_t len)
+{
+  const char *known;
+  size_t slot;
+  size_t i;
+
+  if (len == 0) {
+    return HTTP_HEADER_OTHER;
+  }
+
+  /* tokens[] lowercases token chars and zeroes everything else */
+  slot = HEADER_SLOT(len, tokens[(unsigned char) name[0]],
+                     tokens[(unsigned char) name[len - 1]]);
+  known = header_names[slot].name;
+  if (known == NULL || header_names[slot].len != len) {
+    return HTTP_HEADER_OTHER;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (tokens[(unsigned char) name[i]] != known[i]) {
+      return HTTP_HEADER_OTHER;
+    }
+  }
+
+  return (enum http_header) header_names[slot].id;
+}
+
+struct token_buf {
+  struct http_token *tokens;
+  size_t count;
+  size_t capacity;
+  int paused;   /* set when the buffer itself paused the parser */
+};
+
+static int
+token_push(http_parser *parser, enum http_token_type type,
+           const char *at, size_t length)
+{
+  struct token_buf *buf = (struct token_buf *) parser->data;
+  struct http_token *t = &buf->tokens[buf->count++];
+
+  t->type = type;
+  t->at = at;
+  t->length = length;
+
+  /* Stop before the next token would overflow the array */
+  if (buf->count == buf->capacity) {
+    buf->paused = 1;
+    http_parser_pause(parser, 1);
+  }
+  return 0;
+}
+
+#define TOKEN_CB(FOR, TYPE)                                          \
+static int                                                           \
+token_##FOR(http_parser *parser)                                     \
+{                                                                    \
+  return token_push(parser, TYPE, NULL, 0);                          \
+}
+
+#define TOKEN_DATA_CB(FOR, TYPE)                                     \
+static int                                                           \
+token_##FOR(http_parser *parser, const char *at, size_t length)      \
+{                                                                    \
+  return token_push(parser, TYPE, at, length);                       \
+}
+
+TOKEN_CB(message_begin, HTTP_TOKEN_MESSAGE_BEGIN)
+TOKEN_DATA_CB(url, HTTP_TOKEN_URL)
+TOKEN_DATA_CB(status, HTTP_TOKEN_STATUS)
+TOKEN_DATA_CB(header_field, HTTP_TOKEN_HEADER_FIELD)
+TOKEN_DATA_CB(header_value, HTTP_TOKEN_HEADER_VALUE)
+TOKEN_CB(headers_complete, HTTP_TOKEN_HEADERS_COMPLETE)
+TOKEN_DATA_CB(body, HTTP_TOKEN_BODY)
+TOKEN_CB(message_complete, HTTP_TOKEN_MESSAGE_COMPLETE)
+TOKEN_CB(chunk_header, HTTP_TOKEN_CHUNK_HEADER)
+TOKEN_CB(chunk_complete, HTTP_TOKEN_CHUNK_COMPLETE)
+
+#undef TOKEN_CB
+#undef TOKEN_DATA_CB
+
+static const http_parser_settings token_settings =
+  { token_message_begin
+  , token_url
+  , token_status
+  , token_header_field
+  , token_header_value
+  , token_headers_complete
+  , token_body
+  , token_message_complete
+  , token_chunk_header
+  , token_chunk_complete
+  };
+
+size_t
+http_parser_execute (http_parser *parser,
+                     const http_parser_settings *settings,
+                     const char *data,
+                     size_t len)
+{
+  return execute(parser, settings, data, len, NULL);
+}
+
+size_t
+http_parser_execute_batch (http_parser *parser,
+                           const http_parser_settings *settings,
+                           const char *data,
+                           size_t len,
+                           struct http_message_record *records,
+                           size_t *num_records)
+{
+  struct message_batch batch;
+  size_t nparsed;
+
+  batch.records = records;
+  batch.count = 0;
+  batch.capacity = *num_records;
+  batch.paused = 0;
+
+  if (batch.capacity == 0) {
+    return 0;
+  }
+
+  nparsed = execute(parser, settings, data, len, &batch);
+
+  /* Undo only our own pause; one requested by a callback stays. The two
+   * cannot both happen on one record, as a callback pause returns before
+   * the batch is checked. */
+  if (batch.paused) {
+    http_parser_pause(parser, 0);
+  }
+
+  *num_records = batch.count;
+  return nparsed;
+}
+
+size_t
+http_parser_tokenize(http_parser *parser,
+                     const char *data,
+                     size_t len,
+                     struct http_token *tokens,
+                     size_t *num_tokens)
+{
+  struct token_buf buf;
+  void *user_data;
+  size_t nparsed;
+
+  buf.tokens = tokens;
+  buf.count = 0;
+  buf.capacity = *num_tokens;
+  buf.paused = 0;
+
+  if (buf.capacity == 0) {
+    return 0;
+  }
+
+  user_data = parser->data;
+  parser->data = &buf;
+  nparsed = http_parser_execute(parser, &token_settings, data, len);
+  parser->data = user_data;
+
+  /* A parser paused by the caller before this call stays paused */
+  if (buf.paused) {
+    http_parser_pause(parser, 0);
+  }
+
+  *num_tokens = buf.count;
+  return nparsed;
+}
+
 void
 http_parser_pause(http_parser *parser, int paused) {
   /* Users should only be pausing/unpausing a parser that is not in an error
@@ -52,6 +52,14 @@ typedef unsigned __int64 uint64_t;
 # define HTTP_PARSER_STRICT 1
 #endif
 
+/* Compile with -DHTTP_PARSER_FAST_SCAN=0 to walk header values and URLs one
+ * byte at a time instead of skipping plain runs a word (or, on x86, an
+ * SSE2/AVX2 vector) at a time
+ */
+#ifndef HTTP_PARSER_FAST_SCAN
+# define HTTP_PARSER_FAST_SCAN 1
+#endif
+
 /* Maximium header size allowed. If the macro is not defined
  * before including this header then the default is used. To
  * change the maximum header size, define the macro in the build
@@ -338,6 +346,87 @@ struct http_parser_settings {
 };
 
 
+/* Header names known to http_header_lookup(), which finds them with a
+ * perfect hash on (length, first char, last char). Adding a name whose
+ * hash collides with an existing one fails the build (-Woverride-init).
+ *
+ * XX(id, lowercase name, length, first char, last char)
+ */
+#define HTTP_HEADER_MAP(XX)                                             \
+  XX(HOST,              "host",              4,  'h', 't')              \
+  XX(ACCEPT,            "accept",            6,  'a', 't')              \
+  XX(UPGRADE,           "upgrade",           7,  'u', 'e')              \
+  XX(CONNECTION,        "connection",        10, 'c', 'n')              \
+  XX(KEEP_ALIVE,        "keep-alive",        10, 'k', 'e')              \
+  XX(CONTENT_TYPE,      "content-type",      12, 'c', 'e')              \
+  XX(CONTENT_LENGTH,    "content-length",    14, 'c', 'h')              \
+  XX(ACCEPT_ENCODING,   "accept-encoding",   15, 'a', 'g')              \
+  XX(PROXY_CONNECTION,  "proxy-connection",  16, 'p', 'n')              \
+  XX(TRANSFER_ENCODING, "transfer-encoding", 17, 't', 'g')              \
+
+enum http_header
+  {
+    HTTP_HEADER_OTHER = 0,
+#define XX(id, name, len, first, last) HTTP_HEADER_##id,
+  HTTP_HEADER_MAP(XX)
+#undef XX
+  };
+
+
+/* A HomeKit characteristic address, written "aid.iid" in id lists such as
+ * GET /characteristics?id=1.9,1.10
+ */
+struct http_hap_id {
+  uint32_t aid;
+  uint32_t iid;
+};
+
+
+/* Token types returned by http_parser_tokenize(), one per callback */
+enum http_token_type
+  { HTTP_TOKEN_MESSAGE_BEGIN
+  , HTTP_TOKEN_URL
+  , HTTP_TOKEN_STATUS
+  , HTTP_TOKEN_HEADER_FIELD
+  , HTTP_TOKEN_HEADER_VALUE
+  , HTTP_TOKEN_HEADERS_COMPLETE
+  , HTTP_TOKEN_BODY
+  , HTTP_TOKEN_MESSAGE_COMPLETE
+  , HTTP_TOKEN_CHUNK_HEADER
+  , HTTP_TOKEN_CHUNK_COMPLETE
+  };
+
+
+/* A token points into the buffer passed to http_parser_tokenize(); nothing
+ * is copied. Notification tokens (message begin, headers complete, ...)
+ * have at == NULL and length == 0.
+ *
+ * As with the callbacks, a URL, header or body that straddles two buffers
+ * comes back as two tokens of the same type, one per buffer.
+ */
+struct http_token {
+  enum http_token_type type;
+  const char *at;
+  size_t length;
+};
+
+
+/* One record per message completed by http_parser_execute_batch().
+ *
+ * `at`/`length` cover the bytes of the message that are in the buffer
+ * passed to that call; `partial` is set when the message began in an
+ * earlier buffer (then `at` is the start of this buffer).
+ */
+struct http_message_record {
+  const char *at;
+  size_t length;
+  unsigned int method : 8;       /* requests only */
+  unsigned int status_code : 16; /* responses only */
+  unsigned int keep_alive : 1;   /* http_should_keep_alive() */
+  unsigned int partial : 1;
+};
+
+
 enum http_parser_url_fields
   { UF_SCHEMA           = 0
   , UF_HOST             = 1
@@ -396,6 +485,42 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* Like http_parser_execute(), but also appends a record to `records` for
+ * every message that completes in `data`, so several pipelined requests
+ * can be parsed and then dispatched from a single receive buffer.
+ *
+ * `*num_records` is the capacity on entry and the number stored on return.
+ * Parsing stops after the message that fills the array; the return value
+ * then is less than `len` and the caller continues with `data + consumed`.
+ * Callbacks in `settings` run exactly as with http_parser_execute().
+ */
+size_t http_parser_execute_batch(http_parser *parser,
+                                 const http_parser_settings *settings,
+                                 const char *data,
+                                 size_t len,
+                                 struct http_message_record *records,
+                                 size_t *num_records);
+
+
+/* Pull-style alternative to http_parser_execute(). Parses `data` and stores
+ * up to `*num_tokens` tokens in `tokens`, setting `*num_tokens` to the
+ * number stored. Returns the number of bytes consumed; when the token
+ * array fills up this is less than `len` and the caller continues with
+ * `data + consumed` after processing the tokens. Errors are reported via
+ * `parser->http_errno` exactly like http_parser_execute().
+ *
+ * `parser->data` is used internally for the duration of the call and is
+ * restored before returning. Response bodies are never skipped (there is
+ * no on_headers_complete return value), so use http_parser_execute() for
+ * responses to HEAD.
+ */
+size_t http_parser_tokenize(http_parser *parser,
+                            const char *data,
+                            size_t len,
+                            struct http_token *tokens,
+                            size_t *num_tokens);
+
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns 0, then this should be
  * the last message on the connection.
@@ -424,6 +549,24 @@ int http_parser_parse_url(const char *buf, size_t buflen,
                           int is_connect,
                           struct http_parser_url *u);
 
+/* Parse a HAP id list ("1.9,1.10") into `ids`. Returns the number of ids,
+ * or -1 if the list is malformed or holds more than `max_ids` of them */
+int http_parse_hap_ids(const char *buf, size_t buflen,
+                       struct http_hap_id *ids, size_t max_ids);
+
+/* Buffer size that always fits `n` formatted ids: "4294967295.4294967295"
+ * plus a comma (or the final NUL) is 22 bytes per id */
+#define HTTP_HAP_IDS_SIZE(n) ((n) * 22)
+
+/* Write `ids` as a HAP id list into `buf` and NUL terminate it. Returns the
+ * length written, or -1 (leaving `buf` empty) if it does not fit */
+int http_format_hap_ids(char *buf, size_t size,
+                        const struct http_hap_id *ids, size_t num_ids);
+
+/* Classify a header name (case-insensitive); HTTP_HEADER_OTHER if it is
+ * not in HTTP_HEADER_MAP */
+enum http_header http_header_lookup(const char *name, size_t len);
+
 /* Pause or un-pause the parser; a nonzero value pauses */
 void http_parser_pause(http_parser *parser, int paused);
 
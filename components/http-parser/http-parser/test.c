@@ -20,6 +20,7 @@
  */
 #include "http_parser.h"
 #include <stdlib.h>
+#include <ctype.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h> /* rand */
@@ -1970,6 +1971,28 @@ const struct message responses[] =
   ,.num_chunks_complete= 3
   ,.chunk_lengths= { 2, 2 }
   }
+
+#define HAP_EVENT_NOTIFICATION 28
+, {.name= "HAP EVENT/1.0 notification"
+  ,.type= HTTP_RESPONSE
+  ,.raw= "EVENT/1.0 200 OK\r\n"
+         "Content-Type: application/hap+json\r\n"
+         "Content-Length: 49\r\n"
+         "\r\n"
+         "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":1}]}"
+  ,.should_keep_alive= FALSE
+  ,.message_complete_on_eof= FALSE
+  ,.http_major= 1
+  ,.http_minor= 0
+  ,.status_code= 200
+  ,.response_status= "OK"
+  ,.num_headers= 2
+  ,.headers=
+    { { "Content-Type", "application/hap+json" }
+    , { "Content-Length", "49" }
+    }
+  ,.body= "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":1}]}"
+  }
 };
 
 /* strnlen() is a POSIX.2008 addition. Can't rely on it being available so
@@ -3589,6 +3612,352 @@ test_invalid_header_field_content_error (int req)
   test_invalid_header_content(req, "Foo: B\02ar");
 }
 
+/* Long header values and URLs are skipped a word / vector at a time
+ * (HTTP_PARSER_FAST_SCAN); put the interesting byte at every offset */
+void
+test_long_value_scan (void)
+{
+  char buf[256];
+  char value[80];
+  int i;
+
+  /* offset 0 is the first value byte, handled by s_header_value_start */
+  for (i = 1; i < (int) sizeof(value) - 1; i++) {
+    memset(value, 'a', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+
+    value[i] = '\01';
+    sprintf(buf, "GET / HTTP/1.1\r\nFoo: %s\r\n\r\n", value);
+    test_simple(buf, HPE_INVALID_HEADER_TOKEN);
+
+    sprintf(buf, "GET /%s HTTP/1.1\r\n\r\n", value);
+    test_simple(buf, HPE_INVALID_URL);
+
+    value[i] = '\177';
+    sprintf(buf, "GET / HTTP/1.1\r\nFoo: %s\r\n\r\n", value);
+    test_simple(buf, HPE_INVALID_HEADER_TOKEN);
+
+    value[i] = '\t';
+    sprintf(buf, "GET / HTTP/1.1\r\nFoo: %s\r\n\r\n", value);
+    test_simple(buf, HPE_OK);
+
+    value[i] = '?';
+    sprintf(buf, "GET /%s#frag HTTP/1.1\r\n\r\n", value);
+    test_simple(buf, HPE_OK);
+
+    value[i] = '#';
+    sprintf(buf, "GET /%s?q HTTP/1.1\r\n\r\n", value);
+    test_simple(buf, HPE_OK);
+  }
+}
+
+void
+test_header_lookup (void)
+{
+  static const struct {
+    const char *name;
+    enum http_header id;
+  } known[] = {
+#define XX(id, name, len, first, last) { name, HTTP_HEADER_##id },
+    HTTP_HEADER_MAP(XX)
+#undef XX
+  };
+  char upper[32];
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < ARRAY_SIZE(known); i++) {
+    size_t len = strlen(known[i].name);
+
+    assert(http_header_lookup(known[i].name, len) == known[i].id);
+
+    for (j = 0; j < len; j++)
+      upper[j] = toupper((unsigned char) known[i].name[j]);
+    assert(http_header_lookup(upper, len) == known[i].id);
+
+    /* prefixes and a changed middle byte are not the header */
+    assert(http_header_lookup(known[i].name, len - 1) == HTTP_HEADER_OTHER);
+    upper[len / 2] = '_';
+    assert(http_header_lookup(upper, len) == HTTP_HEADER_OTHER);
+  }
+
+  assert(http_header_lookup("", 0) == HTTP_HEADER_OTHER);
+  assert(http_header_lookup("hxst", 4) == HTTP_HEADER_OTHER);
+  assert(http_header_lookup("content\r\nlength", 15) == HTTP_HEADER_OTHER);
+}
+
+/* http_parser_execute_batch() must report every pipelined message once,
+ * whatever the record capacity and wherever the buffer is split */
+void
+test_execute_batch (void)
+{
+  static const char buf[] =
+    "GET /accessories HTTP/1.1\r\n"
+    "\r\n"
+    "PUT /characteristics HTTP/1.1\r\n"
+    "Content-Length: 2\r\n"
+    "\r\n"
+    "{}"
+    "POST /pair-verify HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "1\r\n"
+    "x\r\n"
+    "0\r\n"
+    "\r\n";
+  static const enum http_method methods[] = { HTTP_GET, HTTP_PUT, HTTP_POST };
+  const size_t buf_len = sizeof(buf) - 1;
+  struct http_message_record records[4];
+  size_t capacity;
+  size_t split;
+
+  for (capacity = 1; capacity <= ARRAY_SIZE(records); capacity++) {
+    http_parser parser;
+    size_t offset = 0;
+    size_t seen = 0;
+    size_t i;
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    while (offset < buf_len) {
+      size_t n = capacity;
+
+      offset += http_parser_execute_batch(&parser, &settings_null,
+                                          buf + offset, buf_len - offset,
+                                          records, &n);
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+
+      for (i = 0; i < n; i++, seen++) {
+        assert(seen < ARRAY_SIZE(methods));
+        assert(records[i].method == methods[seen]);
+        assert(records[i].keep_alive);
+        assert(!records[i].partial);
+      }
+    }
+    assert(seen == ARRAY_SIZE(methods));
+  }
+
+  for (split = 1; split < buf_len; split++) {
+    http_parser parser;
+    size_t total = 0;
+    size_t seen = 0;
+    size_t n;
+    size_t i;
+
+    http_parser_init(&parser, HTTP_REQUEST);
+
+    n = ARRAY_SIZE(records);
+    assert(http_parser_execute_batch(&parser, &settings_null, buf, split,
+                                     records, &n) == split);
+    for (i = 0; i < n; i++, seen++) {
+      assert(!records[i].partial);
+      total += records[i].length;
+    }
+
+    n = ARRAY_SIZE(records);
+    assert(http_parser_execute_batch(&parser, &settings_null, buf + split,
+                                     buf_len - split, records, &n)
+           == buf_len - split);
+    for (i = 0; i < n; i++, seen++) {
+      assert(records[i].method == methods[seen]);
+      assert(records[i].at >= buf + split);
+      assert(records[i].partial == (i == 0 && total < split));
+      if (records[i].partial) {
+        /* the first half of this message was never recorded */
+        total = split;
+      }
+      total += records[i].length;
+    }
+
+    assert(seen == ARRAY_SIZE(methods));
+    assert(total == buf_len);
+  }
+}
+
+static int
+batch_pause_cb (http_parser *p)
+{
+  http_parser_pause(p, 1);
+  return 0;
+}
+
+/* A pause requested by a callback on the message that fills the batch
+ * must still be in effect when http_parser_execute_batch() returns */
+void
+test_execute_batch_pause (void)
+{
+  static const char buf[] =
+    "GET /accessories HTTP/1.1\r\n"
+    "\r\n"
+    "GET /characteristics?id=1.9 HTTP/1.1\r\n"
+    "\r\n";
+  const size_t buf_len = sizeof(buf) - 1;
+  const size_t first_len = sizeof("GET /accessories HTTP/1.1\r\n\r\n") - 1;
+  http_parser_settings settings;
+  struct http_message_record records[1];
+  http_parser parser;
+  size_t parsed;
+  size_t n;
+
+  http_parser_settings_init(&settings);
+  settings.on_message_complete = batch_pause_cb;
+  http_parser_init(&parser, HTTP_REQUEST);
+
+  n = ARRAY_SIZE(records);
+  parsed = http_parser_execute_batch(&parser, &settings, buf, buf_len,
+                                     records, &n);
+  assert(parsed == first_len);
+  assert(n == 1 && records[0].method == HTTP_GET);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+
+  /* still paused: nothing more is parsed until the caller unpauses */
+  n = ARRAY_SIZE(records);
+  assert(http_parser_execute_batch(&parser, &settings, buf + parsed,
+                                   buf_len - parsed, records, &n) == 0);
+  assert(n == 0 && HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+
+  http_parser_pause(&parser, 0);
+  n = ARRAY_SIZE(records);
+  assert(http_parser_execute_batch(&parser, &settings, buf + parsed,
+                                   buf_len - parsed, records, &n)
+         == buf_len - parsed);
+  assert(n == 1 && HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+}
+
+void
+test_hap_ids (void)
+{
+  static const char *bad[] =
+    { "1", "1.", ".1", "1.9,", ",1.9", "1.9,,1.10", "1.9 ", "1..9", "a.9"
+    , "1.-9", "4294967296.1", "1.9.1"
+    };
+  struct http_hap_id ids[4];
+  struct http_hap_id big = { 4294967295u, 4294967295u };
+  char buf[32];
+  size_t i;
+
+  assert(http_parse_hap_ids("1.9,1.10,12.345", 15, ids, 4) == 3);
+  assert(ids[0].aid == 1 && ids[0].iid == 9);
+  assert(ids[1].aid == 1 && ids[1].iid == 10);
+  assert(ids[2].aid == 12 && ids[2].iid == 345);
+
+  assert(http_format_hap_ids(buf, sizeof(buf), ids, 3) == 15);
+  assert(strcmp(buf, "1.9,1.10,12.345") == 0);
+
+  /* exactly fits, then one byte short */
+  assert(http_format_hap_ids(buf, 16, ids, 3) == 15);
+  assert(http_format_hap_ids(buf, 15, ids, 3) == -1 && buf[0] == '\0');
+  assert(http_format_hap_ids(buf, sizeof(buf), ids, 0) == 0 && buf[0] == '\0');
+
+  assert(http_format_hap_ids(buf, sizeof(buf), &big, 1) == 21);
+  assert(http_parse_hap_ids(buf, 21, ids, 4) == 1);
+  assert(ids[0].aid == big.aid && ids[0].iid == big.iid);
+
+  /* only `buflen` bytes are looked at */
+  assert(http_parse_hap_ids("1.9,1.10&type=1", 8, ids, 4) == 2);
+  assert(http_parse_hap_ids("", 0, ids, 4) == 0);
+  assert(http_parse_hap_ids("1.9,1.10,1.11", 13, ids, 2) == -1);
+
+  for (i = 0; i < ARRAY_SIZE(bad); i++) {
+    assert(http_parse_hap_ids(bad[i], strlen(bad[i]), ids, 4) == -1);
+  }
+}
+
+/* http_parser_tokenize() must return the same tokens however small the
+ * token array is */
+void
+test_tokenize (void)
+{
+  static const char buf[] =
+    "POST /characteristics?id=1.9 HTTP/1.1\r\n"
+    "Host: example.local\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "4\r\n"
+    "body\r\n"
+    "0\r\n"
+    "\r\n";
+  static const struct {
+    enum http_token_type type;
+    const char *value;
+  } expected[] =
+    { { HTTP_TOKEN_MESSAGE_BEGIN, NULL }
+    , { HTTP_TOKEN_URL, "/characteristics?id=1.9" }
+    , { HTTP_TOKEN_HEADER_FIELD, "Host" }
+    , { HTTP_TOKEN_HEADER_VALUE, "example.local" }
+    , { HTTP_TOKEN_HEADER_FIELD, "Transfer-Encoding" }
+    , { HTTP_TOKEN_HEADER_VALUE, "chunked" }
+    , { HTTP_TOKEN_HEADERS_COMPLETE, NULL }
+    , { HTTP_TOKEN_CHUNK_HEADER, NULL }
+    , { HTTP_TOKEN_BODY, "body" }
+    , { HTTP_TOKEN_CHUNK_COMPLETE, NULL }
+    , { HTTP_TOKEN_CHUNK_HEADER, NULL }
+    , { HTTP_TOKEN_CHUNK_COMPLETE, NULL }
+    , { HTTP_TOKEN_MESSAGE_COMPLETE, NULL }
+    };
+  const size_t num_expected = ARRAY_SIZE(expected);
+  struct http_token tokens[16];
+  size_t capacity;
+
+  for (capacity = 1; capacity <= ARRAY_SIZE(tokens); capacity++) {
+    http_parser parser;
+    size_t offset = 0;
+    size_t seen = 0;
+    size_t i;
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    parser.data = &parser;
+
+    while (offset < sizeof(buf) - 1) {
+      size_t n = capacity;
+      size_t parsed;
+
+      parsed = http_parser_tokenize(&parser, buf + offset,
+                                    sizeof(buf) - 1 - offset, tokens, &n);
+      assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+      assert(parser.data == &parser);
+      assert(n > 0 && n <= capacity);
+
+      for (i = 0; i < n; i++, seen++) {
+        assert(seen < num_expected);
+        assert(tokens[i].type == expected[seen].type);
+        if (expected[seen].value == NULL) {
+          assert(tokens[i].at == NULL && tokens[i].length == 0);
+        } else {
+          assert(tokens[i].at >= buf && tokens[i].at < buf + sizeof(buf));
+          assert(tokens[i].length == strlen(expected[seen].value));
+          assert(memcmp(tokens[i].at, expected[seen].value,
+                        tokens[i].length) == 0);
+        }
+      }
+      offset += parsed;
+    }
+    assert(seen == num_expected);
+  }
+}
+
+/* http_parser_tokenize() must not clear a pause it did not request */
+void
+test_tokenize_pause (void)
+{
+  static const char buf[] = "GET / HTTP/1.1\r\n\r\n";
+  struct http_token tokens[1];
+  http_parser parser;
+  size_t n;
+
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_pause(&parser, 1);
+
+  n = ARRAY_SIZE(tokens);
+  assert(http_parser_tokenize(&parser, buf, sizeof(buf) - 1, tokens, &n) == 0);
+  assert(n == 0 && HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+
+  /* a full token array pauses and unpauses internally */
+  http_parser_pause(&parser, 0);
+  n = ARRAY_SIZE(tokens);
+  assert(http_parser_tokenize(&parser, buf, sizeof(buf) - 1, tokens, &n) > 0);
+  assert(n == 1 && HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+}
+
 void
 test_invalid_header_field (int req, const char* str)
 {
@@ -4181,6 +4550,13 @@ main (void)
   test_header_cr_no_lf_error(HTTP_RESPONSE);
   test_invalid_header_field_token_error(HTTP_RESPONSE);
   test_invalid_header_field_content_error(HTTP_RESPONSE);
+  test_long_value_scan();
+  test_header_lookup();
+  test_hap_ids();
+  test_tokenize();
+  test_tokenize_pause();
+  test_execute_batch();
+  test_execute_batch_pause();
 
   test_simple_type(
       "POST / HTTP/1.1\r\n"
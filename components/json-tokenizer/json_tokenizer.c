@@ -0,0 +1,354 @@
+#include <string.h>
+
+#include "json_tokenizer.h"
+
+enum state {
+    s_value,                                    // a value is required
+    s_value_or_end,                             // just after '[': a value or ']'
+    s_key_or_end,                               // just after '{': a key or '}'
+    s_key,                                      // after ',' in an object
+    s_colon,
+    s_after_value,                              // ',' or the end of the container
+    s_string,
+    s_escape,
+    s_unicode,
+    s_number,
+    s_literal,
+    s_done,
+    s_error,
+};
+
+static const char *const literals[] = { "true", "false", "null" };
+static const json_token_t literal_tokens[] = { JSON_TOKEN_TRUE, JSON_TOKEN_FALSE, JSON_TOKEN_NULL };
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static void value_append(json_tokenizer_t *t, char c) {
+    if (t->value_len < JSON_TOKENIZER_VALUE_MAX) {
+        t->value[t->value_len++] = c;
+    }
+    else {
+        t->truncated = true;
+    }
+}
+
+static void value_start(json_tokenizer_t *t) {
+    t->value_len = 0;
+    t->truncated = false;
+}
+
+static int emit(json_tokenizer_t *t, json_token_t token) {
+    t->value[t->value_len] = '\0';
+    if (t->callback(t, token, t->value, t->value_len)) {
+        t->state = s_error;
+        return -1;
+    }
+    return 0;
+}
+
+// a scalar or container has just ended
+static void value_done(json_tokenizer_t *t) {
+    t->state = t->depth ? s_after_value : s_done;
+}
+
+static int open_container(json_tokenizer_t *t, bool object) {
+    if (t->depth == JSON_TOKENIZER_MAX_DEPTH) {
+        t->state = s_error;
+        return -1;
+    }
+    value_start(t);
+    if (emit(t, object ? JSON_TOKEN_OBJECT_START : JSON_TOKEN_ARRAY_START)) {
+        return -1;
+    }
+    if (object) {
+        t->in_object |= 1u << t->depth;
+    }
+    else {
+        t->in_object &= ~(1u << t->depth);
+    }
+    t->depth++;
+    t->state = object ? s_key_or_end : s_value_or_end;
+    return 0;
+}
+
+static int close_container(json_tokenizer_t *t, bool object) {
+    t->depth--;
+    value_start(t);
+    if (emit(t, object ? JSON_TOKEN_OBJECT_END : JSON_TOKEN_ARRAY_END)) {
+        return -1;
+    }
+    value_done(t);
+    return 0;
+}
+
+static bool in_object(const json_tokenizer_t *t) {
+    return t->depth && (t->in_object & (1u << (t->depth - 1)));
+}
+
+// Start of a value in s_value / s_value_or_end
+static int start_value(json_tokenizer_t *t, char c) {
+    switch (c) {
+        case '{':
+            return open_container(t, true);
+        case '[':
+            return open_container(t, false);
+        case '"':
+            value_start(t);
+            t->is_key = false;
+            t->state = s_string;
+            return 0;
+        case 't':
+        case 'f':
+        case 'n':
+            t->literal = c == 't' ? 0 : c == 'f' ? 1 : 2;
+            t->literal_pos = 1;
+            t->state = s_literal;
+            return 0;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                value_start(t);
+                value_append(t, c);
+                t->state = s_number;
+                return 0;
+            }
+            t->state = s_error;
+            return -1;
+    }
+}
+
+// \uXXXX as UTF-8 (surrogate pairs are not combined)
+static void append_unicode(json_tokenizer_t *t, uint16_t u) {
+    if (u < 0x80) {
+        value_append(t, u);
+    }
+    else if (u < 0x800) {
+        value_append(t, 0xc0 | (u >> 6));
+        value_append(t, 0x80 | (u & 0x3f));
+    }
+    else {
+        value_append(t, 0xe0 | (u >> 12));
+        value_append(t, 0x80 | ((u >> 6) & 0x3f));
+        value_append(t, 0x80 | (u & 0x3f));
+    }
+}
+
+void json_tokenizer_init(json_tokenizer_t *t, json_token_cb callback, void *data) {
+    memset(t, 0, sizeof(*t));
+    t->callback = callback;
+    t->data = data;
+    t->state = s_value;
+}
+
+int json_tokenizer_feed(json_tokenizer_t *t, const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+
+    while (p < end) {
+        char c = *p;
+
+        switch (t->state) {
+            case s_string: {
+                // copy the run up to the closing quote or an escape in one go
+                const char *run = p;
+                while (p < end && *p != '"' && *p != '\\') {
+                    if ((unsigned char) *p < 0x20) {
+                        t->state = s_error;
+                        return -1;
+                    }
+                    p++;
+                }
+                size_t n = p - run;
+                size_t room = JSON_TOKENIZER_VALUE_MAX - t->value_len;
+                if (n > room) {
+                    n = room;
+                    t->truncated = true;
+                }
+                memcpy(t->value + t->value_len, run, n);
+                t->value_len += n;
+                if (p == end) {
+                    return 0;
+                }
+
+                if (*p == '\\') {
+                    t->state = s_escape;
+                }
+                else if (t->is_key) {
+                    if (emit(t, JSON_TOKEN_KEY)) {
+                        return -1;
+                    }
+                    t->state = s_colon;
+                }
+                else {
+                    if (emit(t, JSON_TOKEN_STRING)) {
+                        return -1;
+                    }
+                    value_done(t);
+                }
+                p++;
+                continue;
+            }
+
+            case s_escape:
+                switch (c) {
+                    case '"':  value_append(t, '"'); break;
+                    case '\\': value_append(t, '\\'); break;
+                    case '/':  value_append(t, '/'); break;
+                    case 'b':  value_append(t, '\b'); break;
+                    case 'f':  value_append(t, '\f'); break;
+                    case 'n':  value_append(t, '\n'); break;
+                    case 'r':  value_append(t, '\r'); break;
+                    case 't':  value_append(t, '\t'); break;
+                    case 'u':
+                        t->unicode = 0;
+                        t->unicode_digits = 0;
+                        t->state = s_unicode;
+                        p++;
+                        continue;
+                    default:
+                        t->state = s_error;
+                        return -1;
+                }
+                t->state = s_string;
+                break;
+
+            case s_unicode: {
+                int digit;
+                if (c >= '0' && c <= '9') {
+                    digit = c - '0';
+                }
+                else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                    digit = (c | 0x20) - 'a' + 10;
+                }
+                else {
+                    t->state = s_error;
+                    return -1;
+                }
+                t->unicode = (t->unicode << 4) | digit;
+                if (++t->unicode_digits == 4) {
+                    append_unicode(t, t->unicode);
+                    t->state = s_string;
+                }
+                break;
+            }
+
+            case s_number:
+                if (is_number_char(c)) {
+                    value_append(t, c);
+                    break;
+                }
+                if (emit(t, JSON_TOKEN_NUMBER)) {
+                    return -1;
+                }
+                value_done(t);
+                // c ends the number and belongs to the next state
+                continue;
+
+            case s_literal:
+                if (c != literals[t->literal][t->literal_pos]) {
+                    t->state = s_error;
+                    return -1;
+                }
+                if (literals[t->literal][++t->literal_pos] == '\0') {
+                    value_start(t);
+                    if (emit(t, literal_tokens[t->literal])) {
+                        return -1;
+                    }
+                    value_done(t);
+                }
+                break;
+
+            case s_value:
+            case s_value_or_end:
+                if (is_space(c)) {
+                    break;
+                }
+                if (c == ']' && t->state == s_value_or_end) {
+                    if (close_container(t, false)) {
+                        return -1;
+                    }
+                    break;
+                }
+                if (start_value(t, c)) {
+                    return -1;
+                }
+                break;
+
+            case s_key_or_end:
+            case s_key:
+                if (is_space(c)) {
+                    break;
+                }
+                if (c == '}' && t->state == s_key_or_end) {
+                    if (close_container(t, true)) {
+                        return -1;
+                    }
+                    break;
+                }
+                if (c != '"') {
+                    t->state = s_error;
+                    return -1;
+                }
+                value_start(t);
+                t->is_key = true;
+                t->state = s_string;
+                break;
+
+            case s_colon:
+                if (is_space(c)) {
+                    break;
+                }
+                if (c != ':') {
+                    t->state = s_error;
+                    return -1;
+                }
+                t->state = s_value;
+                break;
+
+            case s_after_value:
+                if (is_space(c)) {
+                    break;
+                }
+                if (c == ',') {
+                    t->state = in_object(t) ? s_key : s_value;
+                    break;
+                }
+                if (c == (in_object(t) ? '}' : ']')) {
+                    if (close_container(t, in_object(t))) {
+                        return -1;
+                    }
+                    break;
+                }
+                t->state = s_error;
+                return -1;
+
+            case s_done:
+                if (is_space(c)) {
+                    break;
+                }
+                t->state = s_error;
+                return -1;
+
+            default:
+                return -1;
+        }
+        p++;
+    }
+    return 0;
+}
+
+int json_tokenizer_finish(json_tokenizer_t *t) {
+    // a top level number only ends with the input
+    if (t->state == s_number && t->depth == 0) {
+        if (emit(t, JSON_TOKEN_NUMBER)) {
+            return -1;
+        }
+        t->state = s_done;
+    }
+    return t->state == s_done ? 0 : -1;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JSON_TOKENIZER_MAX_DEPTH    32
+#define JSON_TOKENIZER_VALUE_MAX    48          // longer keys/strings/numbers are truncated
+
+typedef enum {
+    JSON_TOKEN_OBJECT_START,
+    JSON_TOKEN_OBJECT_END,
+    JSON_TOKEN_ARRAY_START,
+    JSON_TOKEN_ARRAY_END,
+    JSON_TOKEN_KEY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL,
+} json_token_t;
+
+typedef struct json_tokenizer json_tokenizer_t;
+
+// value/len are set for KEY, STRING (unescaped) and NUMBER (as written).
+//   Return non-zero to stop, json_tokenizer_feed() then fails
+typedef int (*json_token_cb)(json_tokenizer_t *t, json_token_t token, const char *value, size_t len);
+
+// Incremental JSON tokenizer with fixed memory: feed it the document in
+//   pieces of any size (e.g. HTTP body chunks) and it calls back for each
+//   token. Nothing is buffered except the current key/string/number.
+struct json_tokenizer {
+    json_token_cb callback;
+    void *data;                                 // for the callback
+
+    uint8_t depth;                              // containers open around the current token
+    bool truncated;                             // the current value did not fit in value[]
+
+    // private
+    uint8_t state;
+    uint8_t literal;                            // which of true/false/null, and how far matched
+    uint8_t literal_pos;
+    uint8_t unicode_digits;
+    uint16_t unicode;
+    bool is_key;
+    uint32_t in_object;                         // bit per depth: object (1) or array (0)
+    size_t value_len;
+    char value[JSON_TOKENIZER_VALUE_MAX + 1];
+};
+
+void json_tokenizer_init(json_tokenizer_t *t, json_token_cb callback, void *data);
+
+// Returns 0, or -1 on malformed JSON, too much nesting or a callback stop
+int json_tokenizer_feed(json_tokenizer_t *t, const char *data, size_t len);
+
+// End of input: 0 if exactly one complete value was fed, otherwise -1
+int json_tokenizer_finish(json_tokenizer_t *t);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,121 @@
+/* Host tests: make test */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_tokenizer.h"
+
+static char trace[4096];
+
+static const char *const names[] = {
+    "{", "}", "[", "]", "K", "S", "N", "true", "false", "null",
+};
+
+// record "<depth><token>[=value] " for each token
+static int record(json_tokenizer_t *t, json_token_t token, const char *value, size_t len) {
+    size_t used = strlen(trace);
+    if (token == JSON_TOKEN_KEY || token == JSON_TOKEN_STRING || token == JSON_TOKEN_NUMBER) {
+        snprintf(trace + used, sizeof(trace) - used, "%d%s=%.*s%s ", t->depth, names[token],
+                 (int) len, value, t->truncated ? "~" : "");
+    }
+    else {
+        snprintf(trace + used, sizeof(trace) - used, "%d%s ", t->depth, names[token]);
+    }
+    return 0;
+}
+
+static int stop_at_number(json_tokenizer_t *t, json_token_t token, const char *value, size_t len) {
+    (void) t; (void) value; (void) len;
+    return token == JSON_TOKEN_NUMBER;
+}
+
+// tokenize json in pieces of split bytes (0: all at once)
+static int tokenize(const char *json, size_t split) {
+    json_tokenizer_t t;
+    size_t len = strlen(json);
+
+    trace[0] = '\0';
+    json_tokenizer_init(&t, record, NULL);
+    for (size_t i = 0; i < len; i += split ? split : len) {
+        size_t n = split && split < len - i ? split : len - i;
+        if (json_tokenizer_feed(&t, json + i, n)) {
+            return -1;
+        }
+    }
+    return json_tokenizer_finish(&t);
+}
+
+static void expect(const char *json, const char *expected) {
+    char whole[sizeof(trace)];
+
+    assert(tokenize(json, 0) == 0);
+    if (strcmp(trace, expected) != 0) {
+        fprintf(stderr, "%s\n  got:      %s\n  expected: %s\n", json, trace, expected);
+        assert(0);
+    }
+    strcpy(whole, trace);
+
+    // every chunking gives the same tokens
+    for (size_t split = 1; split < strlen(json); split++) {
+        assert(tokenize(json, split) == 0);
+        assert(strcmp(trace, whole) == 0);
+    }
+}
+
+static void expect_error(const char *json) {
+    for (size_t split = 0; split < strlen(json); split++) {
+        if (tokenize(json, split) == 0) {
+            fprintf(stderr, "accepted: %s (split %zu)\n", json, split);
+            assert(0);
+        }
+    }
+}
+
+int main(void) {
+    expect("{\"characteristics\":[{\"aid\":1,\"iid\":10,\"type\":\"00000025-0000-1000-8000-0026BB765291\","
+           "\"value\":true},{\"aid\":1,\"iid\":11,\"value\":75.5}]}",
+           "0{ 1K=characteristics 1[ 2{ 3K=aid 3N=1 3K=iid 3N=10 3K=type "
+           "3S=00000025-0000-1000-8000-0026BB765291 3K=value 3true 2} 2{ 3K=aid 3N=1 3K=iid 3N=11 "
+           "3K=value 3N=75.5 2} 1] 0} ");
+
+    expect(" [ ] ", "0[ 0] ");
+    expect("{}", "0{ 0} ");
+    expect("-12e3", "0N=-12e3 ");
+    expect("[null,false,\"\"]", "0[ 1null 1false 1S= 0] ");
+    expect("\"a\\\"b\\\\c\\/\\n\\u0041\\u00e9\"", "0S=a\"b\\c/\nA\xc3\xa9 ");
+    expect("{\"a\":{\"b\":[1,[2]]}}", "0{ 1K=a 1{ 2K=b 2[ 3N=1 3[ 4N=2 3] 2] 1} 0} ");
+
+    // long values are cut at JSON_TOKENIZER_VALUE_MAX and flagged
+    expect("[\"0123456789012345678901234567890123456789012345678901234567890123456789\"]",
+           "0[ 1S=012345678901234567890123456789012345678901234567~ 0] ");
+
+    assert(tokenize("", 0) == -1);
+    expect_error("{\"a\" 1}");
+    expect_error("{\"a\":1,}");
+    expect_error("[1 2]");
+    expect_error("[1}");
+    expect_error("{\"a\":tru}");
+    expect_error("\"abc");
+    expect_error("{} {}");
+    expect_error("[\"a\nb\"]");
+    expect_error("[\"\\x\"]");
+
+    // nesting is limited to JSON_TOKENIZER_MAX_DEPTH
+    char deep[JSON_TOKENIZER_MAX_DEPTH * 2 + 3];
+    memset(deep, '[', JSON_TOKENIZER_MAX_DEPTH);
+    memset(deep + JSON_TOKENIZER_MAX_DEPTH, ']', JSON_TOKENIZER_MAX_DEPTH);
+    deep[JSON_TOKENIZER_MAX_DEPTH * 2] = '\0';
+    assert(tokenize(deep, 0) == 0);
+    memmove(deep + 1, deep, strlen(deep) + 1);
+    deep[0] = '[';
+    strcat(deep, "]");
+    assert(tokenize(deep, 0) == -1);
+
+    // a callback can stop the tokenizer
+    json_tokenizer_t t;
+    json_tokenizer_init(&t, stop_at_number, NULL);
+    assert(json_tokenizer_feed(&t, "[\"a\",1,2]", 9) == -1);
+
+    printf("json_tokenizer tests passed\n");
+    return 0;
+}
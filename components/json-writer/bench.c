@@ -0,0 +1,156 @@
+/* Host benchmark: render the characteristics PUT body that remote_hk_task
+ * sends, with json_writer and (when built with -DHAVE_CJSON) with cJSON,
+ * and report time and heap allocations per body.
+ *
+ *   make bench && ./bench [iterations]
+ *   make bench CJSON_DIR=$IDF_PATH/components/json/cJSON
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json_writer.h"
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+static const char expected[] =
+    "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":true},"
+    "{\"aid\":1,\"iid\":10,\"value\":75},{\"aid\":2,\"iid\":12,\"value\":3}]}";
+
+static const struct {
+    int aid;
+    int iid;
+    int is_bool;
+    int value;
+} chars[] = {
+    {1, 9, 1, 1},
+    {1, 10, 0, 75},
+    {2, 12, 0, 3},
+};
+
+#define NUM_CHARS (sizeof(chars) / sizeof(chars[0]))
+
+static unsigned long allocations;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t render_writer(char *buf, size_t size) {
+    json_writer_t w;
+    json_writer_init(&w, buf, size);
+    json_write_object_start(&w, NULL);
+    json_write_array_start(&w, "characteristics");
+    for (size_t i = 0; i < NUM_CHARS; i++) {
+        json_write_object_start(&w, NULL);
+        json_write_int(&w, "aid", chars[i].aid);
+        json_write_int(&w, "iid", chars[i].iid);
+        if (chars[i].is_bool) {
+            json_write_bool(&w, "value", chars[i].value);
+        }
+        else {
+            json_write_int(&w, "value", chars[i].value);
+        }
+        json_write_object_end(&w);
+    }
+    json_write_array_end(&w);
+    json_write_object_end(&w);
+    return json_writer_finish(&w);
+}
+
+#ifdef HAVE_CJSON
+static void *counting_malloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+static size_t render_cjson(char *buf, size_t size) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *characteristics = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "characteristics", characteristics);
+    for (size_t i = 0; i < NUM_CHARS; i++) {
+        cJSON *fld;
+        cJSON_AddItemToArray(characteristics, fld = cJSON_CreateObject());
+        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(chars[i].aid));
+        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(chars[i].iid));
+        cJSON_AddItemToObject(fld, "value", chars[i].is_bool ? cJSON_CreateBool(chars[i].value)
+                                                             : cJSON_CreateNumber(chars[i].value));
+    }
+    char *out = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    size_t len = strlen(out);
+    assert(len < size);
+    memcpy(buf, out, len + 1);
+    free(out);
+    return len;
+}
+#endif
+
+static void run(const char *name, size_t (*render)(char *, size_t), long iterations) {
+    char buf[256];
+
+    assert(render(buf, sizeof(buf)) == sizeof(expected) - 1);
+    assert(strcmp(buf, expected) == 0);
+
+    allocations = 0;
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+        render(buf, sizeof(buf));
+    }
+    double elapsed = now() - start;
+
+    printf("%-12s %8.1f ns/body %10.1f MB/s %6.1f allocations/body\n", name,
+           elapsed * 1e9 / iterations,
+           (sizeof(expected) - 1) * iterations / elapsed / 1e6,
+           (double) allocations / iterations);
+}
+
+static void check_writer(void) {
+    char buf[64];
+    json_writer_t w;
+
+    // escaping and nesting
+    json_writer_init(&w, buf, sizeof(buf));
+    json_write_object_start(&w, NULL);
+    json_write_string(&w, "s", "a\"b\\c\n\x01");
+    json_write_array_start(&w, "a");
+    json_write_null(&w, NULL);
+    json_write_int(&w, NULL, -2147483647 - 1);
+    json_write_raw(&w, NULL, "{}");
+    json_write_array_end(&w);
+    json_write_object_end(&w);
+    assert(json_writer_finish(&w) > 0);
+    assert(strcmp(buf, "{\"s\":\"a\\\"b\\\\c\\n\\u0001\",\"a\":[null,-2147483648,{}]}") == 0);
+
+    // overflow reports the size needed and leaves a terminated prefix
+    json_writer_init(&w, buf, 8);
+    json_write_object_start(&w, NULL);
+    json_write_string(&w, "ssid", "network");
+    json_write_object_end(&w);
+    assert(json_writer_finish(&w) == -1);
+    assert(w.len == strlen("{\"ssid\":\"network\"}"));
+    assert(strcmp(buf, "{\"ssid\"") == 0);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+    check_writer();
+
+    run("json_writer", render_writer, iterations);
+#ifdef HAVE_CJSON
+    cJSON_Hooks hooks = { .malloc_fn = counting_malloc, .free_fn = free };
+    cJSON_InitHooks(&hooks);
+    run("cJSON", render_cjson, iterations);
+#else
+    printf("cJSON        not built, set CJSON_DIR to compare\n");
+#endif
+    return 0;
+}
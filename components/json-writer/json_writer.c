@@ -0,0 +1,169 @@
+#include <string.h>
+
+#include "json_writer.h"
+
+static void put_char(json_writer_t *w, char c) {
+    if (w->len + 1 < w->size) {
+        w->buf[w->len] = c;
+    }
+    w->len++;
+}
+
+static void put_mem(json_writer_t *w, const char *s, size_t n) {
+    if (w->len + n < w->size) {
+        memcpy(w->buf + w->len, s, n);
+    }
+    else if (w->len + 1 < w->size) {
+        // keep what fits so the truncated prefix is still readable
+        memcpy(w->buf + w->len, s, w->size - 1 - w->len);
+    }
+    w->len += n;
+}
+
+static void put_str(json_writer_t *w, const char *s) {
+    put_mem(w, s, strlen(s));
+}
+
+static void put_escaped(json_writer_t *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    put_char(w, '"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // copy the plain run before the character that needs escaping
+        put_mem(w, run, s - run);
+        run = s + 1;
+
+        put_char(w, '\\');
+        switch (c) {
+            case '"':  put_char(w, '"'); break;
+            case '\\': put_char(w, '\\'); break;
+            case '\n': put_char(w, 'n'); break;
+            case '\r': put_char(w, 'r'); break;
+            case '\t': put_char(w, 't'); break;
+            case '\b': put_char(w, 'b'); break;
+            case '\f': put_char(w, 'f'); break;
+            default: {
+                char u[5] = {'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                put_mem(w, u, sizeof(u));
+            }
+        }
+    }
+    put_mem(w, run, s - run);
+    put_char(w, '"');
+}
+
+// separator and key for the next value at the current depth
+static void begin_value(json_writer_t *w, const char *key) {
+    uint32_t bit = 1u << (w->depth & (JSON_WRITER_MAX_DEPTH - 1));
+
+    if (w->need_comma & bit) {
+        put_char(w, ',');
+    }
+    w->need_comma |= bit;
+
+    if (key) {
+        put_char(w, '"');
+        put_str(w, key);
+        put_mem(w, "\":", 2);
+    }
+}
+
+static void open_container(json_writer_t *w, const char *key, char c) {
+    begin_value(w, key);
+    put_char(w, c);
+    w->depth++;
+    w->need_comma &= ~(1u << (w->depth & (JSON_WRITER_MAX_DEPTH - 1)));
+}
+
+static void close_container(json_writer_t *w, char c) {
+    if (w->depth) {
+        w->depth--;
+    }
+    put_char(w, c);
+}
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size) {
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->need_comma = 0;
+    w->depth = 0;
+    if (size) {
+        buf[0] = '\0';
+    }
+}
+
+void json_write_object_start(json_writer_t *w, const char *key) {
+    open_container(w, key, '{');
+}
+
+void json_write_object_end(json_writer_t *w) {
+    close_container(w, '}');
+}
+
+void json_write_array_start(json_writer_t *w, const char *key) {
+    open_container(w, key, '[');
+}
+
+void json_write_array_end(json_writer_t *w) {
+    close_container(w, ']');
+}
+
+void json_write_int(json_writer_t *w, const char *key, int32_t value) {
+    char digits[11];
+    int i = sizeof(digits);
+    // negate as unsigned so INT32_MIN works
+    uint32_t u = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+
+    begin_value(w, key);
+    do {
+        digits[--i] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0) {
+        put_char(w, '-');
+    }
+    put_mem(w, digits + i, sizeof(digits) - i);
+}
+
+void json_write_bool(json_writer_t *w, const char *key, bool value) {
+    begin_value(w, key);
+    if (value) {
+        put_mem(w, "true", 4);
+    }
+    else {
+        put_mem(w, "false", 5);
+    }
+}
+
+void json_write_null(json_writer_t *w, const char *key) {
+    begin_value(w, key);
+    put_mem(w, "null", 4);
+}
+
+void json_write_string(json_writer_t *w, const char *key, const char *value) {
+    begin_value(w, key);
+    put_escaped(w, value);
+}
+
+void json_write_raw(json_writer_t *w, const char *key, const char *json) {
+    begin_value(w, key);
+    put_str(w, json);
+}
+
+int json_writer_finish(json_writer_t *w) {
+    if (w->size == 0) {
+        return -1;
+    }
+    if (w->len < w->size) {
+        w->buf[w->len] = '\0';
+        return w->len;
+    }
+    w->buf[w->size - 1] = '\0';
+    return -1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JSON_WRITER_MAX_DEPTH   32
+
+// Writes unformatted JSON straight into a caller's buffer, no allocations.
+//   Like snprintf, len keeps counting once the buffer is full so the
+//   required size is known; json_writer_finish() reports the overflow.
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    uint32_t need_comma;                        // bit per nesting level
+    uint8_t depth;
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size);
+
+// key is the member name inside an object (written as is, not escaped),
+//   NULL for array elements and the top level value
+void json_write_object_start(json_writer_t *w, const char *key);
+void json_write_object_end(json_writer_t *w);
+void json_write_array_start(json_writer_t *w, const char *key);
+void json_write_array_end(json_writer_t *w);
+
+void json_write_int(json_writer_t *w, const char *key, int32_t value);
+void json_write_bool(json_writer_t *w, const char *key, bool value);
+void json_write_null(json_writer_t *w, const char *key);
+void json_write_string(json_writer_t *w, const char *key, const char *value);
+
+// Already rendered JSON, e.g. a config blob read from NVS
+void json_write_raw(json_writer_t *w, const char *key, const char *json);
+
+// NUL terminate. Returns the length, or -1 if it did not fit (buf then holds
+//   a truncated prefix and w->len + 1 is the size that was needed)
+int json_writer_finish(json_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
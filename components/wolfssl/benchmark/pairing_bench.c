@@ -0,0 +1,581 @@
+/*
+   Replays the crypto of a complete HomeKit pair-setup and pair-verify on the
+   host, using the same wolfCrypt calls esp-homekit makes on the accessory.
+
+   Only the accessory side is timed. The controller (iOS) side is computed
+   between steps to produce valid messages, but is excluded from the results.
+
+   All long term keys, the SRP salt and the SRP private values are fixed so
+   every run does the same work. Ephemeral Curve25519 keys come from the RNG,
+   as they do on the device.
+
+   Usage: pairing_bench [-csv] [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/random.h>
+#include <wolfssl/wolfcrypt/srp.h>
+#include <wolfssl/wolfcrypt/sha512.h>
+#include <wolfssl/wolfcrypt/hmac.h>
+#include <wolfssl/wolfcrypt/chacha20_poly1305.h>
+#include <wolfssl/wolfcrypt/curve25519.h>
+#include <wolfssl/wolfcrypt/ed25519.h>
+#include <wolfssl/wolfcrypt/error-crypt.h>
+
+#define DEFAULT_ITERATIONS 10
+
+#define SETUP_CODE "111-11-111"
+#define ACCESSORY_ID "AC:CE:55:01:12:34"
+#define CONTROLLER_ID "6A1E7C2B-1F39-4B8D-9E64-7D2A5C0B3F18"
+
+// 3072-bit group from RFC 5054, generator 5 - as required by HAP
+static const byte srp_N[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xc9, 0x0f, 0xda, 0xa2,
+    0x21, 0x68, 0xc2, 0x34, 0xc4, 0xc6, 0x62, 0x8b, 0x80, 0xdc, 0x1c, 0xd1,
+    0x29, 0x02, 0x4e, 0x08, 0x8a, 0x67, 0xcc, 0x74, 0x02, 0x0b, 0xbe, 0xa6,
+    0x3b, 0x13, 0x9b, 0x22, 0x51, 0x4a, 0x08, 0x79, 0x8e, 0x34, 0x04, 0xdd,
+    0xef, 0x95, 0x19, 0xb3, 0xcd, 0x3a, 0x43, 0x1b, 0x30, 0x2b, 0x0a, 0x6d,
+    0xf2, 0x5f, 0x14, 0x37, 0x4f, 0xe1, 0x35, 0x6d, 0x6d, 0x51, 0xc2, 0x45,
+    0xe4, 0x85, 0xb5, 0x76, 0x62, 0x5e, 0x7e, 0xc6, 0xf4, 0x4c, 0x42, 0xe9,
+    0xa6, 0x37, 0xed, 0x6b, 0x0b, 0xff, 0x5c, 0xb6, 0xf4, 0x06, 0xb7, 0xed,
+    0xee, 0x38, 0x6b, 0xfb, 0x5a, 0x89, 0x9f, 0xa5, 0xae, 0x9f, 0x24, 0x11,
+    0x7c, 0x4b, 0x1f, 0xe6, 0x49, 0x28, 0x66, 0x51, 0xec, 0xe4, 0x5b, 0x3d,
+    0xc2, 0x00, 0x7c, 0xb8, 0xa1, 0x63, 0xbf, 0x05, 0x98, 0xda, 0x48, 0x36,
+    0x1c, 0x55, 0xd3, 0x9a, 0x69, 0x16, 0x3f, 0xa8, 0xfd, 0x24, 0xcf, 0x5f,
+    0x83, 0x65, 0x5d, 0x23, 0xdc, 0xa3, 0xad, 0x96, 0x1c, 0x62, 0xf3, 0x56,
+    0x20, 0x85, 0x52, 0xbb, 0x9e, 0xd5, 0x29, 0x07, 0x70, 0x96, 0x96, 0x6d,
+    0x67, 0x0c, 0x35, 0x4e, 0x4a, 0xbc, 0x98, 0x04, 0xf1, 0x74, 0x6c, 0x08,
+    0xca, 0x18, 0x21, 0x7c, 0x32, 0x90, 0x5e, 0x46, 0x2e, 0x36, 0xce, 0x3b,
+    0xe3, 0x9e, 0x77, 0x2c, 0x18, 0x0e, 0x86, 0x03, 0x9b, 0x27, 0x83, 0xa2,
+    0xec, 0x07, 0xa2, 0x8f, 0xb5, 0xc5, 0x5d, 0xf0, 0x6f, 0x4c, 0x52, 0xc9,
+    0xde, 0x2b, 0xcb, 0xf6, 0x95, 0x58, 0x17, 0x18, 0x39, 0x95, 0x49, 0x7c,
+    0xea, 0x95, 0x6a, 0xe5, 0x15, 0xd2, 0x26, 0x18, 0x98, 0xfa, 0x05, 0x10,
+    0x15, 0x72, 0x8e, 0x5a, 0x8a, 0xaa, 0xc4, 0x2d, 0xad, 0x33, 0x17, 0x0d,
+    0x04, 0x50, 0x7a, 0x33, 0xa8, 0x55, 0x21, 0xab, 0xdf, 0x1c, 0xba, 0x64,
+    0xec, 0xfb, 0x85, 0x04, 0x58, 0xdb, 0xef, 0x0a, 0x8a, 0xea, 0x71, 0x57,
+    0x5d, 0x06, 0x0c, 0x7d, 0xb3, 0x97, 0x0f, 0x85, 0xa6, 0xe1, 0xe4, 0xc7,
+    0xab, 0xf5, 0xae, 0x8c, 0xdb, 0x09, 0x33, 0xd7, 0x1e, 0x8c, 0x94, 0xe0,
+    0x4a, 0x25, 0x61, 0x9d, 0xce, 0xe3, 0xd2, 0x26, 0x1a, 0xd2, 0xee, 0x6b,
+    0xf1, 0x2f, 0xfa, 0x06, 0xd9, 0x8a, 0x08, 0x64, 0xd8, 0x76, 0x02, 0x73,
+    0x3e, 0xc8, 0x6a, 0x64, 0x52, 0x1f, 0x2b, 0x18, 0x17, 0x7b, 0x20, 0x0c,
+    0xbb, 0xe1, 0x17, 0x57, 0x7a, 0x61, 0x5d, 0x6c, 0x77, 0x09, 0x88, 0xc0,
+    0xba, 0xd9, 0x46, 0xe2, 0x08, 0xe2, 0x4f, 0xa0, 0x74, 0xe5, 0xab, 0x31,
+    0x43, 0xdb, 0x5b, 0xfc, 0xe0, 0xfd, 0x10, 0x8e, 0x4b, 0x82, 0xd1, 0x20,
+    0xa9, 0x3a, 0xd2, 0xca, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+static const byte srp_g[] = { 0x05 };
+
+// fixed test vectors
+static const byte srp_salt[16] = {
+    0xbe, 0xb2, 0x53, 0x79, 0xd1, 0xa8, 0x58, 0x1e,
+    0xb5, 0xa7, 0x27, 0x67, 0x3a, 0x24, 0x41, 0xee,
+};
+static const byte srp_b[32] = {
+    0xe4, 0x87, 0xcb, 0x59, 0xd3, 0x1a, 0xc5, 0x50,
+    0x47, 0x1e, 0x81, 0xf0, 0x0f, 0x69, 0x28, 0xe0,
+    0x1d, 0xda, 0x08, 0xe9, 0x74, 0xa0, 0x04, 0xf4,
+    0x9e, 0x61, 0xf5, 0xd1, 0x05, 0x28, 0x4d, 0x20,
+};
+static const byte srp_a[32] = {
+    0x60, 0x97, 0x55, 0x27, 0x03, 0x5c, 0xf2, 0xad,
+    0x19, 0x89, 0x80, 0x6f, 0x04, 0x07, 0x21, 0x0b,
+    0xc8, 0x1e, 0xdc, 0x04, 0xe2, 0x76, 0x2a, 0x56,
+    0xaf, 0xd5, 0x29, 0xdd, 0xda, 0x2d, 0x43, 0x93,
+};
+static const byte accessory_ltsk_seed[32] = {
+    0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60,
+    0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+    0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19,
+    0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60,
+};
+static const byte controller_ltsk_seed[32] = {
+    0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda,
+    0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+    0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24,
+    0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb,
+};
+
+typedef enum {
+    PS_M2_SRP_START,
+    PS_M4_SRP_VERIFY,
+    PS_M6_DECRYPT_M5,
+    PS_M6_VERIFY_CONTROLLER,
+    PS_M6_SIGN_ACCESSORY,
+    PS_M6_ENCRYPT_M6,
+    PV_M2_KEY_AGREEMENT,
+    PV_M2_SIGN_ACCESSORY,
+    PV_M2_ENCRYPT,
+    PV_M4_DECRYPT_M3,
+    PV_M4_VERIFY_CONTROLLER,
+    PV_M4_SESSION_KEYS,
+    STEP_COUNT,
+} step_t;
+
+static const char *step_names[STEP_COUNT] = {
+    "pair-setup M2 srp verifier + B",
+    "pair-setup M4 srp key + proofs",
+    "pair-setup M6 hkdf + decrypt M5",
+    "pair-setup M6 hkdf + verify iOS",
+    "pair-setup M6 hkdf + sign",
+    "pair-setup M6 encrypt M6",
+    "pair-verify M2 x25519",
+    "pair-verify M2 accessory sign",
+    "pair-verify M2 hkdf + encrypt",
+    "pair-verify M4 decrypt M3",
+    "pair-verify M4 verify iOS",
+    "pair-verify M4 hkdf control keys",
+};
+
+static double step_total[STEP_COUNT];
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+#define CHECK(x) do { \
+        int _r = (x); \
+        if (_r != 0) { \
+            fprintf(stderr, "%s:%d %s failed: %d\n", __FILE__, __LINE__, #x, _r); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define STEP_BEGIN() double _step_start = now_ms()
+#define STEP_END(s) step_total[s] += now_ms() - _step_start
+
+// HAP uses K = H(S), not the interleaved SHA of wolfCrypt's default
+static int srp_set_key_h(Srp *srp, byte *secret, word32 size) {
+    wc_Sha512 sha;
+    int r;
+
+    srp->key = (byte*) XMALLOC(WC_SHA512_DIGEST_SIZE, srp->heap, DYNAMIC_TYPE_SRP);
+    if (!srp->key)
+        return MEMORY_E;
+    srp->keySz = WC_SHA512_DIGEST_SIZE;
+
+    r = wc_InitSha512(&sha);
+    if (!r) r = wc_Sha512Update(&sha, secret, size);
+    if (!r) r = wc_Sha512Final(&sha, srp->key);
+    wc_Sha512Free(&sha);
+    return r;
+}
+
+static void srp_init(Srp *srp, SrpSide side) {
+    CHECK(wc_SrpInit(srp, SRP_TYPE_SHA512, side));
+    srp->keyGenFunc_cb = srp_set_key_h;
+    CHECK(wc_SrpSetUsername(srp, (const byte *) "Pair-Setup", 10));
+    CHECK(wc_SrpSetParams(srp, srp_N, sizeof(srp_N), srp_g, sizeof(srp_g),
+                          srp_salt, sizeof(srp_salt)));
+}
+
+static void hkdf(const byte *key, word32 key_size,
+                 const char *salt, const char *info, byte *out, word32 out_size) {
+    CHECK(wc_HKDF(WC_SHA512, key, key_size,
+                  (const byte *) salt, strlen(salt),
+                  (const byte *) info, strlen(info),
+                  out, out_size));
+}
+
+// nonce is 4 zero bytes followed by the 8 byte message label (e.g. "PS-Msg05")
+static void make_nonce(const char *label, byte nonce[CHACHA20_POLY1305_AEAD_IV_SIZE]) {
+    memset(nonce, 0, CHACHA20_POLY1305_AEAD_IV_SIZE);
+    memcpy(nonce + 4, label, 8);
+}
+
+static void seal(const byte *key, const char *label, const byte *in, word32 size,
+                 byte *out) {
+    byte nonce[CHACHA20_POLY1305_AEAD_IV_SIZE];
+    make_nonce(label, nonce);
+    CHECK(wc_ChaCha20Poly1305_Encrypt(key, nonce, NULL, 0, in, size, out, out + size));
+}
+
+static void open_sealed(const byte *key, const char *label, const byte *in, word32 size,
+                        byte *out) {
+    byte nonce[CHACHA20_POLY1305_AEAD_IV_SIZE];
+    make_nonce(label, nonce);
+    CHECK(wc_ChaCha20Poly1305_Decrypt(key, nonce, NULL, 0, in, size - CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE,
+                                      in + size - CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE, out));
+}
+
+static word32 tlv_add(byte *buf, word32 pos, byte type, const byte *value, word32 size) {
+    // values over 255 bytes are split into fragments of the same type
+    do {
+        word32 chunk = size > 255 ? 255 : size;
+        buf[pos++] = type;
+        buf[pos++] = chunk;
+        memcpy(buf + pos, value, chunk);
+        pos += chunk;
+        value += chunk;
+        size -= chunk;
+    } while (size > 0);
+    return pos;
+}
+
+static void import_ed25519(ed25519_key *key, const byte seed[32]) {
+    byte pub[ED25519_PUB_KEY_SIZE];
+    CHECK(wc_ed25519_init(key));
+    CHECK(wc_ed25519_import_private_only(seed, 32, key));
+    CHECK(wc_ed25519_make_public(key, pub, sizeof(pub)));
+    CHECK(wc_ed25519_import_private_key(seed, 32, pub, sizeof(pub), key));
+}
+
+static void verify_ed25519(ed25519_key *key, const byte *sig, const byte *msg, word32 size) {
+    int stat = 0;
+    CHECK(wc_ed25519_verify_msg(sig, ED25519_SIG_SIZE, msg, size, &stat, key));
+    if (!stat) {
+        fprintf(stderr, "ed25519 signature did not verify\n");
+        exit(1);
+    }
+}
+
+static void pair_setup(ed25519_key *accessory_ltsk, ed25519_key *controller_ltsk) {
+    Srp accessory, controller;
+    byte B[384], A[384], proof[WC_SHA512_DIGEST_SIZE];
+    word32 B_size = sizeof(B), A_size = sizeof(A), proof_size = sizeof(proof);
+    byte verifier[384];
+    word32 verifier_size = sizeof(verifier);
+
+    // **** M1 -> M2 ****
+    {
+        STEP_BEGIN();
+        // verifier is generated from the setup code as a client, then switched
+        srp_init(&accessory, SRP_CLIENT_SIDE);
+        CHECK(wc_SrpSetPassword(&accessory, (const byte *) SETUP_CODE, strlen(SETUP_CODE)));
+        CHECK(wc_SrpGetVerifier(&accessory, verifier, &verifier_size));
+        accessory.side = SRP_SERVER_SIDE;
+        CHECK(wc_SrpSetVerifier(&accessory, verifier, verifier_size));
+        CHECK(wc_SrpSetPrivate(&accessory, srp_b, sizeof(srp_b)));
+        CHECK(wc_SrpGetPublic(&accessory, B, &B_size));
+        STEP_END(PS_M2_SRP_START);
+    }
+
+    // controller: M3 (A, M1 proof)
+    srp_init(&controller, SRP_CLIENT_SIDE);
+    CHECK(wc_SrpSetPassword(&controller, (const byte *) SETUP_CODE, strlen(SETUP_CODE)));
+    CHECK(wc_SrpSetPrivate(&controller, srp_a, sizeof(srp_a)));
+    CHECK(wc_SrpGetPublic(&controller, A, &A_size));
+    CHECK(wc_SrpComputeKey(&controller, A, A_size, B, B_size));
+    CHECK(wc_SrpGetProof(&controller, proof, &proof_size));
+
+    // **** M3 -> M4 ****
+    {
+        STEP_BEGIN();
+        CHECK(wc_SrpComputeKey(&accessory, A, A_size, B, B_size));
+        CHECK(wc_SrpVerifyPeersProof(&accessory, proof, proof_size));
+        proof_size = sizeof(proof);
+        CHECK(wc_SrpGetProof(&accessory, proof, &proof_size));
+        STEP_END(PS_M4_SRP_VERIFY);
+    }
+
+    // controller: verify M4, build M5
+    CHECK(wc_SrpVerifyPeersProof(&controller, proof, proof_size));
+
+    byte session_key[32];
+    hkdf(controller.key, controller.keySz, "Pair-Setup-Encrypt-Salt", "Pair-Setup-Encrypt-Info",
+         session_key, sizeof(session_key));
+
+    byte controller_ltpk[ED25519_PUB_KEY_SIZE];
+    word32 ltpk_size = sizeof(controller_ltpk);
+    CHECK(wc_ed25519_export_public(controller_ltsk, controller_ltpk, &ltpk_size));
+
+    byte info[32 + 64 + ED25519_PUB_KEY_SIZE];
+    word32 info_size = 0;
+    hkdf(controller.key, controller.keySz, "Pair-Setup-Controller-Sign-Salt", "Pair-Setup-Controller-Sign-Info",
+         info, 32);
+    info_size = 32;
+    memcpy(info + info_size, CONTROLLER_ID, strlen(CONTROLLER_ID));
+    info_size += strlen(CONTROLLER_ID);
+    memcpy(info + info_size, controller_ltpk, ltpk_size);
+    info_size += ltpk_size;
+
+    byte signature[ED25519_SIG_SIZE];
+    word32 signature_size = sizeof(signature);
+    CHECK(wc_ed25519_sign_msg(info, info_size, signature, &signature_size, controller_ltsk));
+
+    byte tlv[256], encrypted[256 + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE];
+    word32 tlv_size = 0;
+    tlv_size = tlv_add(tlv, tlv_size, 1, (const byte *) CONTROLLER_ID, strlen(CONTROLLER_ID));
+    tlv_size = tlv_add(tlv, tlv_size, 3, controller_ltpk, ltpk_size);
+    tlv_size = tlv_add(tlv, tlv_size, 10, signature, signature_size);
+    seal(session_key, "PS-Msg05", tlv, tlv_size, encrypted);
+    word32 encrypted_size = tlv_size + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE;
+
+    // **** M5 -> M6 ****
+    byte decrypted[256];
+    {
+        STEP_BEGIN();
+        hkdf(accessory.key, accessory.keySz, "Pair-Setup-Encrypt-Salt", "Pair-Setup-Encrypt-Info",
+             session_key, sizeof(session_key));
+        open_sealed(session_key, "PS-Msg05", encrypted, encrypted_size, decrypted);
+        STEP_END(PS_M6_DECRYPT_M5);
+    }
+    {
+        // decrypted TLV is laid out as built above: id, ltpk, signature
+        STEP_BEGIN();
+        const byte *id = decrypted + 2;
+        const byte *ltpk = id + strlen(CONTROLLER_ID) + 2;
+        const byte *sig = ltpk + ED25519_PUB_KEY_SIZE + 2;
+
+        hkdf(accessory.key, accessory.keySz, "Pair-Setup-Controller-Sign-Salt", "Pair-Setup-Controller-Sign-Info",
+             info, 32);
+        info_size = 32;
+        memcpy(info + info_size, id, strlen(CONTROLLER_ID));
+        info_size += strlen(CONTROLLER_ID);
+        memcpy(info + info_size, ltpk, ED25519_PUB_KEY_SIZE);
+        info_size += ED25519_PUB_KEY_SIZE;
+
+        ed25519_key ios_ltpk;
+        CHECK(wc_ed25519_init(&ios_ltpk));
+        CHECK(wc_ed25519_import_public(ltpk, ED25519_PUB_KEY_SIZE, &ios_ltpk));
+        verify_ed25519(&ios_ltpk, sig, info, info_size);
+        wc_ed25519_free(&ios_ltpk);
+        STEP_END(PS_M6_VERIFY_CONTROLLER);
+    }
+
+    byte accessory_ltpk[ED25519_PUB_KEY_SIZE];
+    ltpk_size = sizeof(accessory_ltpk);
+    {
+        STEP_BEGIN();
+        hkdf(accessory.key, accessory.keySz, "Pair-Setup-Accessory-Sign-Salt", "Pair-Setup-Accessory-Sign-Info",
+             info, 32);
+        info_size = 32;
+        memcpy(info + info_size, ACCESSORY_ID, strlen(ACCESSORY_ID));
+        info_size += strlen(ACCESSORY_ID);
+        CHECK(wc_ed25519_export_public(accessory_ltsk, accessory_ltpk, &ltpk_size));
+        memcpy(info + info_size, accessory_ltpk, ltpk_size);
+        info_size += ltpk_size;
+
+        signature_size = sizeof(signature);
+        CHECK(wc_ed25519_sign_msg(info, info_size, signature, &signature_size, accessory_ltsk));
+        STEP_END(PS_M6_SIGN_ACCESSORY);
+    }
+    {
+        STEP_BEGIN();
+        tlv_size = 0;
+        tlv_size = tlv_add(tlv, tlv_size, 1, (const byte *) ACCESSORY_ID, strlen(ACCESSORY_ID));
+        tlv_size = tlv_add(tlv, tlv_size, 3, accessory_ltpk, ltpk_size);
+        tlv_size = tlv_add(tlv, tlv_size, 10, signature, signature_size);
+        seal(session_key, "PS-Msg06", tlv, tlv_size, encrypted);
+        STEP_END(PS_M6_ENCRYPT_M6);
+    }
+
+    // controller: check M6 can be opened
+    open_sealed(session_key, "PS-Msg06", encrypted, tlv_size + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE, decrypted);
+
+    wc_SrpTerm(&accessory);
+    wc_SrpTerm(&controller);
+}
+
+static void pair_verify(WC_RNG *rng, ed25519_key *accessory_ltsk, ed25519_key *controller_ltsk) {
+    // controller: M1 (ephemeral curve25519 public key)
+    curve25519_key controller_key;
+    byte controller_pub[CURVE25519_KEYSIZE];
+    word32 controller_pub_size = sizeof(controller_pub);
+    CHECK(wc_curve25519_init(&controller_key));
+    CHECK(wc_curve25519_make_key(rng, CURVE25519_KEYSIZE, &controller_key));
+    CHECK(wc_curve25519_export_public_ex(&controller_key, controller_pub, &controller_pub_size,
+                                         EC25519_LITTLE_ENDIAN));
+
+    // **** M1 -> M2 ****
+    curve25519_key accessory_key, peer_key;
+    byte accessory_pub[CURVE25519_KEYSIZE];
+    word32 accessory_pub_size = sizeof(accessory_pub);
+    byte shared[CURVE25519_KEYSIZE];
+    word32 shared_size = sizeof(shared);
+    {
+        STEP_BEGIN();
+        CHECK(wc_curve25519_init(&accessory_key));
+        CHECK(wc_curve25519_make_key(rng, CURVE25519_KEYSIZE, &accessory_key));
+        CHECK(wc_curve25519_export_public_ex(&accessory_key, accessory_pub, &accessory_pub_size,
+                                             EC25519_LITTLE_ENDIAN));
+        CHECK(wc_curve25519_init(&peer_key));
+        CHECK(wc_curve25519_import_public_ex(controller_pub, controller_pub_size, &peer_key,
+                                             EC25519_LITTLE_ENDIAN));
+        CHECK(wc_curve25519_shared_secret_ex(&accessory_key, &peer_key, shared, &shared_size,
+                                             EC25519_LITTLE_ENDIAN));
+        STEP_END(PV_M2_KEY_AGREEMENT);
+    }
+
+    byte info[2 * CURVE25519_KEYSIZE + 64];
+    word32 info_size;
+    byte signature[ED25519_SIG_SIZE];
+    word32 signature_size = sizeof(signature);
+    {
+        STEP_BEGIN();
+        info_size = 0;
+        memcpy(info + info_size, accessory_pub, accessory_pub_size);
+        info_size += accessory_pub_size;
+        memcpy(info + info_size, ACCESSORY_ID, strlen(ACCESSORY_ID));
+        info_size += strlen(ACCESSORY_ID);
+        memcpy(info + info_size, controller_pub, controller_pub_size);
+        info_size += controller_pub_size;
+        CHECK(wc_ed25519_sign_msg(info, info_size, signature, &signature_size, accessory_ltsk));
+        STEP_END(PV_M2_SIGN_ACCESSORY);
+    }
+
+    byte session_key[32];
+    byte tlv[256], encrypted[256 + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE];
+    word32 tlv_size;
+    {
+        STEP_BEGIN();
+        hkdf(shared, shared_size, "Pair-Verify-Encrypt-Salt", "Pair-Verify-Encrypt-Info",
+             session_key, sizeof(session_key));
+        tlv_size = 0;
+        tlv_size = tlv_add(tlv, tlv_size, 1, (const byte *) ACCESSORY_ID, strlen(ACCESSORY_ID));
+        tlv_size = tlv_add(tlv, tlv_size, 10, signature, signature_size);
+        seal(session_key, "PV-Msg02", tlv, tlv_size, encrypted);
+        STEP_END(PV_M2_ENCRYPT);
+    }
+
+    // controller: open M2, build M3
+    byte decrypted[256];
+    byte controller_shared[CURVE25519_KEYSIZE];
+    word32 controller_shared_size = sizeof(controller_shared);
+    byte controller_session_key[32];
+    curve25519_key accessory_pub_key;
+    CHECK(wc_curve25519_init(&accessory_pub_key));
+    CHECK(wc_curve25519_import_public_ex(accessory_pub, accessory_pub_size, &accessory_pub_key,
+                                         EC25519_LITTLE_ENDIAN));
+    CHECK(wc_curve25519_shared_secret_ex(&controller_key, &accessory_pub_key, controller_shared,
+                                         &controller_shared_size, EC25519_LITTLE_ENDIAN));
+    hkdf(controller_shared, controller_shared_size, "Pair-Verify-Encrypt-Salt", "Pair-Verify-Encrypt-Info",
+         controller_session_key, sizeof(controller_session_key));
+    open_sealed(controller_session_key, "PV-Msg02", encrypted, tlv_size + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE,
+                decrypted);
+
+    info_size = 0;
+    memcpy(info + info_size, controller_pub, controller_pub_size);
+    info_size += controller_pub_size;
+    memcpy(info + info_size, CONTROLLER_ID, strlen(CONTROLLER_ID));
+    info_size += strlen(CONTROLLER_ID);
+    memcpy(info + info_size, accessory_pub, accessory_pub_size);
+    info_size += accessory_pub_size;
+    signature_size = sizeof(signature);
+    CHECK(wc_ed25519_sign_msg(info, info_size, signature, &signature_size, controller_ltsk));
+
+    tlv_size = 0;
+    tlv_size = tlv_add(tlv, tlv_size, 1, (const byte *) CONTROLLER_ID, strlen(CONTROLLER_ID));
+    tlv_size = tlv_add(tlv, tlv_size, 10, signature, signature_size);
+    seal(controller_session_key, "PV-Msg03", tlv, tlv_size, encrypted);
+    word32 encrypted_size = tlv_size + CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE;
+
+    // **** M3 -> M4 ****
+    {
+        STEP_BEGIN();
+        open_sealed(session_key, "PV-Msg03", encrypted, encrypted_size, decrypted);
+        STEP_END(PV_M4_DECRYPT_M3);
+    }
+    {
+        // accessory looks up the stored LTPK of the controller id
+        STEP_BEGIN();
+        const byte *sig = decrypted + 2 + strlen(CONTROLLER_ID) + 2;
+
+        byte controller_ltpk[ED25519_PUB_KEY_SIZE];
+        word32 ltpk_size = sizeof(controller_ltpk);
+        CHECK(wc_ed25519_export_public(controller_ltsk, controller_ltpk, &ltpk_size));
+
+        ed25519_key ios_ltpk;
+        CHECK(wc_ed25519_init(&ios_ltpk));
+        CHECK(wc_ed25519_import_public(controller_ltpk, ltpk_size, &ios_ltpk));
+        verify_ed25519(&ios_ltpk, sig, info, info_size);
+        wc_ed25519_free(&ios_ltpk);
+        STEP_END(PV_M4_VERIFY_CONTROLLER);
+    }
+    {
+        STEP_BEGIN();
+        byte read_key[32], write_key[32];
+        hkdf(shared, shared_size, "Control-Salt", "Control-Read-Encryption-Key",
+             read_key, sizeof(read_key));
+        hkdf(shared, shared_size, "Control-Salt", "Control-Write-Encryption-Key",
+             write_key, sizeof(write_key));
+        STEP_END(PV_M4_SESSION_KEYS);
+    }
+
+    wc_curve25519_free(&controller_key);
+    wc_curve25519_free(&accessory_key);
+    wc_curve25519_free(&peer_key);
+    wc_curve25519_free(&accessory_pub_key);
+}
+
+int main(int argc, char **argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    int csv = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            csv = 1;
+        } else if (atoi(argv[i]) > 0) {
+            iterations = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "usage: %s [-csv] [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    WC_RNG rng;
+    CHECK(wc_InitRng(&rng));
+
+    ed25519_key accessory_ltsk, controller_ltsk;
+    import_ed25519(&accessory_ltsk, accessory_ltsk_seed);
+    import_ed25519(&controller_ltsk, controller_ltsk_seed);
+
+    for (int i = 0; i < iterations; i++) {
+        pair_setup(&accessory_ltsk, &controller_ltsk);
+        pair_verify(&rng, &accessory_ltsk, &controller_ltsk);
+    }
+
+    double total = 0;
+    for (int s = 0; s < STEP_COUNT; s++) {
+        total += step_total[s] / iterations;
+    }
+
+    if (csv) {
+        printf("step,avg_ms,start_ms\n");
+    } else {
+        printf("HomeKit pairing crypto replay, %d iterations (accessory side, avg per pairing)\n\n", iterations);
+        printf("%-34s %10s %10s\n", "step", "ms", "start ms");
+    }
+
+    double start = 0;
+    for (int s = 0; s < STEP_COUNT; s++) {
+        double avg = step_total[s] / iterations;
+        if (csv) {
+            printf("%s,%.3f,%.3f\n", step_names[s], avg, start);
+        } else {
+            // waterfall: bar offset by the start time, 60 columns for the total
+            int offset = (int) (start / total * 60);
+            int width = (int) (avg / total * 60 + 0.5);
+            printf("%-34s %10.3f %10.3f |%*s", step_names[s], avg, start, offset, "");
+            for (int w = 0; w < (width ? width : 1); w++) {
+                putchar('#');
+            }
+            putchar('\n');
+        }
+        start += avg;
+    }
+
+    double setup = 0;
+    for (int s = PS_M2_SRP_START; s <= PS_M6_ENCRYPT_M6; s++) {
+        setup += step_total[s] / iterations;
+    }
+    if (csv) {
+        printf("pair-setup total,%.3f,0.000\n", setup);
+        printf("pair-verify total,%.3f,%.3f\n", total - setup, setup);
+        printf("total,%.3f,0.000\n", total);
+    } else {
+        printf("\n%-34s %10.3f\n", "pair-setup total", setup);
+        printf("%-34s %10.3f\n", "pair-verify total", total - setup);
+        printf("%-34s %10.3f\n", "total", total);
+    }
+
+    wc_ed25519_free(&accessory_ltsk);
+    wc_ed25519_free(&controller_ltsk);
+    wc_FreeRng(&rng);
+    return 0;
+}
@@ -0,0 +1,54 @@
+# Runs each wolfcrypt_bench_<variant> with -csv and merges the results into
+#  one file:  variant,algorithm,metric,value
+#
+# Invoked by the bench_csv target with -DVARIANTS -DALGOS -DBIN_DIR -DOUTPUT
+#  and optionally -DSIZE_TOOL (binutils 'size') to record wolfCrypt code size
+
+separate_arguments(VARIANTS)
+separate_arguments(ALGOS)
+
+file(WRITE "${OUTPUT}" "variant,algorithm,metric,value\n")
+
+foreach(variant ${VARIANTS})
+  message(STATUS "wolfcrypt_bench_${variant}")
+  execute_process(
+    COMMAND "${BIN_DIR}/wolfcrypt_bench_${variant}" -csv ${ALGOS}
+    OUTPUT_VARIABLE out
+    RESULT_VARIABLE res
+  )
+  if(NOT res EQUAL 0)
+    message(FATAL_ERROR "wolfcrypt_bench_${variant} failed: ${res}")
+  endif()
+
+  # symmetric:  "CHACHA,230.290,8.28,"           (MB/s, cycles per byte)
+  # asymmetric: "ED 25519 sign,0.079,12670.239," (avg ms, ops/sec)
+  set(metrics mb_per_sec cycles_per_byte)
+  string(REPLACE "\n" ";" lines "${out}")
+  foreach(line ${lines})
+    if(line MATCHES "^Asymmetric Ciphers:")
+      set(metrics avg_ms ops_per_sec)
+    elseif(line MATCHES "^([^,]+),([0-9.]+),([0-9.]*),?$")
+      list(GET metrics 0 m1)
+      list(GET metrics 1 m2)
+      file(APPEND "${OUTPUT}" "${variant},${CMAKE_MATCH_1},${m1},${CMAKE_MATCH_2}\n")
+      if(NOT CMAKE_MATCH_3 STREQUAL "")
+        file(APPEND "${OUTPUT}" "${variant},${CMAKE_MATCH_1},${m2},${CMAKE_MATCH_3}\n")
+      endif()
+    endif()
+  endforeach()
+
+  if(SIZE_TOOL)
+    execute_process(
+      COMMAND "${SIZE_TOOL}" -t "${BIN_DIR}/libwolfcrypt_${variant}.a"
+      OUTPUT_VARIABLE size_out
+    )
+    # last line is the total: "text data bss dec hex (TOTALS)"
+    if(size_out MATCHES "\n[ \t]*([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]+[0-9]+[ \t]+[0-9a-f]+[ \t]+\\(TOTALS\\)")
+      file(APPEND "${OUTPUT}" "${variant},wolfcrypt,text_bytes,${CMAKE_MATCH_1}\n")
+      file(APPEND "${OUTPUT}" "${variant},wolfcrypt,data_bytes,${CMAKE_MATCH_2}\n")
+      file(APPEND "${OUTPUT}" "${variant},wolfcrypt,bss_bytes,${CMAKE_MATCH_3}\n")
+    endif()
+  endif()
+endforeach()
+
+message(STATUS "Results written to ${OUTPUT}")
@@ -182,6 +182,68 @@
     #endif
     */
 
+#elif defined(HOMEKIT_HOST_BENCH)
+    // Host (Linux) build of the same profile, used by benchmark/CMakeLists.txt
+    //  Mirrors the ESP8266 defines above. WOLFSSL_ESPIDF itself would pull in
+    //  FreeRTOS and lwIP, so what it defines for the crypto code is repeated below
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <sys/random.h>
+
+    static inline int hwrand_generate_block(uint8_t *buf, size_t len) {
+        size_t i = 0;
+        while (i < len) {
+            ssize_t r = getrandom(buf + i, len - i, 0);
+            if (r <= 0) {
+                return -1;
+            }
+            i += r;
+        }
+        return 0;
+    }
+
+    #define CUSTOM_RAND_GENERATE_BLOCK hwrand_generate_block
+
+    #define WC_NO_HARDEN
+
+    #define WOLFSSL_SHA512
+    #define WOLFCRYPT_HAVE_SRP
+    #define WOLFSSL_BASE64_ENCODE
+    #define NO_SHA
+    #define NO_MD5
+    #define HAVE_CURVE25519
+    #define HAVE_HKDF
+    #define HAVE_CHACHA
+    #define HAVE_POLY1305
+    #define HAVE_ED25519
+    #define NO_SESSION_CACHE
+    #define USE_WOLFSSL_MEMORY
+    #define RSA_LOW_MEMORY
+    #define GCM_SMALL
+    #define USE_SLOW_SHA512
+    #define WOLFCRYPT_ONLY
+//    #define CURVE25519_SMALL                  // set by add_wolfcrypt_variant(small CURVE25519_SMALL ED25519_SMALL)
+//    #define ED25519_SMALL                     //  in benchmark/CMakeLists.txt
+
+    // from WOLFSSL_ESPIDF in wolfssl/wolfcrypt/settings.h, minus FREERTOS and WOLFSSL_LWIP
+    #define SIZEOF_LONG_LONG 8
+    #define NO_WOLFSSL_DIR
+    #define WOLFSSL_NO_CURRDIR
+    #define TFM_TIMING_RESISTANT
+    #define ECC_TIMING_RESISTANT
+    #define WC_RSA_BLINDING
+
+    #define NO_ASN
+    #define NO_AES
+    #define NO_RC4
+    #define NO_RSA
+    #define NO_SHA256
+    #define NO_DH
+    #define NO_DSA
+
+    #define SINGLE_THREADED
+    #define NO_FILESYSTEM
+    #define NO_WRITEV
 
 #endif
 
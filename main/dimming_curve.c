@@ -0,0 +1,34 @@
+#include <sys/param.h>                          // min max functions
+#include <string.h>
+
+#include "dimming_curve.h"
+#include "dimming_curves.h"                     // generated into the build directory
+
+_Static_assert(DIMMING_CURVE_TABLES == DIMMING_CURVES, "tools/gen_dimming_curves.py and dimming_curve_t differ");
+_Static_assert(DIMMING_CURVE_PERIOD_US == PWM_PERIOD_IN_US, "dimming tables generated for another PWM period");
+
+static const char *curve_names[DIMMING_CURVES] = {
+    [DIMMING_CURVE_GAMMA] = "gamma",
+    [DIMMING_CURVE_CIE1931] = "cie1931",
+    [DIMMING_CURVE_LINEAR] = "linear",
+};
+
+uint32_t dimming_curve_duty(dimming_curve_t curve, int brightness) {
+    if (curve >= DIMMING_CURVES) {
+        curve = DIMMING_CURVE_GAMMA;
+    }
+    return dimming_curve_tables[curve][MIN(100, MAX(0, brightness))];
+}
+
+const char *dimming_curve_name(dimming_curve_t curve) {
+    return curve < DIMMING_CURVES ? curve_names[curve] : curve_names[DIMMING_CURVE_GAMMA];
+}
+
+dimming_curve_t dimming_curve_from_name(const char *name) {
+    for (int curve = 0; curve < DIMMING_CURVES; curve++) {
+        if (name && strcmp(name, curve_names[curve]) == 0) {
+            return curve;
+        }
+    }
+    return DIMMING_CURVE_GAMMA;
+}
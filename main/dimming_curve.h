@@ -0,0 +1,30 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// How a light's brightness (0-100%) maps to PWM duty. The tables are
+//   generated at build time for the PWM period (tools/gen_dimming_curves.py),
+//   so setting a duty is a lookup, with no floating point
+typedef enum {
+    DIMMING_CURVE_GAMMA = 0,                    // 2.2 gamma from 20%, the original curve and the default
+    DIMMING_CURVE_CIE1931,                      // perceived lightness, darker at the bottom
+    DIMMING_CURVE_LINEAR,
+    DIMMING_CURVES,
+} dimming_curve_t;
+
+// PWM duty in microseconds for brightness, which is clamped to 0..100
+uint32_t dimming_curve_duty(dimming_curve_t curve, int brightness);
+
+// "gamma", "cie1931" or "linear"
+const char *dimming_curve_name(dimming_curve_t curve);
+
+// The curve called name, DIMMING_CURVE_GAMMA if there is none
+dimming_curve_t dimming_curve_from_name(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
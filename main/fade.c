@@ -0,0 +1,218 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <freertos/timers.h>
+
+#include <sys/param.h>                          // min max functions
+#include <string.h>
+
+#include "pwm_batch.h"
+
+#include "fade.h"
+
+#include "esp_log.h"
+static const char *TAG = "fade";
+
+// Positions are in 1/256 steps along the curve: 0 is off, (b + 1) << 8 is brightness b
+#define POS_OFF                 0
+#define POS(brightness)         (((brightness) + 1) << 8)
+
+typedef struct {
+    bool used;
+    dimming_curve_t curve;
+    int32_t pos;
+    int32_t from;
+    int32_t to;
+    TickType_t start;
+    TickType_t ticks;                           // the whole fade
+    bool active;
+    bool pending;                               // set in a transaction, starts at fade_end()
+} fade_channel_t;
+
+static fade_channel_t channels[FADE_CHANNELS];
+static SemaphoreHandle_t fade_mutex = NULL;
+static int transaction_depth;
+static TimerHandle_t frame_timer = NULL;
+static fade_frame_cb frame_cb;
+
+// Duty for a position, interpolated between the table entries either side
+static uint32_t duty_at(const fade_channel_t *ch) {
+    int step = ch->pos >> 8;
+    int frac = ch->pos & 0xff;
+
+    if (step == 0) {
+        // between off and 0%
+        return dimming_curve_duty(ch->curve, 0) * frac / 256;
+    }
+    uint32_t low = dimming_curve_duty(ch->curve, step - 1);
+    uint32_t high = dimming_curve_duty(ch->curve, step);
+    return low + ((int32_t)(high - low) * frac) / 256;
+}
+
+// take fade_mutex before calling
+static void set_target(fade_channel_t *ch, int32_t to, uint32_t ms) {
+    ch->from = ch->pos;
+    ch->to = to;
+    ch->start = xTaskGetTickCount();
+    ch->ticks = pdMS_TO_TICKS(ms);
+    ch->active = true;
+    ch->pending = transaction_depth > 0;
+    if (ch->ticks == 0) {
+        ch->pos = to;
+    }
+}
+
+// Move every active channel to where it should be now and stage its duty.
+//   Returns whether any is still fading. Take fade_mutex before calling
+static bool step_channels(TickType_t now) {
+    bool busy = false;
+
+    for (int i = 0; i < FADE_CHANNELS; i++) {
+        fade_channel_t *ch = &channels[i];
+        if (!ch->active || ch->pending) {
+            continue;
+        }
+
+        TickType_t elapsed = now - ch->start;
+        if (elapsed >= ch->ticks) {
+            ch->pos = ch->to;
+            ch->active = false;
+        }
+        else {
+            ch->pos = ch->from + (ch->to - ch->from) * (int32_t)elapsed / (int32_t)ch->ticks;
+            busy = true;
+        }
+        pwm_batch_set_duty(i, duty_at(ch));
+    }
+    return busy;
+}
+
+// Start whatever was set outside a transaction, or at the end of one, together:
+//   jumps are committed now, fades run from the frame timer. Take fade_mutex before calling
+static void commit_targets(void) {
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < FADE_CHANNELS; i++) {
+        if (channels[i].pending) {
+            channels[i].start = now;
+            channels[i].pending = false;
+        }
+    }
+    step_channels(now);
+    pwm_batch_commit();
+    xTimerStart(frame_timer, 0);
+}
+
+static void frame_timer_callback(TimerHandle_t timer) {
+    // busy with a new target: pick it up next frame
+    if (xSemaphoreTake(fade_mutex, 0) != pdTRUE) {
+        return;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    bool busy = step_channels(now);
+
+    // one pwm_start for every channel that changed this frame
+    pwm_batch_commit();
+
+    if (frame_cb && frame_cb(now)) {
+        busy = true;
+    }
+
+    // stop under fade_mutex, so a fade_to() right after restarts the timer
+    if (!busy) {
+        xTimerStop(frame_timer, 0);
+    }
+    xSemaphoreGive(fade_mutex);
+}
+
+esp_err_t fade_init(fade_frame_cb on_frame) {
+    frame_cb = on_frame;
+
+    if (pwm_batch_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    fade_mutex = xSemaphoreCreateMutex();
+    frame_timer = xTimerCreate("fade", pdMS_TO_TICKS(FADE_FRAME_MS), pdTRUE, NULL, frame_timer_callback);
+    if (!fade_mutex || !frame_timer) {
+        ESP_LOGE(TAG, "mutex or timer create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fade_add_channel(uint8_t channel, dimming_curve_t curve) {
+    if (channel >= FADE_CHANNELS) {
+        ESP_LOGE(TAG, "PWM channel %d, only %d can fade", channel, FADE_CHANNELS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    memset(&channels[channel], 0, sizeof(channels[channel]));
+    channels[channel].used = true;
+    channels[channel].curve = curve;
+    xSemaphoreGive(fade_mutex);
+    return ESP_OK;
+}
+
+void fade_to(uint8_t channel, bool on, int brightness, uint32_t ms) {
+    if (channel >= FADE_CHANNELS || !channels[channel].used) {
+        return;
+    }
+    int32_t to = on ? POS(MIN(100, MAX(0, brightness))) : POS_OFF;
+
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    set_target(&channels[channel], to, ms);
+    if (transaction_depth == 0) {
+        commit_targets();
+    }
+    xSemaphoreGive(fade_mutex);
+}
+
+void fade_sweep(uint8_t channel, int brightness, uint32_t sweep_ms) {
+    if (channel >= FADE_CHANNELS || !channels[channel].used) {
+        return;
+    }
+    int32_t to = POS(MIN(100, MAX(0, brightness)));
+
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    fade_channel_t *ch = &channels[channel];
+    uint32_t distance = to > ch->pos ? to - ch->pos : ch->pos - to;
+    set_target(ch, to, distance * sweep_ms / (POS(100) - POS(0)));
+    if (transaction_depth == 0) {
+        commit_targets();
+    }
+    xSemaphoreGive(fade_mutex);
+}
+
+int fade_stop(uint8_t channel) {
+    if (channel >= FADE_CHANNELS || !channels[channel].used) {
+        return 0;
+    }
+
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    fade_channel_t *ch = &channels[channel];
+    ch->active = false;
+    ch->pending = false;
+    // round to the nearest whole brightness
+    int brightness = ch->pos < POS(0) ? 0 : MIN(100, ((ch->pos + 128) >> 8) - 1);
+    xSemaphoreGive(fade_mutex);
+    return brightness;
+}
+
+void fade_begin(void) {
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    transaction_depth++;
+    xSemaphoreGive(fade_mutex);
+}
+
+void fade_end(void) {
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    if (transaction_depth > 0 && --transaction_depth == 0) {
+        commit_targets();
+    }
+    xSemaphoreGive(fade_mutex);
+}
+
+void fade_wake(void) {
+    xSemaphoreTake(fade_mutex, portMAX_DELAY);
+    xTimerStart(frame_timer, 0);
+    xSemaphoreGive(fade_mutex);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "dimming_curve.h"
+#include "pwm_batch.h"
+
+#define FADE_FRAME_MS           20              // 50 frames a second, two ticks at 100Hz
+#define FADE_CHANNELS           PWM_BATCH_CHANNELS  // PWM channels, one per local dimmer
+
+// Moves every PWM channel toward its target a little each frame, from one
+//   shared timer that only runs while something is fading. Channels move
+//   along their dimming curve, so a fade looks even all the way, and off is
+//   one step below 0% so fading on and off is smooth too. Each frame's
+//   duties go out in one pwm_batch commit.
+
+// Other work to do each frame, in the timer task, e.g. remote dimming.
+//   Return true to keep the frames coming. Must not call fade_*()
+typedef bool (*fade_frame_cb)(TickType_t now);
+
+esp_err_t fade_init(fade_frame_cb on_frame);
+
+// Fade PWM channel (as given to pwm_init), which starts off
+esp_err_t fade_add_channel(uint8_t channel, dimming_curve_t curve);
+
+// Fade channel to brightness (0-100), or to off, over ms. With 0 it jumps
+//   there, committed before returning (or at fade_end())
+void fade_to(uint8_t channel, bool on, int brightness, uint32_t ms);
+
+// Fade channel to brightness at a steady rate, sweep_ms per 0% to 100%,
+//   from wherever it is now. For hold to dim
+void fade_sweep(uint8_t channel, int brightness, uint32_t sweep_ms);
+
+// Stop channel where it is. Returns its brightness then, 0 if it is off
+int fade_stop(uint8_t channel);
+
+// Changes between these start together at fade_end(), so several lights
+//   changing at once do it in one PWM commit. They nest
+void fade_begin(void);
+void fade_end(void);
+
+// Start the frames if they are not running, so on_frame is called
+void fade_wake(void);
+
+#ifdef __cplusplus
+}
+#endif
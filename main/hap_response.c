@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hap_response.h"
+
+#include "esp_log.h"
+static const char *TAG = "hap_response";
+
+enum {
+    KEY_OTHER,
+    KEY_AID,
+    KEY_IID,
+    KEY_TYPE,
+    KEY_VALUE,
+};
+
+// depth of the tokens we look at:
+//   0 {"characteristics": 1 [ 2 {"aid": 3 1, ...} ] }
+static int on_token(json_tokenizer_t *t, json_token_t token, const char *value, size_t len) {
+    hap_response_t *r = t->data;
+
+    if (t->depth == 1) {
+        if (token == JSON_TOKEN_KEY) {
+            r->in_characteristics = strcmp(value, "characteristics") == 0;
+        }
+        else if (token != JSON_TOKEN_ARRAY_START) {
+            r->in_characteristics = false;
+        }
+        return 0;
+    }
+    if (!r->in_characteristics) {
+        return 0;
+    }
+
+    if (t->depth == 2) {
+        if (token == JSON_TOKEN_OBJECT_START) {
+            memset(&r->current, 0, sizeof(r->current));
+            r->key = KEY_OTHER;
+        }
+        else if (token == JSON_TOKEN_OBJECT_END) {
+            if (r->num_chars < HAP_RESPONSE_MAX_CHARS) {
+                r->chars[r->num_chars++] = r->current;
+            }
+            else {
+                r->dropped++;
+            }
+        }
+        return 0;
+    }
+    if (t->depth != 3) {
+        return 0;
+    }
+
+    hap_char_t *c = &r->current;
+    switch (token) {
+        case JSON_TOKEN_KEY:
+            r->key = strcmp(value, "aid") == 0 ? KEY_AID :
+                     strcmp(value, "iid") == 0 ? KEY_IID :
+                     strcmp(value, "type") == 0 ? KEY_TYPE :
+                     strcmp(value, "value") == 0 ? KEY_VALUE : KEY_OTHER;
+            break;
+        case JSON_TOKEN_NUMBER:
+            if (r->key == KEY_AID) {
+                c->aid = strtoul(value, NULL, 10);
+            }
+            else if (r->key == KEY_IID) {
+                c->iid = strtoul(value, NULL, 10);
+            }
+            else if (r->key == KEY_VALUE) {
+                c->value = strtol(value, NULL, 10);
+                c->has_value = true;
+            }
+            break;
+        case JSON_TOKEN_TRUE:
+        case JSON_TOKEN_FALSE:
+            if (r->key == KEY_VALUE) {
+                c->value = token == JSON_TOKEN_TRUE;
+                c->has_value = true;
+            }
+            break;
+        case JSON_TOKEN_STRING:
+            if (r->key == KEY_TYPE && len < sizeof(c->type)) {
+                memcpy(c->type, value, len + 1);
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+void hap_response_init(hap_response_t *r) {
+    r->num_chars = 0;
+    r->dropped = 0;
+    r->in_characteristics = false;
+    r->error = false;
+    json_tokenizer_init(&r->tokenizer, on_token, r);
+}
+
+esp_err_t hap_response_feed(hap_response_t *r, const char *data, size_t len) {
+    if (r->error) {
+        return ESP_FAIL;
+    }
+    if (json_tokenizer_feed(&r->tokenizer, data, len)) {
+        ESP_LOGE(TAG, "malformed json");
+        r->error = true;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t hap_response_finish(hap_response_t *r) {
+    if (r->error || json_tokenizer_finish(&r->tokenizer)) {
+        return ESP_FAIL;
+    }
+    if (r->dropped) {
+        ESP_LOGW(TAG, "%d characteristics beyond %d ignored", r->dropped, HAP_RESPONSE_MAX_CHARS);
+    }
+    return ESP_OK;
+}
+
+int hap_response_on_data(void *ctx, const char *data, size_t len) {
+    hap_response_t *r = ctx;
+    // NULL: a new response body starts (http_pool retries on a new connection)
+    if (!data) {
+        hap_response_init(r);
+        return 0;
+    }
+    return hap_response_feed(r, data, len) == ESP_OK ? 0 : -1;
+}
+
+const hap_char_t *hap_response_find(const hap_response_t *r, uint32_t aid, uint32_t iid) {
+    for (int i = 0; i < r->num_chars; i++) {
+        if (r->chars[i].aid == aid && r->chars[i].iid == iid) {
+            return &r->chars[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "json_tokenizer.h"
+
+#define HAP_RESPONSE_MAX_CHARS  8               // characteristics kept from one response
+
+typedef struct {
+    uint32_t aid;
+    uint32_t iid;
+    char type[40];                              // empty unless requested with type=1
+    int value;                                  // bools as 0/1, numbers truncated to int
+    bool has_value;                             // false for string/null values
+} hap_char_t;
+
+// {"characteristics":[{"aid","iid","type","value"}, ...]} from a GET response
+//   or EVENT/1.0 body, read as it arrives with fixed memory. Only the fields
+//   above are kept, so a large accessory response is never truncated.
+typedef struct {
+    json_tokenizer_t tokenizer;
+    hap_char_t chars[HAP_RESPONSE_MAX_CHARS];
+    int num_chars;
+    int dropped;                                // characteristics beyond HAP_RESPONSE_MAX_CHARS
+
+    // private
+    bool in_characteristics;
+    uint8_t key;
+    bool error;
+    hap_char_t current;
+} hap_response_t;
+
+void hap_response_init(hap_response_t *r);
+
+esp_err_t hap_response_feed(hap_response_t *r, const char *data, size_t len);
+
+// ESP_OK if the body was complete, valid JSON
+esp_err_t hap_response_finish(hap_response_t *r);
+
+// http_pool_data_cb for streaming a response body into ctx (a hap_response_t)
+int hap_response_on_data(void *ctx, const char *data, size_t len);
+
+const hap_char_t *hap_response_find(const hap_response_t *r, uint32_t aid, uint32_t iid);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,434 @@
+#include <string.h>
+#include <stdio.h>
+
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/random.h>
+#include <wolfssl/wolfcrypt/hmac.h>
+#include <wolfssl/wolfcrypt/chacha20_poly1305.h>
+#include <wolfssl/wolfcrypt/curve25519.h>
+#include <wolfssl/wolfcrypt/ed25519.h>
+
+#include "nvs.h"
+
+#include "hap_session.h"
+
+#include "esp_log.h"
+static const char *TAG = "hap_session";
+
+// TLV8 types used by pair-verify
+#define TLV_IDENTIFIER      0x01
+#define TLV_PUBLIC_KEY      0x03
+#define TLV_ENCRYPTED_DATA  0x05
+#define TLV_STATE           0x06
+#define TLV_ERROR           0x07
+#define TLV_SIGNATURE       0x0a
+
+#define TAG_SIZE            CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE
+#define NONCE_SIZE          CHACHA20_POLY1305_AEAD_IV_SIZE
+
+static WC_RNG rng;
+static ed25519_key controller_key;
+static char controller_id[HAP_SESSION_ID_SIZE];
+static bool identity_loaded;
+
+static size_t tlv_add(uint8_t *buf, size_t pos, size_t size, uint8_t type, const uint8_t *value, size_t len) {
+    // values over 255 bytes are split into fragments of the same type
+    do {
+        size_t chunk = len > 255 ? 255 : len;
+        if (pos + 2 + chunk > size) {
+            return 0;
+        }
+        buf[pos++] = type;
+        buf[pos++] = chunk;
+        memcpy(buf + pos, value, chunk);
+        pos += chunk;
+        value += chunk;
+        len -= chunk;
+    } while (len > 0);
+    return pos;
+}
+
+// Copy the value of type (fragments joined) into out. Returns its length,
+//   or -1 if it is missing or larger than size
+static int tlv_get(const uint8_t *tlv, size_t tlv_len, uint8_t type, uint8_t *out, size_t size) {
+    size_t pos = 0;
+    int len = -1;
+
+    while (pos + 2 <= tlv_len) {
+        uint8_t t = tlv[pos];
+        size_t chunk = tlv[pos + 1];
+        if (pos + 2 + chunk > tlv_len) {
+            return -1;
+        }
+        if (t == type) {
+            len = len < 0 ? 0 : len;
+            if (len + chunk > size) {
+                return -1;
+            }
+            memcpy(out + len, tlv + pos + 2, chunk);
+            len += chunk;
+        }
+        else if (len >= 0) {
+            // a different type ends the fragments
+            break;
+        }
+        pos += 2 + chunk;
+    }
+    return len;
+}
+
+static int hkdf(const uint8_t *key, const char *salt, const char *info, uint8_t *out) {
+    return wc_HKDF(WC_SHA512, key, HAP_SESSION_KEY_SIZE, (const byte *) salt, strlen(salt),
+                   (const byte *) info, strlen(info), out, HAP_SESSION_KEY_SIZE);
+}
+
+// 4 zero bytes, then the 8 byte label (pair-verify) or little-endian counter (frames)
+static void make_nonce(uint8_t *nonce, const char *label, uint64_t counter) {
+    memset(nonce, 0, NONCE_SIZE);
+    if (label) {
+        memcpy(nonce + 4, label, 8);
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        nonce[4 + i] = counter >> (8 * i);
+    }
+}
+
+esp_err_t hap_session_init_identity(void) {
+    uint8_t seed[ED25519_KEY_SIZE];
+    uint8_t pub[ED25519_PUB_KEY_SIZE];
+    size_t seed_size = sizeof(seed);
+    size_t id_size = sizeof(controller_id);
+    nvs_handle handle;
+
+    if (identity_loaded) {
+        return ESP_OK;
+    }
+    if (wc_InitRng(&rng) != 0 || wc_ed25519_init(&controller_key) != 0) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = nvs_open("hap_client", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs_open err %d", err);
+        return err;
+    }
+
+    if (nvs_get_blob(handle, "ltsk", seed, &seed_size) != ESP_OK || seed_size != sizeof(seed) ||
+        nvs_get_str(handle, "id", controller_id, &id_size) != ESP_OK) {
+        // first use: a new long-term key, and a random UUID as the pairing identifier
+        uint8_t uuid[16];
+        word32 size = sizeof(seed);
+        if (wc_ed25519_make_key(&rng, ED25519_KEY_SIZE, &controller_key) != 0 ||
+            wc_ed25519_export_private_only(&controller_key, seed, &size) != 0 ||
+            wc_RNG_GenerateBlock(&rng, uuid, sizeof(uuid)) != 0) {
+            nvs_close(handle);
+            return ESP_FAIL;
+        }
+        uuid[6] = (uuid[6] & 0x0f) | 0x40;
+        uuid[8] = (uuid[8] & 0x3f) | 0x80;
+        snprintf(controller_id, sizeof(controller_id),
+                 "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+                 uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+                 uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+
+        err = nvs_set_blob(handle, "ltsk", seed, sizeof(seed));
+        if (err == ESP_OK) {
+            err = nvs_set_str(handle, "id", controller_id);
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "error saving identity err %d", err);
+            nvs_close(handle);
+            return err;
+        }
+        ESP_LOGI(TAG, "new controller identity %s", controller_id);
+    }
+    nvs_close(handle);
+
+    if (wc_ed25519_import_private_only(seed, sizeof(seed), &controller_key) != 0 ||
+        wc_ed25519_make_public(&controller_key, pub, sizeof(pub)) != 0 ||
+        wc_ed25519_import_private_key(seed, sizeof(seed), pub, sizeof(pub), &controller_key) != 0) {
+        ESP_LOGE(TAG, "error loading identity");
+        return ESP_FAIL;
+    }
+    identity_loaded = true;
+    return ESP_OK;
+}
+
+esp_err_t hap_session_get_identity(char *id, size_t id_size, uint8_t *ltpk) {
+    word32 size = HAP_SESSION_KEY_SIZE;
+
+    if (!identity_loaded) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    strlcpy(id, controller_id, id_size);
+    return wc_ed25519_export_public(&controller_key, ltpk, &size) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+void hap_session_reset(hap_session_t *session) {
+    // drop the keys with the connection
+    memset(session, 0, offsetof(hap_session_t, tlv));
+    session->tlv_len = 0;
+    session->frame_len = 0;
+}
+
+int hap_session_verify_start(hap_session_t *session, const hap_pairing_t *pairing, uint8_t *body, size_t size) {
+    curve25519_key key;
+    word32 secret_size = sizeof(session->secret);
+    word32 public_size = sizeof(session->public_key);
+    const uint8_t state = 1;
+
+    if (!identity_loaded) {
+        return -1;
+    }
+    hap_session_reset(session);
+    session->pairing = pairing;
+
+    wc_curve25519_init(&key);
+    int r = wc_curve25519_make_key(&rng, CURVE25519_KEYSIZE, &key);
+    if (r == 0) {
+        r = wc_curve25519_export_key_raw_ex(&key, session->secret, &secret_size, session->public_key, &public_size,
+                                            EC25519_LITTLE_ENDIAN);
+    }
+    wc_curve25519_free(&key);
+    if (r != 0) {
+        return -1;
+    }
+
+    size_t len = tlv_add(body, 0, size, TLV_STATE, &state, 1);
+    len = len ? tlv_add(body, len, size, TLV_PUBLIC_KEY, session->public_key, sizeof(session->public_key)) : 0;
+    if (!len) {
+        return -1;
+    }
+    session->state = HAP_SESSION_M2;
+    return len;
+}
+
+int hap_session_verify_on_data(void *ctx, const char *data, size_t len) {
+    hap_session_t *session = ctx;
+
+    if (!data) {
+        session->tlv_len = 0;
+        return 0;
+    }
+    if (session->tlv_len + len > sizeof(session->tlv)) {
+        return -1;
+    }
+    memcpy(session->tlv + session->tlv_len, data, len);
+    session->tlv_len += len;
+    return 0;
+}
+
+// M2: check the accessory's signature and answer with ours in M3
+static int verify_m2(hap_session_t *session, uint8_t *body, size_t size) {
+    const hap_pairing_t *pairing = session->pairing;
+    uint8_t encrypted[HAP_SESSION_TLV_SIZE];
+    uint8_t sub_tlv[HAP_SESSION_TLV_SIZE];
+    uint8_t info[2 * HAP_SESSION_KEY_SIZE + HAP_SESSION_ID_SIZE];
+    uint8_t signature[ED25519_SIG_SIZE];
+    char id[HAP_SESSION_ID_SIZE];
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t session_key[HAP_SESSION_KEY_SIZE];
+    curve25519_key own, peer;
+    ed25519_key accessory_ltpk;
+    word32 shared_size = sizeof(session->shared);
+    int stat = 0;
+
+    if (tlv_get(session->tlv, session->tlv_len, TLV_PUBLIC_KEY, session->accessory_key, sizeof(session->accessory_key))
+            != HAP_SESSION_KEY_SIZE) {
+        return -1;
+    }
+    int encrypted_len = tlv_get(session->tlv, session->tlv_len, TLV_ENCRYPTED_DATA, encrypted, sizeof(encrypted));
+    if (encrypted_len < TAG_SIZE) {
+        return -1;
+    }
+
+    wc_curve25519_init(&own);
+    wc_curve25519_init(&peer);
+    int r = wc_curve25519_import_private_raw_ex(session->secret, sizeof(session->secret), session->public_key,
+                                                sizeof(session->public_key), &own, EC25519_LITTLE_ENDIAN);
+    if (r == 0) {
+        r = wc_curve25519_import_public_ex(session->accessory_key, sizeof(session->accessory_key), &peer,
+                                           EC25519_LITTLE_ENDIAN);
+    }
+    if (r == 0) {
+        r = wc_curve25519_shared_secret_ex(&own, &peer, session->shared, &shared_size, EC25519_LITTLE_ENDIAN);
+    }
+    wc_curve25519_free(&own);
+    wc_curve25519_free(&peer);
+    if (r != 0 || hkdf(session->shared, "Pair-Verify-Encrypt-Salt", "Pair-Verify-Encrypt-Info", session_key) != 0) {
+        return -1;
+    }
+
+    make_nonce(nonce, "PV-Msg02", 0);
+    int sub_len = encrypted_len - TAG_SIZE;
+    if (wc_ChaCha20Poly1305_Decrypt(session_key, nonce, NULL, 0, encrypted, sub_len, encrypted + sub_len, sub_tlv) != 0) {
+        ESP_LOGE(TAG, "M2 does not decrypt");
+        return -1;
+    }
+
+    // the accessory we expect, signing accessory key | its id | our key
+    int id_len = tlv_get(sub_tlv, sub_len, TLV_IDENTIFIER, (uint8_t *) id, sizeof(id) - 1);
+    if (id_len < 0 || tlv_get(sub_tlv, sub_len, TLV_SIGNATURE, signature, sizeof(signature)) != ED25519_SIG_SIZE) {
+        return -1;
+    }
+    id[id_len] = '\0';
+    if (strcmp(id, pairing->accessory_id) != 0) {
+        ESP_LOGE(TAG, "M2 from %s, expected %s", id, pairing->accessory_id);
+        return -1;
+    }
+
+    size_t info_len = 0;
+    memcpy(info + info_len, session->accessory_key, HAP_SESSION_KEY_SIZE);
+    info_len += HAP_SESSION_KEY_SIZE;
+    memcpy(info + info_len, id, id_len);
+    info_len += id_len;
+    memcpy(info + info_len, session->public_key, HAP_SESSION_KEY_SIZE);
+    info_len += HAP_SESSION_KEY_SIZE;
+
+    wc_ed25519_init(&accessory_ltpk);
+    r = wc_ed25519_import_public(pairing->accessory_ltpk, sizeof(pairing->accessory_ltpk), &accessory_ltpk);
+    if (r == 0) {
+        r = wc_ed25519_verify_msg(signature, sizeof(signature), info, info_len, &stat, &accessory_ltpk);
+    }
+    wc_ed25519_free(&accessory_ltpk);
+    if (r != 0 || !stat) {
+        ESP_LOGE(TAG, "%s signature does not verify", id);
+        return -1;
+    }
+
+    // M3: our key | our id | accessory key, signed with our long-term key
+    info_len = 0;
+    memcpy(info + info_len, session->public_key, HAP_SESSION_KEY_SIZE);
+    info_len += HAP_SESSION_KEY_SIZE;
+    memcpy(info + info_len, controller_id, strlen(controller_id));
+    info_len += strlen(controller_id);
+    memcpy(info + info_len, session->accessory_key, HAP_SESSION_KEY_SIZE);
+    info_len += HAP_SESSION_KEY_SIZE;
+
+    word32 signature_size = sizeof(signature);
+    if (wc_ed25519_sign_msg(info, info_len, signature, &signature_size, &controller_key) != 0) {
+        return -1;
+    }
+    sub_len = tlv_add(sub_tlv, 0, sizeof(sub_tlv), TLV_IDENTIFIER, (const uint8_t *) controller_id, strlen(controller_id));
+    sub_len = sub_len ? tlv_add(sub_tlv, sub_len, sizeof(sub_tlv), TLV_SIGNATURE, signature, signature_size) : 0;
+    if (!sub_len || sub_len + TAG_SIZE > (int) sizeof(encrypted)) {
+        return -1;
+    }
+    make_nonce(nonce, "PV-Msg03", 0);
+    if (wc_ChaCha20Poly1305_Encrypt(session_key, nonce, NULL, 0, sub_tlv, sub_len, encrypted, encrypted + sub_len) != 0) {
+        return -1;
+    }
+
+    const uint8_t state = 3;
+    size_t len = tlv_add(body, 0, size, TLV_STATE, &state, 1);
+    len = len ? tlv_add(body, len, size, TLV_ENCRYPTED_DATA, encrypted, sub_len + TAG_SIZE) : 0;
+    return len ? (int) len : -1;
+}
+
+int hap_session_verify_step(hap_session_t *session, uint8_t *body, size_t size) {
+    uint8_t state = 0;
+    uint8_t error = 0;
+    int len = -1;
+
+    if (tlv_get(session->tlv, session->tlv_len, TLV_ERROR, &error, 1) == 1) {
+        // kTLVError_Authentication (2): we have not been added to this accessory
+        ESP_LOGE(TAG, "%s refused pair-verify, error %d", session->pairing->accessory_id, error);
+    }
+    else if (tlv_get(session->tlv, session->tlv_len, TLV_STATE, &state, 1) != 1) {
+        ESP_LOGE(TAG, "pair-verify response without a state");
+    }
+    else if (session->state == HAP_SESSION_M2 && state == 2) {
+        len = verify_m2(session, body, size);
+        if (len > 0) {
+            session->state = HAP_SESSION_M4;
+        }
+    }
+    else if (session->state == HAP_SESSION_M4 && state == 4) {
+        if (hkdf(session->shared, "Control-Salt", "Control-Read-Encryption-Key", session->read_key) == 0 &&
+            hkdf(session->shared, "Control-Salt", "Control-Write-Encryption-Key", session->write_key) == 0) {
+            session->state = HAP_SESSION_ESTABLISHED;
+            len = 0;
+        }
+    }
+
+    session->tlv_len = 0;
+    // the ephemeral secret is not needed any more either way
+    memset(session->secret, 0, sizeof(session->secret));
+    if (len < 0) {
+        session->state = HAP_SESSION_NONE;
+    }
+    return len;
+}
+
+bool hap_session_established(const hap_session_t *session) {
+    return session->state == HAP_SESSION_ESTABLISHED;
+}
+
+int hap_session_encrypt(hap_session_t *session, const char *data, size_t len, uint8_t *out, size_t size) {
+    uint8_t nonce[NONCE_SIZE];
+    size_t pos = 0;
+
+    while (len > 0) {
+        size_t chunk = len > HAP_SESSION_FRAME_MAX ? HAP_SESSION_FRAME_MAX : len;
+        if (pos + 2 + chunk + TAG_SIZE > size) {
+            return -1;
+        }
+        // the little-endian length is the additional authenticated data
+        out[pos] = chunk;
+        out[pos + 1] = chunk >> 8;
+        make_nonce(nonce, NULL, session->write_count++);
+        if (wc_ChaCha20Poly1305_Encrypt(session->write_key, nonce, out + pos, 2, (const byte *) data, chunk,
+                                        out + pos + 2, out + pos + 2 + chunk) != 0) {
+            return -1;
+        }
+        pos += 2 + chunk + TAG_SIZE;
+        data += chunk;
+        len -= chunk;
+    }
+    return pos;
+}
+
+int hap_session_decrypt(hap_session_t *session, const char *data, size_t len,
+                        hap_session_data_cb callback, void *ctx) {
+    uint8_t nonce[NONCE_SIZE];
+
+    while (len > 0) {
+        // the length first, then the rest of the frame
+        size_t need = 2;
+        if (session->frame_len >= 2) {
+            size_t frame_size = session->frame[0] | session->frame[1] << 8;
+            if (frame_size > HAP_SESSION_FRAME_MAX) {
+                return -1;
+            }
+            need = 2 + frame_size + TAG_SIZE;
+        }
+        size_t chunk = need - session->frame_len;
+        chunk = chunk < len ? chunk : len;
+        memcpy(session->frame + session->frame_len, data, chunk);
+        session->frame_len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (need == 2 || session->frame_len < need) {
+            continue;
+        }
+
+        size_t plain_len = need - 2 - TAG_SIZE;
+        make_nonce(nonce, NULL, session->read_count++);
+        // in place: the tag is checked before anything is decrypted
+        if (wc_ChaCha20Poly1305_Decrypt(session->read_key, nonce, session->frame, 2, session->frame + 2, plain_len,
+                                        session->frame + 2 + plain_len, session->frame + 2) != 0) {
+            ESP_LOGE(TAG, "frame does not authenticate");
+            return -1;
+        }
+        session->frame_len = 0;
+        if (callback(ctx, (const char *) session->frame + 2, plain_len)) {
+            return -1;
+        }
+    }
+    return 0;
+}
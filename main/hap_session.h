@@ -0,0 +1,90 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define HAP_SESSION_ID_SIZE     37              // pairing identifier, up to a UUID plus '\0'
+#define HAP_SESSION_KEY_SIZE    32              // Ed25519 public key, Curve25519 keys, session keys
+#define HAP_SESSION_FRAME_MAX   1024            // plaintext per encrypted frame
+#define HAP_SESSION_TLV_SIZE    256             // largest pair-verify message
+
+// HAP controller side of pair-verify and of the encrypted session that
+//   follows it. This switch is one controller with its own long-term Ed25519
+//   key; an admin controller must add it to each accessory (Add Pairing) with
+//   the identity from hap_session_get_identity(). pair-verify then runs once
+//   per connection, and every request after it reuses the session keys.
+
+// An accessory this switch is paired with
+typedef struct {
+    char accessory_id[HAP_SESSION_ID_SIZE];     // e.g. "AC:CE:55:01:12:34"
+    uint8_t accessory_ltpk[HAP_SESSION_KEY_SIZE];
+} hap_pairing_t;
+
+typedef enum {
+    HAP_SESSION_NONE,
+    HAP_SESSION_M2,                             // M1 sent, waiting for M2
+    HAP_SESSION_M4,                             // M3 sent, waiting for M4
+    HAP_SESSION_ESTABLISHED,
+} hap_session_state_t;
+
+// One per connection; reset it whenever the connection closes
+typedef struct {
+    hap_session_state_t state;
+    const hap_pairing_t *pairing;
+    uint8_t secret[HAP_SESSION_KEY_SIZE];       // ephemeral Curve25519, this verify only
+    uint8_t public_key[HAP_SESSION_KEY_SIZE];
+    uint8_t accessory_key[HAP_SESSION_KEY_SIZE];
+    uint8_t shared[HAP_SESSION_KEY_SIZE];
+    uint8_t read_key[HAP_SESSION_KEY_SIZE];     // accessory to controller
+    uint8_t write_key[HAP_SESSION_KEY_SIZE];    // controller to accessory
+    uint64_t read_count;                        // frame nonces
+    uint64_t write_count;
+    uint8_t tlv[HAP_SESSION_TLV_SIZE];          // pair-verify response body
+    size_t tlv_len;
+    uint8_t frame[2 + HAP_SESSION_FRAME_MAX + 16];  // encrypted frame being received
+    size_t frame_len;
+} hap_session_t;
+
+// Receives the plaintext of each frame. Return non-zero to stop
+typedef int (*hap_session_data_cb)(void *ctx, const char *data, size_t len);
+
+// Load the controller identity from NVS, creating it on first use
+esp_err_t hap_session_init_identity(void);
+
+// This controller's pairing identifier and long-term public key, to add to accessories
+esp_err_t hap_session_get_identity(char *id, size_t id_size, uint8_t *ltpk);
+
+void hap_session_reset(hap_session_t *session);
+
+// Start pair-verify with pairing: write the M1 body into body. Returns its
+//   length, or -1 on error
+int hap_session_verify_start(hap_session_t *session, const hap_pairing_t *pairing, uint8_t *body, size_t size);
+
+// Collect the pair-verify response body. Returns non-zero if it is too long
+int hap_session_verify_on_data(void *session, const char *data, size_t len);
+
+// The M2 or M4 response is complete. After M2, write the M3 body into body
+//   and return its length; after M4 return 0 with the session established.
+//   Returns -1 if the accessory could not be verified or refused us
+int hap_session_verify_step(hap_session_t *session, uint8_t *body, size_t size);
+
+bool hap_session_established(const hap_session_t *session);
+
+// Encrypt data as frames into out. Returns the length written, or -1
+int hap_session_encrypt(hap_session_t *session, const char *data, size_t len, uint8_t *out, size_t size);
+
+// Decrypt received bytes, which may end in the middle of a frame, and pass
+//   each complete frame's plaintext to callback. Returns -1 if a frame does
+//   not authenticate, or callback returned non-zero
+int hap_session_decrypt(hap_session_t *session, const char *data, size_t len,
+                        hap_session_data_cb callback, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,724 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/sockets.h"
+#include "http_parser.h"
+
+#include "http_pool.h"
+#include "socket_budget.h"                      // lwip sockets shared with remote_shadow
+
+#include "esp_log.h"
+static const char *TAG = "http_pool";
+
+typedef enum {
+    ENTRY_IDLE,                                 // nothing in flight, the socket may still be open
+    ENTRY_CONNECTING,                           // non-blocking connect for the head request
+    ENTRY_VERIFYING,                            // pair-verify on the new connection, before the head request
+    ENTRY_WAITING,                              // head request sent, reading its response
+} entry_state_t;
+
+typedef struct {
+    char host_ip[16];                           // empty if the slot is free
+    uint16_t port;
+    int sock;                                   // -1 if not connected
+    entry_state_t state;
+    http_pool_req_t *head;                      // requests in order, head is in flight unless IDLE
+    http_pool_req_t *tail;
+    TickType_t last_used;                       // last time the socket carried a request
+    TickType_t last_request;                    // last request from a caller
+    bool keepalive;                             // TCP keep-alives watch the idle socket
+    TickType_t started;                         // current stage of the attempt, for its timeout
+    TickType_t sent;
+    uint32_t rtt_ms;                            // smoothed, 0 until the first request completes
+    bool reused;                                // current attempt is on an already open connection
+    bool response_started;
+    bool complete;
+    bool data_error;
+    bool parse_error;
+    http_parser parser;
+    const hap_pairing_t *pairing;               // NULL: plain HTTP
+    hap_session_t *session;                     // allocated for the first request to a paired host
+    bool verified;                              // the current attempt ran pair-verify
+    TickType_t verify_started;
+} http_pool_entry_t;
+
+static http_pool_entry_t pool[HTTP_POOL_SIZE];
+static SemaphoreHandle_t pool_mutex = NULL;
+static http_parser_settings parser_settings;
+static int ctrl_sock = -1;                      // the pool task selects on this, submitters send to it
+static struct sockaddr_in ctrl_addr;
+static http_pool_session_stats_t session_stats;
+
+static uint32_t ms_since(TickType_t then) {
+    return (xTaskGetTickCount() - then) * portTICK_PERIOD_MS;
+}
+
+static const char *method_name(esp_http_client_method_t method) {
+    switch (method) {
+        case HTTP_METHOD_GET:       return "GET";
+        case HTTP_METHOD_POST:      return "POST";
+        case HTTP_METHOD_PUT:       return "PUT";
+        case HTTP_METHOD_DELETE:    return "DELETE";
+        default:                    return NULL;
+    }
+}
+
+static void close_socket(http_pool_entry_t *entry) {
+    if (entry->sock >= 0) {
+        close(entry->sock);
+        socket_budget_give();
+        entry->sock = -1;
+    }
+    // a session lives as long as its connection
+    if (entry->session) {
+        hap_session_reset(entry->session);
+    }
+}
+
+static void enqueue(http_pool_entry_t *entry, http_pool_req_t *req) {
+    req->next = NULL;
+    if (entry->tail) {
+        entry->tail->next = req;
+    }
+    else {
+        entry->head = req;
+    }
+    entry->tail = req;
+}
+
+static int on_body(http_parser *parser, const char *at, size_t length) {
+    http_pool_entry_t *entry = parser->data;
+    http_pool_req_t *req = entry->head;
+    if (entry->state == ENTRY_VERIFYING) {
+        if (hap_session_verify_on_data(entry->session, at, length)) {
+            entry->data_error = true;
+        }
+    }
+    else if (req->on_data && !entry->data_error) {
+        if (req->on_data(req->ctx, at, length)) {
+            // read on so the connection stays usable, but fail the request
+            entry->data_error = true;
+        }
+    }
+    return 0;
+}
+
+static int on_message_complete(http_parser *parser) {
+    http_pool_entry_t *entry = parser->data;
+    entry->complete = true;
+    return 0;
+}
+
+// take pool_mutex before calling
+static http_pool_entry_t *get_entry(const char *host_ip, uint16_t port) {
+    http_pool_entry_t *lru = NULL;
+
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool_entry_t *entry = &pool[i];
+        if (entry->host_ip[0] && entry->port == port && strcmp(entry->host_ip, host_ip) == 0) {
+            return entry;
+        }
+        // only a slot with nothing queued can be taken over
+        if (entry->head) {
+            continue;
+        }
+        if (!lru || !entry->host_ip[0]) {
+            lru = entry;
+        }
+        else if (lru->host_ip[0] && (int32_t)(entry->last_request - lru->last_request) < 0) {
+            lru = entry;
+        }
+    }
+    if (!lru) {
+        return NULL;
+    }
+
+    // reuse the least recently requested slot for the new host
+    if (lru->host_ip[0]) {
+        ESP_LOGI(TAG, "evicting %s:%u", lru->host_ip, lru->port);
+    }
+    close_socket(lru);
+    free(lru->session);
+    memset(lru, 0, sizeof(*lru));
+    lru->sock = -1;
+    strlcpy(lru->host_ip, host_ip, sizeof(lru->host_ip));
+    lru->port = port;
+    return lru;
+}
+
+// The head request is done. Its callback may chain a follow-up, which then
+//   stays at the head and is sent next
+// take pool_mutex before calling
+static void finish(http_pool_entry_t *entry, esp_err_t err) {
+    http_pool_req_t *req = entry->head;
+
+    if (err == ESP_OK) {
+        // exponentially weighted, 1/8 per sample (as TCP does for SRTT)
+        uint32_t rtt_ms = MAX(ms_since(entry->sent), portTICK_PERIOD_MS);
+        entry->rtt_ms = entry->rtt_ms ? (entry->rtt_ms * 7 + rtt_ms) / 8 : rtt_ms;
+        entry->last_used = xTaskGetTickCount();
+        req->status_code = entry->parser.status_code;
+
+        if (!http_should_keep_alive(&entry->parser)) {
+            close_socket(entry);
+        }
+        if (entry->data_error) {
+            err = ESP_FAIL;
+        }
+    }
+    else {
+        close_socket(entry);
+    }
+    req->rtt_ms = entry->rtt_ms;
+    entry->state = ENTRY_IDLE;
+
+    if (entry->pairing) {
+        uint32_t latency_ms = ms_since(req->submitted);
+        session_stats.requests++;
+        session_stats.reused += err == ESP_OK && !entry->verified;
+        session_stats.latency_ms_total += latency_ms;
+        session_stats.latency_ms_max = MAX(session_stats.latency_ms_max, latency_ms);
+    }
+
+    if (req->on_done && req->on_done(req, err)) {
+        req->retried = false;
+        return;
+    }
+    entry->head = req->next;
+    if (!entry->head) {
+        entry->tail = NULL;
+    }
+}
+
+// take pool_mutex before calling
+static void fail_attempt(http_pool_entry_t *entry, esp_err_t err) {
+    http_pool_req_t *req = entry->head;
+
+    close_socket(entry);
+    // remote device restarted or dropped the connection; once more on a new socket
+    if (entry->reused && !entry->response_started && !req->retried) {
+        ESP_LOGD(TAG, "%s: retrying on a new connection", entry->host_ip);
+        req->retried = true;
+        entry->state = ENTRY_IDLE;
+        return;
+    }
+    ESP_LOGW(TAG, "%s %s%s failed: %s", entry->host_ip, method_name(req->method), req->path, esp_err_to_name(err));
+    finish(entry, err);
+}
+
+// Send a request, encrypted once the connection has a verified session. A
+//   request is far smaller than the socket's send buffer, which is empty
+//   between requests, so it goes in one non-blocking send
+// take pool_mutex before calling
+static bool send_request(http_pool_entry_t *entry, const char *request, int len) {
+    http_parser_init(&entry->parser, HTTP_RESPONSE);
+    entry->parser.data = entry;
+    entry->complete = false;
+
+    if (entry->session && hap_session_established(entry->session)) {
+        uint8_t frames[HTTP_POOL_PATH_SIZE + HTTP_POOL_BODY_SIZE + 128 + 2 * (2 + 16)];
+        int frames_len = hap_session_encrypt(entry->session, request, len, frames, sizeof(frames));
+        return frames_len > 0 && send(entry->sock, frames, frames_len, 0) == frames_len;
+    }
+    return send(entry->sock, request, len, 0) == len;
+}
+
+// POST a pair-verify message; the body is TLV8, not text
+// take pool_mutex before calling
+static void send_verify(http_pool_entry_t *entry, const uint8_t *body, int body_len) {
+    char request[HAP_SESSION_TLV_SIZE + 128];
+
+    int len = snprintf(request, sizeof(request),
+            "POST /pair-verify HTTP/1.1\r\nHost: %s:%u\r\nContent-Type: application/pairing+tlv8\r\nContent-Length: %d\r\n\r\n",
+            entry->host_ip, entry->port, body_len);
+    if (len < 0 || len + body_len > (int) sizeof(request)) {
+        finish(entry, ESP_ERR_INVALID_SIZE);
+        return;
+    }
+    memcpy(request + len, body, body_len);
+
+    if (!send_request(entry, request, len + body_len)) {
+        fail_attempt(entry, ESP_FAIL);
+        return;
+    }
+    entry->state = ENTRY_VERIFYING;
+}
+
+// take pool_mutex before calling
+static void send_head(http_pool_entry_t *entry) {
+    http_pool_req_t *req = entry->head;
+    char request[HTTP_POOL_PATH_SIZE + HTTP_POOL_BODY_SIZE + 128];
+    int len;
+
+    // a paired accessory only takes requests on a verified session: verify
+    //   first, on_verify_response() sends the request once that is done
+    if (entry->session && !hap_session_established(entry->session)) {
+        uint8_t body[HAP_SESSION_TLV_SIZE];
+        // verification has a deadline of its own, HTTP_POOL_VERIFY_MS
+        entry->verified = true;
+        entry->verify_started = entry->started = xTaskGetTickCount();
+        xSemaphoreGive(pool_mutex);
+        int body_len = hap_session_verify_start(entry->session, entry->pairing, body, sizeof(body));
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+        if (body_len < 0) {
+            finish(entry, ESP_FAIL);
+            return;
+        }
+        send_verify(entry, body, body_len);
+        return;
+    }
+
+    if (req->body[0]) {
+        len = snprintf(request, sizeof(request),
+                "%s %s HTTP/1.1\r\nHost: %s:%u\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n%s",
+                method_name(req->method), req->path, entry->host_ip, entry->port, (int) strlen(req->body), req->body);
+    }
+    else {
+        len = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %s:%u\r\n\r\n",
+                method_name(req->method), req->path, entry->host_ip, entry->port);
+    }
+    if (len < 0 || len >= (int) sizeof(request)) {
+        finish(entry, ESP_ERR_INVALID_SIZE);
+        return;
+    }
+
+    if (!send_request(entry, request, len)) {
+        fail_attempt(entry, ESP_FAIL);
+        return;
+    }
+    // the request gets the whole HTTP_POOL_TIMEOUT_MS, whatever the connect
+    //   and pair-verify before it took
+    entry->sent = entry->started = xTaskGetTickCount();
+    entry->state = ENTRY_WAITING;
+}
+
+// Have lwip probe the connection while it is idle, so one the other end
+//   dropped errors out (and is closed by on_readable()) before the next
+//   request rather than with it. No request is sent to the accessory for it
+static bool set_keepalive(int sock) {
+    int on = 1;
+    int idle_s = HTTP_POOL_KEEPALIVE_MS / 1000;
+    int interval_s = 5;
+    int count = 3;
+
+    return setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle_s, sizeof(idle_s)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval_s, sizeof(interval_s)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) == 0;
+}
+
+// Take a socket for entry from the budget. With none left, close the idle
+//   connection used least recently: a queued request matters more than
+//   a kept-alive socket
+// take pool_mutex before calling
+static bool take_socket(http_pool_entry_t *entry) {
+    if (socket_budget_take(0)) {
+        return true;
+    }
+
+    http_pool_entry_t *lru = NULL;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool_entry_t *idle = &pool[i];
+        if (idle == entry || idle->sock < 0 || idle->state != ENTRY_IDLE || idle->head) {
+            continue;
+        }
+        if (!lru || (int32_t)(idle->last_used - lru->last_used) < 0) {
+            lru = idle;
+        }
+    }
+    if (!lru) {
+        return false;
+    }
+    ESP_LOGI(TAG, "closing %s for %s", lru->host_ip, entry->host_ip);
+    close_socket(lru);
+    return socket_budget_take(0);
+}
+
+// Start the head request: send it on the open connection, or connect first
+// take pool_mutex before calling
+static void start(http_pool_entry_t *entry) {
+    http_pool_req_t *req = entry->head;
+
+    if (!method_name(req->method)) {
+        finish(entry, ESP_ERR_NOT_SUPPORTED);
+        return;
+    }
+
+    // a connection idle for this long has most likely been closed by the
+    //   other end; reconnect now rather than fail the first attempt. With
+    //   keep-alives a dead connection has already been closed
+    if (entry->sock >= 0 && !entry->keepalive && ms_since(entry->last_used) > HTTP_POOL_STALE_MS) {
+        ESP_LOGD(TAG, "%s idle %ums, reconnecting", entry->host_ip, (unsigned)ms_since(entry->last_used));
+        close_socket(entry);
+    }
+
+    if (entry->pairing && !entry->session) {
+        entry->session = calloc(1, sizeof(hap_session_t));
+        if (!entry->session) {
+            finish(entry, ESP_ERR_NO_MEM);
+            return;
+        }
+    }
+
+    if (req->on_data) {
+        req->on_data(req->ctx, NULL, 0);
+    }
+    entry->verified = false;
+    entry->data_error = false;
+    entry->complete = false;
+    entry->response_started = false;
+    entry->started = xTaskGetTickCount();
+
+    if (entry->sock >= 0) {
+        entry->reused = true;
+        send_head(entry);
+        return;
+    }
+    entry->reused = false;
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(entry->port),
+    };
+    if (inet_aton(entry->host_ip, &addr.sin_addr) == 0) {
+        finish(entry, ESP_ERR_INVALID_ARG);
+        return;
+    }
+    if (!take_socket(entry)) {
+        ESP_LOGW(TAG, "no socket left for %s", entry->host_ip);
+        finish(entry, ESP_ERR_NO_MEM);
+        return;
+    }
+    entry->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (entry->sock < 0) {
+        socket_budget_give();
+        ESP_LOGE(TAG, "no socket for %s", entry->host_ip);
+        finish(entry, ESP_ERR_NO_MEM);
+        return;
+    }
+    fcntl(entry->sock, F_SETFL, fcntl(entry->sock, F_GETFL, 0) | O_NONBLOCK);
+    entry->keepalive = set_keepalive(entry->sock);
+
+    if (connect(entry->sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        send_head(entry);
+    }
+    else if (errno == EINPROGRESS) {
+        entry->state = ENTRY_CONNECTING;
+    }
+    else {
+        fail_attempt(entry, ESP_FAIL);
+    }
+}
+
+// Release the sockets (lwip only has 16) of hosts that have not been used
+//   for a while
+// take pool_mutex before calling
+static void close_idle(http_pool_entry_t *entry) {
+    if (entry->sock >= 0 && !entry->head && ms_since(entry->last_request) > HTTP_POOL_WARM_MS) {
+        ESP_LOGI(TAG, "%s not used for a while, closing", entry->host_ip);
+        close_socket(entry);
+    }
+}
+
+// Plaintext of the response, straight from the socket or decrypted
+static int parse(void *ctx, const char *data, size_t len) {
+    http_pool_entry_t *entry = ctx;
+    if (http_parser_execute(&entry->parser, &parser_settings, data, len) != len) {
+        ESP_LOGE(TAG, "%s: %s", entry->host_ip, http_errno_name(HTTP_PARSER_ERRNO(&entry->parser)));
+        entry->parse_error = true;
+        return -1;
+    }
+    return 0;
+}
+
+// A pair-verify response is in: answer M2 with M3, or after M4 send the
+//   head request on the session
+// take pool_mutex before calling
+static void on_verify_response(http_pool_entry_t *entry) {
+    uint8_t body[HAP_SESSION_TLV_SIZE];
+
+    // the X25519 and Ed25519 work of M2 still blocks the pool task, once per
+    //   connection, but not callers of http_pool_*
+    int len = -1;
+    if (entry->parser.status_code == 200 && !entry->data_error) {
+        xSemaphoreGive(pool_mutex);
+        len = hap_session_verify_step(entry->session, body, sizeof(body));
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    }
+    if (len < 0) {
+        ESP_LOGE(TAG, "pair-verify with %s failed", entry->host_ip);
+        session_stats.verify_failures++;
+        fail_attempt(entry, ESP_ERR_INVALID_RESPONSE);
+        return;
+    }
+    if (len > 0) {
+        send_verify(entry, body, len);
+        return;
+    }
+
+    uint32_t verify_ms = ms_since(entry->verify_started);
+    ESP_LOGI(TAG, "%s verified in %ums", entry->host_ip, (unsigned) verify_ms);
+    session_stats.verifies++;
+    session_stats.verify_ms_total += verify_ms;
+    session_stats.verify_ms_max = MAX(session_stats.verify_ms_max, verify_ms);
+    send_head(entry);
+}
+
+// take pool_mutex before calling
+static void on_readable(http_pool_entry_t *entry, char *buf, size_t size) {
+    int len = recv(entry->sock, buf, size, 0);
+
+    if (entry->state == ENTRY_IDLE) {
+        // nothing was asked: the other end closed the idle connection
+        ESP_LOGD(TAG, "%s closed the connection", entry->host_ip);
+        close_socket(entry);
+        return;
+    }
+
+    if (len < 0) {
+        fail_attempt(entry, ESP_FAIL);
+        return;
+    }
+    entry->parse_error = false;
+    if (len > 0 && entry->session && hap_session_established(entry->session) && entry->state == ENTRY_WAITING) {
+        if (hap_session_decrypt(entry->session, buf, len, parse, entry) && !entry->parse_error) {
+            fail_attempt(entry, ESP_ERR_INVALID_RESPONSE);
+            return;
+        }
+    }
+    else {
+        // len 0 tells the parser about EOF, which ends a body without a length
+        parse(entry, buf, len);
+    }
+
+    if (entry->complete) {
+        if (len == 0) {
+            close_socket(entry);
+        }
+        if (entry->state == ENTRY_VERIFYING) {
+            on_verify_response(entry);
+        }
+        else {
+            finish(entry, ESP_OK);
+        }
+    }
+    else if (len == 0 || entry->parse_error) {
+        fail_attempt(entry, ESP_FAIL);
+    }
+    else {
+        entry->response_started = true;
+    }
+}
+
+// take pool_mutex before calling
+static void on_connected(http_pool_entry_t *entry) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(entry->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error) {
+        ESP_LOGW(TAG, "connect to %s failed", entry->host_ip);
+        fail_attempt(entry, ESP_FAIL);
+        return;
+    }
+    send_head(entry);
+}
+
+// Runs every host's requests: select() over all their sockets, so a slow or
+//   dead host holds up only the requests queued for it. pool_mutex is
+//   released for the pair-verify crypto: meanwhile callers may only queue
+//   requests and read the rtts. The session and the socket are only touched
+//   by this task, and a host with requests queued is never evicted
+static void http_pool_task(void *arg) {
+    char buf[256];
+
+    while (1) {
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(ctrl_sock, &read_fds);
+        int max_fd = ctrl_sock;
+
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            http_pool_entry_t *entry = &pool[i];
+            if (!entry->host_ip[0]) {
+                continue;
+            }
+
+            uint32_t timeout_ms = entry->state == ENTRY_VERIFYING ? HTTP_POOL_VERIFY_MS : HTTP_POOL_TIMEOUT_MS;
+            if (entry->state != ENTRY_IDLE && ms_since(entry->started) > timeout_ms) {
+                ESP_LOGW(TAG, "%s %s%s timed out", entry->host_ip, method_name(entry->head->method), entry->head->path);
+                finish(entry, ESP_ERR_TIMEOUT);
+            }
+            close_idle(entry);
+            // requests that fail at once (or are chained) move the queue on here
+            while (entry->state == ENTRY_IDLE && entry->head) {
+                start(entry);
+            }
+
+            if (entry->sock >= 0) {
+                FD_SET(entry->sock, entry->state == ENTRY_CONNECTING ? &write_fds : &read_fds);
+                max_fd = MAX(max_fd, entry->sock);
+            }
+        }
+        xSemaphoreGive(pool_mutex);
+
+        struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout) <= 0) {
+            continue;
+        }
+
+        if (FD_ISSET(ctrl_sock, &read_fds)) {
+            recv(ctrl_sock, buf, sizeof(buf), 0);
+        }
+
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            http_pool_entry_t *entry = &pool[i];
+            if (entry->sock < 0) {
+                continue;
+            }
+            if (entry->state == ENTRY_CONNECTING && FD_ISSET(entry->sock, &write_fds)) {
+                on_connected(entry);
+            }
+            else if (entry->state != ENTRY_CONNECTING && FD_ISSET(entry->sock, &read_fds)) {
+                on_readable(entry, buf, sizeof(buf));
+            }
+        }
+        xSemaphoreGive(pool_mutex);
+    }
+}
+
+// UDP over loopback, as esp_http_server does to wake its select(). One
+//   socket: submitters send to its own address on it
+static esp_err_t create_ctrl_sock(void) {
+    ctrl_addr.sin_family = AF_INET;
+    ctrl_addr.sin_port = htons(HTTP_POOL_CTRL_PORT);
+    ctrl_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (!socket_budget_take(0)) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctrl_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ctrl_sock < 0) {
+        socket_budget_give();
+        return ESP_ERR_NO_MEM;
+    }
+    if (bind(ctrl_sock, (struct sockaddr *) &ctrl_addr, sizeof(ctrl_addr)) != 0) {
+        close(ctrl_sock);
+        socket_budget_give();
+        ctrl_sock = -1;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_pool_init(void) {
+    if (pool_mutex) {
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        pool[i].sock = -1;
+    }
+    http_parser_settings_init(&parser_settings);
+    parser_settings.on_body = on_body;
+    parser_settings.on_message_complete = on_message_complete;
+
+    if (create_ctrl_sock() != ESP_OK) {
+        ESP_LOGE(TAG, "error creating control socket");
+        return ESP_FAIL;
+    }
+
+    pool_mutex = xSemaphoreCreateMutex();
+    if (!pool_mutex) {
+        ESP_LOGE(TAG, "error creating mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // room for the Curve25519/Ed25519 work of pair-verify
+    if (xTaskCreate(&http_pool_task, "http_pool", 6144, NULL, tskIDLE_PRIORITY + 2, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_pool_submit(const char *host_ip, uint16_t port, http_pool_req_t *req) {
+    if (!pool_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+
+    http_pool_entry_t *entry = get_entry(host_ip, port);
+    if (!entry) {
+        xSemaphoreGive(pool_mutex);
+        ESP_LOGW(TAG, "all %d hosts busy, %s dropped", HTTP_POOL_SIZE, host_ip);
+        return ESP_ERR_NO_MEM;
+    }
+
+    req->status_code = 0;
+    req->retried = false;
+    if (req->pairing) {
+        entry->pairing = req->pairing;
+    }
+    req->submitted = xTaskGetTickCount();
+    entry->last_request = req->submitted;
+    enqueue(entry, req);
+
+    sendto(ctrl_sock, "", 1, 0, (struct sockaddr *) &ctrl_addr, sizeof(ctrl_addr));
+    xSemaphoreGive(pool_mutex);
+    return ESP_OK;
+}
+
+uint32_t http_pool_get_rtt(const char *host_ip, uint16_t port) {
+    uint32_t rtt_ms = 0;
+    if (!pool_mutex) {
+        return 0;
+    }
+
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (pool[i].host_ip[0] && pool[i].port == port && strcmp(pool[i].host_ip, host_ip) == 0) {
+            rtt_ms = pool[i].rtt_ms;
+            break;
+        }
+    }
+    xSemaphoreGive(pool_mutex);
+    return rtt_ms;
+}
+
+int http_pool_get_rtts(http_pool_rtt_t *rtts, int max) {
+    int n = 0;
+    if (!pool_mutex) {
+        return 0;
+    }
+
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    for (int i = 0; i < HTTP_POOL_SIZE && n < max; i++) {
+        if (pool[i].host_ip[0] && pool[i].rtt_ms) {
+            strlcpy(rtts[n].host_ip, pool[i].host_ip, sizeof(rtts[n].host_ip));
+            rtts[n].port = pool[i].port;
+            rtts[n].rtt_ms = pool[i].rtt_ms;
+            n++;
+        }
+    }
+    xSemaphoreGive(pool_mutex);
+    return n;
+}
+
+void http_pool_get_session_stats(http_pool_session_stats_t *stats) {
+    if (pool_mutex) {
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    }
+    *stats = session_stats;
+    if (pool_mutex) {
+        xSemaphoreGive(pool_mutex);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_http_client.h"                    // esp_http_client_method_t
+#include "hap_session.h"                        // pair-verified, encrypted connections
+
+#define HTTP_POOL_SIZE          4               // remote hosts with a kept-alive connection
+#define HTTP_POOL_KEEPALIVE_MS  15000           // idle connections are probed with TCP keep-alives after this
+#define HTTP_POOL_STALE_MS      30000           // without keep-alives, idle longer than this: assume half-closed
+#define HTTP_POOL_WARM_MS       600000          // close a host's connection 10 min after its last request
+#define HTTP_POOL_TIMEOUT_MS    5000            // connect, then the request and its response, per attempt
+#define HTTP_POOL_VERIFY_MS     10000           // pair-verify: both round trips and the crypto at each end
+#define HTTP_POOL_CTRL_PORT     32769           // loopback UDP that wakes the pool task (httpd has 32768)
+#define HTTP_POOL_PATH_SIZE     128             // fits remote_plan_t.get_path
+#define HTTP_POOL_BODY_SIZE     256
+
+// Receives the response body as it arrives (chunked or not). Called with
+//   data NULL before each attempt, as a retry starts the body again.
+//   Return non-zero to fail the request
+typedef int (*http_pool_data_cb)(void *ctx, const char *data, size_t len);
+
+typedef struct http_pool_req http_pool_req_t;
+
+// The request finished: err is ESP_OK and req->status_code is set, or it
+//   failed. To send a follow-up to the same host before anything else queued
+//   for it (e.g. a PUT built from this GET's response), rewrite req and return
+//   true; otherwise the pool is done with req and the caller may reuse it.
+typedef bool (*http_pool_done_cb)(http_pool_req_t *req, esp_err_t err);
+
+// A request is owned by the caller and must stay valid until on_done returns
+//   false. Callbacks run in the pool task and must not call http_pool_*
+struct http_pool_req {
+    esp_http_client_method_t method;
+    char path[HTTP_POOL_PATH_SIZE];
+    char body[HTTP_POOL_BODY_SIZE];             // empty: no body
+    http_pool_data_cb on_data;                  // may be NULL
+    http_pool_done_cb on_done;                  // may be NULL
+    void *ctx;                                  // for the callbacks
+    const hap_pairing_t *pairing;               // paired accessory: requests go over a verified session.
+                                                //   NULL for plain HTTP. Must stay valid
+
+    // set by the pool
+    int status_code;
+    uint32_t rtt_ms;                            // the host's smoothed round trip after this request
+    TickType_t submitted;
+
+    // private
+    struct http_pool_req *next;
+    bool retried;
+};
+
+// Create the pool and the task that runs all requests. The task also runs
+//   pair-verify, once per connection to a paired accessory. Its wake socket
+//   and each connection are taken from socket_budget, which must be set first;
+//   connections are opened on demand and closed once idle for WARM_MS
+esp_err_t http_pool_init(void);
+
+// Queue req for host_ip:port and return at once. Requests to one host are sent
+//   in order over its kept-alive connection, one at a time; requests to
+//   different hosts are in flight at the same time. A request that fails on
+//   a reused connection is retried once on a new one.
+esp_err_t http_pool_submit(const char *host_ip, uint16_t port, http_pool_req_t *req);
+
+typedef struct {
+    char host_ip[16];
+    uint16_t port;
+    uint32_t rtt_ms;
+} http_pool_rtt_t;
+
+// Smoothed round trip time of requests to host_ip:port, 0 if not measured yet
+uint32_t http_pool_get_rtt(const char *host_ip, uint16_t port);
+
+// Fill rtts with up to max pooled hosts, returns the number filled
+int http_pool_get_rtts(http_pool_rtt_t *rtts, int max);
+
+// Requests to paired accessories
+typedef struct {
+    uint32_t verifies;                          // pair-verify completed, one per new connection
+    uint32_t verify_failures;
+    uint32_t verify_ms_max;
+    uint32_t verify_ms_total;
+    uint32_t requests;                          // completed
+    uint32_t reused;                            // of those, sent on a session verified before them
+    uint32_t latency_ms_max;                    // submitted until done, a pair-verify included
+    uint32_t latency_ms_total;
+} http_pool_session_stats_t;
+
+void http_pool_get_session_stats(http_pool_session_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,7 @@
 #include "esp_http_server.h"
 #include "esp_wifi.h"
 #include "cJSON.h"
+#include "json_writer.h"                        // responses written without building a cJSON tree
 #include "nvs_flash.h"
 #include "lwip/sockets.h"                       // SSE uses send()
 
@@ -16,6 +17,12 @@
 #include "httpd.h"
 #include <homekit/homekit.h>
 #include "lights.h"
+#include "http_pool.h"                          // remote host round trip times
+#include "socket_budget.h"                      // sockets held by remote lights
+#include "hap_session.h"                        // controller identity for paired accessories
+#include "latency_trace.h"                      // press latency histograms
+#include "dimming_curve.h"                      // curve names for the lights config
+#include "scenes.h"                             // apply a scene by name
 
 #include "esp_log.h"
 static const char *TAG = "myhttpd";
@@ -97,23 +104,77 @@ void send_sse_message (char* message, char* event) {
     }
 }
 
+static void write_latency_json(json_writer_t *w, const latency_stage_stats_t *stages, int num_stages, uint32_t presses)
+{
+    json_write_object_start(w, NULL);
+    json_write_int(w, "presses", presses);
+    json_write_array_start(w, "stages");
+    for (int i = 0; i < num_stages; i++) {
+        json_write_object_start(w, NULL);
+        json_write_string(w, "stage", stages[i].name);
+        json_write_int(w, "count", stages[i].count);
+        json_write_int(w, "p50_us", stages[i].p50_us);
+        json_write_int(w, "p99_us", stages[i].p99_us);
+        json_write_int(w, "max_us", stages[i].max_us);
+        json_write_object_end(w);
+    }
+    json_write_array_end(w);
+    json_write_object_end(w);
+}
+
+// Press latency per stage, malloc'd. NULL if out of memory
+static char *latency_json()
+{
+    latency_stage_stats_t stages[LATENCY_STAGES];
+    int num_stages = latency_trace_get_stats(stages, LATENCY_STAGES);
+    uint32_t presses = latency_trace_get_presses();
+    json_writer_t w;
+
+    // measure first, then one allocation of the exact size
+    json_writer_init(&w, NULL, 0);
+    write_latency_json(&w, stages, num_stages, presses);
+    size_t out_size = w.len + 1;
+    char *out = malloc(out_size);
+    if (out) {
+        json_writer_init(&w, out, out_size);
+        write_latency_json(&w, stages, num_stages, presses);
+        json_writer_finish(&w);
+    }
+    return out;
+}
+
 static void sse_logging_task(void * param)
 {
     char recv_buf[LOG_BUF_MAX_LINE_SIZE];
+    uint32_t latency_presses = 0;
+    TickType_t latency_sent = xTaskGetTickCount();
 
     while(1) {
-        if (xQueueReceive(q_sse_message_queue, recv_buf, portMAX_DELAY) == pdTRUE) {
+        if (xQueueReceive(q_sse_message_queue, recv_buf, pdMS_TO_TICKS(LATENCY_SSE_PERIOD_MS)) == pdTRUE) {
             send_sse_message(recv_buf, NULL);
         } 
+
+        // a "latency" event when there have been presses, at most once a period
+        if (latency_trace_get_presses() != latency_presses &&
+                xTaskGetTickCount() - latency_sent >= pdMS_TO_TICKS(LATENCY_SSE_PERIOD_MS)) {
+            latency_presses = latency_trace_get_presses();
+            latency_sent = xTaskGetTickCount();
+            char *out = latency_json();
+            if (out) {
+                send_sse_message(out, "latency");
+                free(out);
+            }
+        }
     }
 }
 
 static void status_json_sse_handler()
 {
     char ip_buf[17];
-    char *out;
-    cJSON *root;
-    root = cJSON_CreateObject();
+    char out[704];
+    json_writer_t w;
+    json_writer_init(&w, out, sizeof(out));
+    json_write_object_start(&w, NULL);
 
     wifi_config_t wifi_cfg;
     esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_cfg);
@@ -129,26 +190,56 @@ static void status_json_sse_handler()
         bool if_status = tcpip_adapter_is_netif_up(TCPIP_ADAPTER_IF_STA);
     #endif
 
-    cJSON_AddItemToObject(root, "ssid", cJSON_CreateString((const char *)wifi_cfg.sta.ssid));
+    json_write_string(&w, "ssid", (const char *)wifi_cfg.sta.ssid);
     snprintf(ip_buf, 17, IPSTR, IP2STR(&ip_info.ip));
-    cJSON_AddItemToObject(root, "ip", cJSON_CreateString(ip_buf));
+    json_write_string(&w, "ip", ip_buf);
     snprintf(ip_buf, 17, IPSTR, IP2STR(&ip_info.netmask));
-    cJSON_AddItemToObject(root, "netmask", cJSON_CreateString(ip_buf));
+    json_write_string(&w, "netmask", ip_buf);
     snprintf(ip_buf, 17, IPSTR, IP2STR(&ip_info.gw));
-    cJSON_AddItemToObject(root, "gw", cJSON_CreateString(ip_buf));
-    cJSON_AddItemToObject(root, "if_status", cJSON_CreateBool(if_status));
- 
-    out = cJSON_PrintUnformatted(root);
+    json_write_string(&w, "gw", ip_buf);
+    json_write_bool(&w, "if_status", if_status);
+
+    // round trip to each remote HomeKit host, which sets the remote dimming rate
+    http_pool_rtt_t rtts[HTTP_POOL_SIZE];
+    int num_rtts = http_pool_get_rtts(rtts, HTTP_POOL_SIZE);
+    json_write_array_start(&w, "remote_rtt");
+    for (int i = 0; i < num_rtts; i++) {
+        json_write_object_start(&w, NULL);
+        json_write_string(&w, "host", rtts[i].host_ip);
+        json_write_int(&w, "rtt_ms", rtts[i].rtt_ms);
+        json_write_object_end(&w);
+    }
+    json_write_array_end(&w);
+
+    // sockets held by remote light connections, out of the remote budget
+    int sockets_in_use, sockets_in_use_max;
+    socket_budget_get_stats(&sockets_in_use, &sockets_in_use_max);
+    json_write_int(&w, "remote_sockets", sockets_in_use);
+    json_write_int(&w, "remote_sockets_max", sockets_in_use_max);
+
+    // paired accessories: how many requests went on an already verified session
+    http_pool_session_stats_t session;
+    http_pool_get_session_stats(&session);
+    json_write_object_start(&w, "hap_sessions");
+    json_write_int(&w, "verifies", session.verifies);
+    json_write_int(&w, "verify_failures", session.verify_failures);
+    json_write_int(&w, "verify_ms_max", session.verify_ms_max);
+    json_write_int(&w, "requests", session.requests);
+    json_write_int(&w, "reused", session.reused);
+    json_write_int(&w, "latency_ms_avg", session.requests ? session.latency_ms_total / session.requests : 0);
+    json_write_int(&w, "latency_ms_max", session.latency_ms_max);
+    json_write_object_end(&w);
+    json_write_object_end(&w);
+
+    if (json_writer_finish(&w) < 0) {
+        ESP_LOGE(TAG, "status json needs %d bytes", (int)w.len + 1);
+        return;
+    }
 
     ESP_LOGI(TAG, "ssid: %s, ip:"IPSTR", netmask:"IPSTR", gw:"IPSTR", if_up? %s",
         wifi_cfg.sta.ssid, IP2STR(&ip_info.ip), IP2STR(&ip_info.netmask), IP2STR(&ip_info.gw), if_status?"TRUE":"FALSE");
 
     send_sse_message(out, "status");
-
-    /* free all objects under root and root itself */
-    cJSON_Delete(root);
-    free(out);
-
 }
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
@@ -246,11 +337,25 @@ esp_err_t root_handler(httpd_req_t *req)
 }
 
 /* GET handler for /ap.json. Retrieves list of APs */
+// [{"ssid", "chan", "rssi", "auth"}, ...]
+static void write_ap_json(json_writer_t *w, const wifi_ap_record_t *ap_info, uint16_t ap_count)
+{
+    json_write_array_start(w, NULL);
+    for (int i = 0; i < ap_count && i <= MAX_AP_COUNT; i++) {
+        json_write_object_start(w, NULL);
+        json_write_string(w, "ssid", (const char *)ap_info[i].ssid);
+        json_write_int(w, "chan", ap_info[i].primary);
+        json_write_int(w, "rssi", ap_info[i].rssi);
+        json_write_int(w, "auth", ap_info[i].authmode);
+        json_write_object_end(w);
+    }
+    json_write_array_end(w);
+}
+
 esp_err_t ap_json_handler(httpd_req_t *req)
 {
-    char *out;
-    cJSON *root, *fld;
-    root = cJSON_CreateArray();
+    char *out = NULL;
+    json_writer_t w;
 
     uint16_t ap_count = 0;
 
@@ -264,33 +369,53 @@ esp_err_t ap_json_handler(httpd_req_t *req)
         ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_info));
 
         ESP_LOGI(TAG, "Total APs scanned = %u", ap_count);
-        for (int i = 0; i < ap_count && i <= MAX_AP_COUNT; i++) {
-            cJSON_AddItemToArray(root, fld = cJSON_CreateObject());
-            cJSON_AddItemToObject(fld, "ssid", cJSON_CreateString((const char *)ap_info[i].ssid));
-            cJSON_AddItemToObject(fld, "chan", cJSON_CreateNumber(ap_info[i].primary));
-            cJSON_AddItemToObject(fld, "rssi", cJSON_CreateNumber(ap_info[i].rssi));
-            cJSON_AddItemToObject(fld, "auth", cJSON_CreateNumber(ap_info[i].authmode));
+
+        // measure first, then one allocation of the exact size
+        json_writer_init(&w, NULL, 0);
+        write_ap_json(&w, ap_info, ap_count);
+        size_t out_size = w.len + 1;
+        out = malloc(out_size);
+        if (out) {
+            json_writer_init(&w, out, out_size);
+            write_ap_json(&w, ap_info, ap_count);
+            json_writer_finish(&w);
         }
         free(ap_info);
     }
     else {
         ESP_LOGI(TAG, "Scan or connect in progress");
     }
-
-    out = cJSON_PrintUnformatted(root);
    
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
     httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    httpd_resp_send(req, out, strlen(out));      
+    httpd_resp_send(req, out ? out : "[]", out ? strlen(out) : 2);
 
-    /* free all objects under root and root itself */
-    cJSON_Delete(root);
     free(out);
 
     return ESP_OK;
 }
 
+/* GET handler for /latency.json. p50/p99 of each stage from button edge to light, see latency_trace.h */
+esp_err_t latency_json_handler(httpd_req_t *req)
+{
+    char *out = latency_json();
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
+    httpd_resp_set_hdr(req, "Pragma", "no-cache");
+    if (out) {
+        httpd_resp_send(req, out, strlen(out));
+        free(out);
+    }
+    else {
+        httpd_resp_set_status(req, HTTPD_500);
+        httpd_resp_send(req, NULL, 0);
+    }
+
+    return ESP_OK;
+}
+
 /* POST handler for /connect.json. Takes SSID and Password and connects to AP */
 esp_err_t connect_json_handler(httpd_req_t *req)
 {
@@ -418,6 +543,49 @@ esp_err_t restart_json_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* POST handler for /scene.json. Takes {"name": "..."} and applies that scene */
+esp_err_t scene_json_handler(httpd_req_t *req)
+{
+    int total_len = req->content_len;
+    int cur_len = 0;
+    char buf[SCRATCH_BUFSIZE];
+    int received = 0;
+
+    if (total_len >= SCRATCH_BUFSIZE) {
+        // Client will not receive response if it hasn't finished sending the POST data
+        // Can't store to buffer (too big), so just close connection
+        return ESP_FAIL;
+    }
+    while (cur_len < total_len) {
+        received = httpd_req_recv(req, buf + cur_len, total_len);
+        if (received <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                    // Retry if timeout occurred
+                    continue;
+                }
+                ESP_LOGE(TAG, "JSON reception failed!");
+                return ESP_FAIL;
+        }
+        cur_len += received;
+    }
+    buf[total_len] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+
+    esp_err_t err = cJSON_IsString(name) ? scenes_apply(name->valuestring) : ESP_ERR_INVALID_ARG;
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_set_status(req, HTTPD_404);
+    }
+    else if (err != ESP_OK) {
+        httpd_resp_set_status(req, HTTPD_400);
+    }
+    httpd_resp_send(req, NULL, 0);
+
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
 /* POST handler for /updateboot. 
    Use curl to POST binary file to be updated to OTA_0 */
 esp_err_t update_boot_handler(httpd_req_t *req)
@@ -519,6 +687,108 @@ esp_err_t update_boot_handler(httpd_req_t *req)
 
 
 /* GET handler for /getlights.json. Gets light config from NVS */
+// Everything read from NVS once, then rendered twice: to measure, then to write
+typedef struct {
+    bool has_status_led;
+    uint8_t status_led_gpio;
+    uint8_t num_lights;
+    lights_t *light_config;                     // NULL if not read
+    uint8_t *curves;
+    char **remote_cmds;                         // rendered JSON per light, NULL if none
+    bool has_invert;
+    bool invert_config[4];                      // status, light_gpio, led_gpio, button_gpio
+    bool has_controller;
+    char controller_id[HAP_SESSION_ID_SIZE];
+    char ltpk_hex[2 * HAP_SESSION_KEY_SIZE + 1];
+    fade_config_t fade_config;
+    scene_t scenes[SCENE_MAX];
+    int num_scenes;
+    bool udp_key_set;
+} lights_json_t;
+
+static void write_lights_json(json_writer_t *w, const lights_json_t *c)
+{
+    json_write_object_start(w, NULL);
+    if (c->has_status_led) {
+        json_write_int(w, "status_led", c->status_led_gpio);
+    }
+
+    if (c->num_lights > 0) {
+        if (c->light_config) {
+            json_write_array_start(w, "lights");
+            for (int i = 0; i < c->num_lights; i++) {
+                json_write_object_start(w, NULL);
+                json_write_int(w, "light_gpio", c->light_config[i].light_gpio);
+                json_write_int(w, "led_gpio", c->light_config[i].led_gpio);
+                json_write_int(w, "button_gpio", c->light_config[i].button_gpio);
+                json_write_bool(w, "is_dimmer", c->light_config[i].is_dimmer);
+                json_write_bool(w, "is_remote", c->light_config[i].is_remote);
+                json_write_string(w, "curve", dimming_curve_name(c->curves[i]));
+                if (c->remote_cmds[i]) {
+                    // saved by /setlights.json as unformatted JSON
+                    json_write_raw(w, "remote_cmd", c->remote_cmds[i]);
+                }
+                else {
+                    json_write_null(w, "remote_cmd");
+                }
+                json_write_object_end(w);
+            }
+            json_write_array_end(w);
+        }
+
+        if (c->has_invert) {
+            json_write_object_start(w, "invert");
+            json_write_bool(w, "status_gpio", c->invert_config[0]);
+            json_write_bool(w, "light_gpio", c->invert_config[1]);
+            json_write_bool(w, "led_gpio", c->invert_config[2]);
+            json_write_bool(w, "button_gpio", c->invert_config[3]);
+            json_write_object_end(w);
+        }
+
+        if (c->has_controller) {
+            json_write_object_start(w, "hap_controller");
+            json_write_string(w, "id", c->controller_id);
+            json_write_string(w, "ltpk", c->ltpk_hex);
+            json_write_object_end(w);
+        }
+
+        json_write_object_start(w, "fade");
+        json_write_int(w, "homekit_ms", c->fade_config.homekit_ms);
+        json_write_int(w, "toggle_ms", c->fade_config.toggle_ms);
+        json_write_int(w, "dim_sweep_ms", c->fade_config.dim_sweep_ms);
+        json_write_object_end(w);
+
+        // "lights" in a scene are indexes into the lights above
+        json_write_array_start(w, "scenes");
+        for (int i = 0; i < c->num_scenes; i++) {
+            const scene_t *scene = &c->scenes[i];
+            json_write_object_start(w, NULL);
+            json_write_string(w, "name", scene->name);
+            if (scene->button >= 0) {
+                json_write_int(w, "button", scene->button);
+            }
+            else {
+                json_write_null(w, "button");
+            }
+            json_write_array_start(w, "lights");
+            for (int j = 0; j < MIN(scene->num_targets, SCENE_MAX_TARGETS); j++) {
+                json_write_object_start(w, NULL);
+                json_write_int(w, "light", scene->targets[j].light);
+                json_write_bool(w, "on", scene->targets[j].on);
+                json_write_int(w, "brightness", scene->targets[j].brightness);
+                json_write_object_end(w);
+            }
+            json_write_array_end(w);
+            json_write_object_end(w);
+        }
+        json_write_array_end(w);
+
+        // the key itself is never sent back
+        json_write_bool(w, "udp_key_set", c->udp_key_set);
+    }
+    json_write_object_end(w);
+}
+
 esp_err_t getlights_json_handler(httpd_req_t *req)
 {
     esp_err_t err;
@@ -527,95 +797,125 @@ esp_err_t getlights_json_handler(httpd_req_t *req)
     err = nvs_open("lights", NVS_READWRITE, &lights_config_handle);
     if (err == ESP_OK) {
         char *out;
-        cJSON *root, *lights_json, *fld, *invert_json;
-
-        root = cJSON_CreateObject();
+        json_writer_t w;
+        lights_json_t config = { 0 };
 
         // Status LED
-        uint8_t status_led_gpio = 0;
-        err = nvs_get_u8(lights_config_handle, "status_led", &status_led_gpio); 
+        err = nvs_get_u8(lights_config_handle, "status_led", &config.status_led_gpio); 
         if (err == ESP_OK) {
-            cJSON_AddItemToObject(root, "status_led", cJSON_CreateNumber(status_led_gpio));
+            config.has_status_led = true;
         }
         else {
             ESP_LOGW(TAG, "error nvs_get_u8 status_led err %d", err);
         }
 
         // Get configured number of lights
-        uint8_t num_lights = 0;
-        err = nvs_get_u8(lights_config_handle, "num_lights", &num_lights);
+        err = nvs_get_u8(lights_config_handle, "num_lights", &config.num_lights);
         if (err != ESP_OK) {
             ESP_LOGW(TAG, "error nvs_get_u8 num_lights err %d", err);
         }
 
+        int num_lights = config.num_lights;
+        lights_t light_config[MAX(num_lights, 1)];
+        uint8_t curves[MAX(num_lights, 1)];
+        char *remote_cmds[MAX(num_lights, 1)];
+        memset(remote_cmds, 0, sizeof(remote_cmds));
+
         if (num_lights > 0) {
-            lights_t light_config[num_lights];
             size_t size = num_lights * sizeof(lights_t);
             err = nvs_get_blob(lights_config_handle, "config", light_config, &size);
             if (err == ESP_OK) {
-                lights_json = cJSON_CreateArray();
-                cJSON_AddItemToObject(root, "lights", lights_json);
+                config.light_config = light_config;
+
+                // saved before there was a choice of curve: all gamma
+                memset(curves, DIMMING_CURVE_GAMMA, num_lights);
+                size = num_lights;
+                nvs_get_blob(lights_config_handle, "curves", curves, &size);
+                config.curves = curves;
 
                 for (int i = 0; i < num_lights; i++) {
-                    cJSON_AddItemToArray(lights_json, fld = cJSON_CreateObject());
-                    cJSON_AddItemToObject(fld, "light_gpio", cJSON_CreateNumber(light_config[i].light_gpio));
-                    cJSON_AddItemToObject(fld, "led_gpio", cJSON_CreateNumber(light_config[i].led_gpio));
-                    cJSON_AddItemToObject(fld, "button_gpio", cJSON_CreateNumber(light_config[i].button_gpio));
-                    cJSON_AddItemToObject(fld, "is_dimmer", cJSON_CreateBool(light_config[i].is_dimmer));
-                    cJSON_AddItemToObject(fld, "is_remote", cJSON_CreateBool(light_config[i].is_remote));
-
-                    int remote_cmd_len = snprintf(NULL, 0, "rem_cmd_%d", i);
-                    char *remote_cmd_key = malloc(remote_cmd_len + 1);
-                    snprintf(remote_cmd_key, remote_cmd_len + 1, "rem_cmd_%d", i);
+                    char remote_cmd_key[16];
+                    snprintf(remote_cmd_key, sizeof(remote_cmd_key), "rem_cmd_%d", i);
                     size_t required_size;
                     err = nvs_get_str(lights_config_handle, remote_cmd_key, NULL, &required_size); //includes zero-terminator
                     if (err == ESP_OK) {
-                        char *remote_cmd_val = malloc(required_size); 
-                        nvs_get_str(lights_config_handle, remote_cmd_key, remote_cmd_val, &required_size);
-                        cJSON_AddItemToObject(fld, "remote_cmd", cJSON_Parse(remote_cmd_val));
-
-ESP_LOGW("nvs", "key: %s value: %s", remote_cmd_key, remote_cmd_val);
-
-                        free(remote_cmd_val);
-                    } else {
-                        cJSON_AddItemToObject(fld, "remote_cmd", cJSON_CreateNull());
+                        remote_cmds[i] = malloc(required_size);
+                        if (remote_cmds[i] &&
+                            nvs_get_str(lights_config_handle, remote_cmd_key, remote_cmds[i], &required_size) != ESP_OK) {
+                            free(remote_cmds[i]);
+                            remote_cmds[i] = NULL;
+                        }
                     }
-                    free(remote_cmd_key);
-
-                 }
+                }
+                config.remote_cmds = remote_cmds;
             }
             else {
-                ESP_LOGW(TAG, "error nvs_get_u8 num_lights err %d", err);
+                ESP_LOGW(TAG, "error nvs_get_blob config err %d", err);
             }
 
             //4; status, light_gpio, led_gpio, button_gpio
-            bool invert_config[4];
-            size = 4 * sizeof(bool);
-            err = nvs_get_blob(lights_config_handle, "invert", invert_config, &size);
+            size = sizeof(config.invert_config);
+            err = nvs_get_blob(lights_config_handle, "invert", config.invert_config, &size);
             if (err == ESP_OK) {
-                invert_json = cJSON_CreateObject();
-                cJSON_AddItemToObject(root, "invert", invert_json);
-                cJSON_AddItemToObject(invert_json, "status_gpio",cJSON_CreateBool(invert_config[0]));
-                cJSON_AddItemToObject(invert_json, "light_gpio",cJSON_CreateBool(invert_config[1]));
-                cJSON_AddItemToObject(invert_json, "led_gpio",cJSON_CreateBool(invert_config[2]));
-                cJSON_AddItemToObject(invert_json, "button_gpio",cJSON_CreateBool(invert_config[3]));
+                config.has_invert = true;
             }
             else {
                 ESP_LOGW(TAG, "error nvs_get_u8 invert err %d", err);
             }
 
-            nvs_close(lights_config_handle);
+            // add this controller to an accessory, then give its id and key in remote_cmd
+            uint8_t controller_ltpk[HAP_SESSION_KEY_SIZE];
+            if (hap_session_get_identity(config.controller_id, sizeof(config.controller_id), controller_ltpk) == ESP_OK) {
+                for (int i = 0; i < HAP_SESSION_KEY_SIZE; i++) {
+                    sprintf(config.ltpk_hex + 2 * i, "%02x", controller_ltpk[i]);
+                }
+                config.has_controller = true;
+            }
+
+            // saved before fades could be set: the defaults
+            size = sizeof(config.fade_config);
+            if (nvs_get_blob(lights_config_handle, "fade", &config.fade_config, &size) != ESP_OK) {
+                config.fade_config = (fade_config_t) FADE_CONFIG_DEFAULT;
+            }
+
+            size = sizeof(config.scenes);
+            if (nvs_get_blob(lights_config_handle, "scenes", config.scenes, &size) != ESP_OK) {
+                size = 0;
+            }
+            config.num_scenes = size / sizeof(scene_t);
+            for (int i = 0; i < config.num_scenes; i++) {
+                config.scenes[i].name[SCENE_NAME_SIZE - 1] = '\0';
+            }
+
+            size_t udp_key_size;
+            config.udp_key_set = nvs_get_str(lights_config_handle, "udp_key", NULL, &udp_key_size) == ESP_OK;
         }
+        nvs_close(lights_config_handle);
 
-        out = cJSON_PrintUnformatted(root);
-        
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-        httpd_resp_set_hdr(req, "Pragma", "no-cache");
-        httpd_resp_send(req, out, strlen(out));      
+        // measure first, then one allocation of the exact size
+        json_writer_init(&w, NULL, 0);
+        write_lights_json(&w, &config);
+        size_t out_size = w.len + 1;
+        out = malloc(out_size);
+        if (out) {
+            json_writer_init(&w, out, out_size);
+            write_lights_json(&w, &config);
+            json_writer_finish(&w);
+        }
+        for (int i = 0; i < num_lights; i++) {
+            free(remote_cmds[i]);
+        }
 
-        /* free all objects under root and root itself */
-        cJSON_Delete(root);
+        if (out) {
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
+            httpd_resp_set_hdr(req, "Pragma", "no-cache");
+            httpd_resp_send(req, out, strlen(out));      
+        }
+        else {
+            httpd_resp_set_status(req, HTTPD_500);
+            httpd_resp_send(req, NULL, 0);
+        }
         free(out);
     }
     else {
@@ -687,6 +987,8 @@ esp_err_t setlights_json_handler(httpd_req_t *req)
             memset(light_config, 0, num_lights * sizeof(lights_t));
 
             char *remote_cmd[num_lights];
+            uint8_t curves[num_lights];
+            memset(curves, DIMMING_CURVE_GAMMA, sizeof(curves));
 
             cJSON *fld;
             uint8_t i = 0;
@@ -711,6 +1013,9 @@ esp_err_t setlights_json_handler(httpd_req_t *req)
                 }
                 light_config[i].is_dimmer = cJSON_IsTrue(cJSON_GetObjectItem(fld, "is_dimmer"));
                 light_config[i].is_remote = cJSON_IsTrue(cJSON_GetObjectItem(fld, "is_remote"));
+                // "gamma" (the default), "cie1931" or "linear"
+                key = cJSON_GetObjectItem(fld, "curve");
+                curves[i] = dimming_curve_from_name(cJSON_IsString(key) ? key->valuestring : NULL);
 
                 key = cJSON_GetObjectItem(fld, "remote_cmd");
                 if (!light_config[i].is_remote || !cJSON_IsObject(key)) {
@@ -733,11 +1038,12 @@ esp_err_t setlights_json_handler(httpd_req_t *req)
             invert[3] = cJSON_IsTrue(cJSON_GetObjectItem(invert_json, "button_gpio"));
 
             ESP_LOGI(TAG, 
-                "          Light  LED   Button  Dimmable? Remote?");
+                "          Light  LED   Button  Dimmable? Remote? Curve");
             for (i = 0; i < num_lights; i++) {
                 ESP_LOGI(TAG, 
-                "Light %d    %2d     %2d     %2d     %s     %s", (i + 1), light_config[i].light_gpio, light_config[i].led_gpio, light_config[i].button_gpio, 
-                                                                    light_config[i].is_dimmer ? "true" : "false", light_config[i].is_remote ? "true" : "false");
+                "Light %d    %2d     %2d     %2d     %s     %s   %s", (i + 1), light_config[i].light_gpio, light_config[i].led_gpio, light_config[i].button_gpio, 
+                                                                    light_config[i].is_dimmer ? "true" : "false", light_config[i].is_remote ? "true" : "false",
+                                                                    dimming_curve_name(curves[i]));
                 if (light_config[i].is_remote) {
                     ESP_LOGI(TAG, 
                     " Command   %s", remote_cmd[i]);
@@ -757,6 +1063,12 @@ esp_err_t setlights_json_handler(httpd_req_t *req)
                 ESP_LOGW(TAG, "error nvs_set_blob lights size %d err %d", size, err);
             }
 
+            size = num_lights * sizeof(uint8_t);
+            err = nvs_set_blob(lights_config_handle, "curves", curves, size);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "error nvs_set_blob curves size %d err %d", size, err);
+            }
+
             size = 4 * sizeof(bool);
             err = nvs_set_blob(lights_config_handle, "invert", invert, size);
             if (err != ESP_OK) {
@@ -778,6 +1090,95 @@ esp_err_t setlights_json_handler(httpd_req_t *req)
         else {
             ESP_LOGE(TAG, "error parsing lights array json");
         }
+
+        // fade times in ms, any left out keep their default
+        cJSON *fade_json = cJSON_GetObjectItem(root, "fade");
+        if (cJSON_IsObject(fade_json)) {
+            fade_config_t fade_config = FADE_CONFIG_DEFAULT;
+            cJSON *key = cJSON_GetObjectItem(fade_json, "homekit_ms");
+            if (cJSON_IsNumber(key) && key->valueint >= 0) {
+                fade_config.homekit_ms = MIN(key->valueint, FADE_CONFIG_MAX_MS);
+            }
+            key = cJSON_GetObjectItem(fade_json, "toggle_ms");
+            if (cJSON_IsNumber(key) && key->valueint >= 0) {
+                fade_config.toggle_ms = MIN(key->valueint, FADE_CONFIG_MAX_MS);
+            }
+            // 0 would jump straight to the end of the hold
+            key = cJSON_GetObjectItem(fade_json, "dim_sweep_ms");
+            if (cJSON_IsNumber(key) && key->valueint >= 500) {
+                fade_config.dim_sweep_ms = MIN(key->valueint, FADE_CONFIG_MAX_MS);
+            }
+            ESP_LOGI(TAG, "Fade homekit %dms toggle %dms dim sweep %dms",
+                     fade_config.homekit_ms, fade_config.toggle_ms, fade_config.dim_sweep_ms);
+
+            err = nvs_set_blob(lights_config_handle, "fade", &fade_config, sizeof(fade_config));
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "error nvs_set_blob fade err %d", err);
+            }
+        }
+
+        // scenes replace the ones saved, an empty array removes them all
+        cJSON *scenes_json = cJSON_GetObjectItem(root, "scenes");
+        if (cJSON_IsArray(scenes_json)) {
+            scene_t scenes[SCENE_MAX];
+            memset(scenes, 0, sizeof(scenes));
+            int num_scenes = 0;
+
+            cJSON *scene_json;
+            cJSON_ArrayForEach(scene_json, scenes_json) {
+                cJSON *name = cJSON_GetObjectItem(scene_json, "name");
+                if (!cJSON_IsString(name) || !name->valuestring[0] || num_scenes == SCENE_MAX) {
+                    ESP_LOGW(TAG, "error scene %d ignored", num_scenes + 1);
+                    continue;
+                }
+                scene_t *scene = &scenes[num_scenes++];
+                strlcpy(scene->name, name->valuestring, sizeof(scene->name));
+
+                cJSON *key = cJSON_GetObjectItem(scene_json, "button");
+                scene->button = cJSON_IsNumber(key) && key->valueint >= 0 && key->valueint < SCENE_MAX_TARGETS ? key->valueint : -1;
+
+                cJSON *fld;
+                cJSON_ArrayForEach(fld, cJSON_GetObjectItem(scene_json, "lights")) {
+                    key = cJSON_GetObjectItem(fld, "light");
+                    if (!cJSON_IsNumber(key) || key->valueint < 0 || key->valueint >= SCENE_MAX_TARGETS ||
+                            scene->num_targets == SCENE_MAX_TARGETS) {
+                        continue;
+                    }
+                    scene_target_t *target = &scene->targets[scene->num_targets++];
+                    target->light = key->valueint;
+                    target->on = cJSON_IsTrue(cJSON_GetObjectItem(fld, "on"));
+                    key = cJSON_GetObjectItem(fld, "brightness");
+                    target->brightness = cJSON_IsNumber(key) ? MIN(100, MAX(1, key->valueint)) : 100;
+                }
+                ESP_LOGI(TAG, "Scene %s  lights %d  button %d", scene->name, scene->num_targets, scene->button);
+            }
+
+            if (num_scenes > 0) {
+                err = nvs_set_blob(lights_config_handle, "scenes", scenes, num_scenes * sizeof(scene_t));
+            }
+            else {
+                err = nvs_erase_key(lights_config_handle, "scenes");
+                err = err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+            }
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "error saving scenes err %d", err);
+            }
+        }
+
+        // shared key for the UDP fast path between switches, empty turns it off
+        cJSON *udp_key_json = cJSON_GetObjectItem(root, "udp_key");
+        if (cJSON_IsString(udp_key_json)) {
+            if (udp_key_json->valuestring[0]) {
+                err = nvs_set_str(lights_config_handle, "udp_key", udp_key_json->valuestring);
+            }
+            else {
+                err = nvs_erase_key(lights_config_handle, "udp_key");
+                err = err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+            }
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "error saving udp_key err %d", err);
+            }
+        }
         
         err = nvs_commit(lights_config_handle);
         if (err != ESP_OK) {
@@ -806,6 +1207,7 @@ esp_err_t start_webserver(void)
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_open_sockets = 5;
+    config.max_uri_handlers = 10;
     // kick off any old socket connections to allow new connections
     config.lru_purge_enable = true;
 
@@ -873,6 +1275,23 @@ esp_err_t start_webserver(void)
         };
         httpd_register_uri_handler(server, &server_side_event_registration_page);
 
+        // Press latency histograms, also sent to SSE clients as "latency" events
+        httpd_uri_t latency_json_page = {
+            .uri       = "/latency.json",
+            .method    = HTTP_GET,
+            .handler   = latency_json_handler,
+            .user_ctx  = NULL
+        };
+        httpd_register_uri_handler(server, &latency_json_page);
+
+        httpd_uri_t scene_json_page = {
+            .uri       = "/scene.json",
+            .method    = HTTP_POST,
+            .handler   = scene_json_handler,
+            .user_ctx  = NULL
+        };
+        httpd_register_uri_handler(server, &scene_json_page);
+
         // Not shown on the webpage. Used to update boot partition
         httpd_uri_t update_boot_page = {
             .uri       = "/updateboot",
@@ -893,7 +1312,8 @@ esp_err_t start_webserver(void)
         
         // Task to accept messages from queue and send to SSE clients
         q_sse_message_queue = xQueueCreate( 10, sizeof(char)*LOG_BUF_MAX_LINE_SIZE );
-        xTaskCreate(&sse_logging_task, "sse", 2048, NULL, 4, &t_sse_task_handle);
+        //   (send_sse_message copies a "latency" event onto this task's stack)
+        xTaskCreate(&sse_logging_task, "sse", 3072, NULL, 4, &t_sse_task_handle);
 
         #ifdef CONFIG_IDF_TARGET_ESP32
             esp_log_set_vprintf(&sse_logging_vprintf);
@@ -7,6 +7,7 @@ extern "C" {
 #define MAX_AP_COUNT 10
 #define LOG_BUF_MAX_LINE_SIZE 160
 #define MAX_SSE_CLIENTS 3
+#define LATENCY_SSE_PERIOD_MS 5000
 
 esp_err_t start_webserver(void);
 void stop_webserver(void);
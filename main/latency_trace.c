@@ -0,0 +1,162 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "latency_trace.h"
+
+#include "esp_log.h"
+
+#if LATENCY_TRACE
+
+static const char *TAG = "latency_trace";
+
+// named by the point each stage ends at; the EDGE slot holds the whole press
+static const char *stage_names[LATENCY_STAGES] = {
+    [LATENCY_EDGE] = "press",
+    [LATENCY_POSTED] = "button",
+    [LATENCY_HANDLED] = "event_loop",
+    [LATENCY_DEQUEUED] = "queue",
+    [LATENCY_RESOLVED] = "mdns",
+    [LATENCY_SENT] = "prepare",
+    [LATENCY_DONE] = "network",
+    [LATENCY_APPLIED] = "output",
+};
+
+typedef struct {
+    uint16_t buckets[LATENCY_TRACE_BUCKETS];    // all halved when one fills, so old presses fade out
+    uint32_t count;
+    uint32_t max_us;
+} histogram_t;
+
+static histogram_t histograms[LATENCY_STAGES];
+static uint32_t presses;
+static SemaphoreHandle_t trace_mutex = NULL;
+
+// Two buckets per power of two: [128, 192), [192, 256), [256, 384), ...
+static int bucket_of(uint32_t us) {
+    if (us < LATENCY_TRACE_MIN_US) {
+        return 0;
+    }
+    int msb = 31 - __builtin_clz(us);
+    int bucket = 1 + (msb - 7) * 2 + ((us >> (msb - 1)) & 1);
+    return MIN(bucket, LATENCY_TRACE_BUCKETS - 1);
+}
+
+static uint32_t bucket_upper_us(int bucket) {
+    if (bucket == 0) {
+        return LATENCY_TRACE_MIN_US;
+    }
+    int msb = 7 + (bucket - 1) / 2;
+    return (1u << msb) + (((bucket - 1) & 1) + 1) * (1u << (msb - 1));
+}
+
+// take trace_mutex before calling
+static void add_sample(histogram_t *histogram, uint32_t us) {
+    int bucket = bucket_of(us);
+    if (histogram->buckets[bucket] == UINT16_MAX) {
+        for (int i = 0; i < LATENCY_TRACE_BUCKETS; i++) {
+            histogram->buckets[i] /= 2;
+        }
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->max_us = MAX(histogram->max_us, us);
+}
+
+// take trace_mutex before calling
+static uint32_t percentile_us(const histogram_t *histogram, int percent) {
+    uint32_t total = 0;
+    for (int i = 0; i < LATENCY_TRACE_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_TRACE_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen * 100 >= total * percent) {
+            return MIN(bucket_upper_us(i), histogram->max_us);
+        }
+    }
+    return histogram->max_us;
+}
+
+#endif // LATENCY_TRACE
+
+esp_err_t latency_trace_init(void) {
+#if LATENCY_TRACE
+    trace_mutex = xSemaphoreCreateMutex();
+    if (!trace_mutex) {
+        ESP_LOGE(TAG, "mutex create failed");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    return ESP_OK;
+}
+
+void latency_trace_start(latency_trace_t *trace) {
+    memset(trace, 0, sizeof(*trace));
+    latency_trace_mark(trace, LATENCY_EDGE);
+}
+
+void latency_trace_mark(latency_trace_t *trace, latency_point_t point) {
+    // 0 means not reached, so never store it
+    trace->us[point] = (uint32_t) esp_timer_get_time() | 1;
+}
+
+void latency_trace_commit(latency_trace_t *trace) {
+#if LATENCY_TRACE
+    latency_point_t end = trace->us[LATENCY_APPLIED] ? LATENCY_APPLIED : LATENCY_DONE;
+
+    if (trace_mutex && trace->us[LATENCY_EDGE] && trace->us[end]) {
+        xSemaphoreTake(trace_mutex, portMAX_DELAY);
+        uint32_t last = trace->us[LATENCY_EDGE];
+        for (int point = LATENCY_EDGE + 1; point < LATENCY_POINTS; point++) {
+            if (trace->us[point]) {
+                // unsigned, so the 71 minute wrap of the 32 bit times does not matter
+                add_sample(&histograms[point], trace->us[point] - last);
+                last = trace->us[point];
+            }
+        }
+        add_sample(&histograms[LATENCY_EDGE], trace->us[end] - trace->us[LATENCY_EDGE]);
+        presses++;
+        xSemaphoreGive(trace_mutex);
+    }
+#endif
+    memset(trace, 0, sizeof(*trace));
+}
+
+uint32_t latency_trace_get_presses(void) {
+#if LATENCY_TRACE
+    return presses;
+#else
+    return 0;
+#endif
+}
+
+int latency_trace_get_stats(latency_stage_stats_t *stats, int max) {
+    int n = 0;
+#if LATENCY_TRACE
+    if (!trace_mutex) {
+        return 0;
+    }
+    xSemaphoreTake(trace_mutex, portMAX_DELAY);
+    for (int stage = 0; stage < LATENCY_STAGES && n < max; stage++) {
+        const histogram_t *histogram = &histograms[stage];
+        stats[n].name = stage_names[stage];
+        stats[n].count = histogram->count;
+        stats[n].p50_us = percentile_us(histogram, 50);
+        stats[n].p99_us = percentile_us(histogram, 99);
+        stats[n].max_us = histogram->max_us;
+        n++;
+    }
+    xSemaphoreGive(trace_mutex);
+#endif
+    return n;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Set to 0 (e.g. with -DLATENCY_TRACE=0) to compile the trace points out
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE           1
+#endif
+
+#define LATENCY_TRACE_MIN_US    128             // first bucket boundary, anything quicker is in bucket 0
+#define LATENCY_TRACE_BUCKETS   34              // two per power of two from 128us, the last from ~8.4s up
+
+// Where a button press has got to. A press is traced from the debounced edge
+//   to the light changing: a local light's fade starting or GPIO level, or the
+//   remote host's answer to the request
+typedef enum {
+    LATENCY_EDGE,                               // button.c saw the debounced edge (BUTTON_EVENT_DOWN)
+    LATENCY_POSTED,                             // button_callback posted the press event
+    LATENCY_HANDLED,                            // main_event_handler has it
+    LATENCY_DEQUEUED,                           // remote_hk_task took the command off its queue
+    LATENCY_RESOLVED,                           // remote host address known
+    LATENCY_SENT,                               // handed to http_pool or remote_udp
+    LATENCY_DONE,                               // remote host answered
+    LATENCY_APPLIED,                            // local light's fade started or GPIO set
+    LATENCY_POINTS,
+} latency_point_t;
+
+// One press. Carried along with the command, by copy, so it holds no pointers
+typedef struct {
+    uint32_t us[LATENCY_POINTS];                // esp_timer time, 0 if not reached
+} latency_trace_t;
+
+// Each stage ends at a point and starts at the last point reached before it;
+//   the last stage is the whole press, edge to the light changing
+#define LATENCY_STAGES          LATENCY_POINTS
+
+typedef struct {
+    const char *name;
+    uint32_t count;
+    uint32_t p50_us;                            // bucket upper bounds, so at most ~40% high
+    uint32_t p99_us;
+    uint32_t max_us;
+} latency_stage_stats_t;
+
+#if LATENCY_TRACE
+#define LATENCY_START(trace)            latency_trace_start(trace)
+#define LATENCY_MARK(trace, point)      latency_trace_mark((trace), (point))
+#define LATENCY_COMMIT(trace)           latency_trace_commit(trace)
+#else
+#define LATENCY_START(trace)            ((void) 0)
+#define LATENCY_MARK(trace, point)      ((void) 0)
+#define LATENCY_COMMIT(trace)           ((void) 0)
+#endif
+
+esp_err_t latency_trace_init(void);
+
+// Clear trace and mark LATENCY_EDGE
+void latency_trace_start(latency_trace_t *trace);
+
+void latency_trace_mark(latency_trace_t *trace, latency_point_t point);
+
+// Add a press that reached LATENCY_DONE or LATENCY_APPLIED to the histograms.
+//   The trace is cleared either way, so only the first commit of a press counts
+void latency_trace_commit(latency_trace_t *trace);
+
+// Presses committed so far, to tell whether the stats have changed
+uint32_t latency_trace_get_presses(void);
+
+// Fill stats, one per stage. Returns the number filled
+int latency_trace_get_stats(latency_stage_stats_t *stats, int max);
+
+#ifdef __cplusplus
+}
+#endif
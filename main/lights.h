@@ -15,6 +15,38 @@ typedef struct {
     bool is_remote;
 } lights_t;
 
+// Each light's dimming_curve_t is in a separate uint8_t blob, "curves", so
+//   "config" blobs saved before it still load
+
+// Fade times, stored in NVS as the blob "fade". Missing means FADE_CONFIG_DEFAULT
+typedef struct {
+    uint16_t homekit_ms;        // a change from HomeKit (or another switch)
+    uint16_t toggle_ms;         // button press on/off and double press full on
+    uint16_t dim_sweep_ms;      // button hold, 10% to 100%
+} fade_config_t;
+
+#define FADE_CONFIG_DEFAULT     { .homekit_ms = 400, .toggle_ms = 200, .dim_sweep_ms = 4500 }
+#define FADE_CONFIG_MAX_MS      60000
+
+#define SCENE_MAX               8
+#define SCENE_MAX_TARGETS       5               // as many lights as /setlights.json keeps
+#define SCENE_NAME_SIZE         16
+
+// One light's part of a scene
+typedef struct {
+    uint8_t light;              // index into "config"
+    bool on;
+    uint8_t brightness;         // 1-100, dimmers only
+} scene_target_t;
+
+// Stored in NVS as the blob "scenes", an array of up to SCENE_MAX
+typedef struct {
+    char name[SCENE_NAME_SIZE];
+    int8_t button;              // light whose button applies it with a triple press, -1 for none
+    uint8_t num_targets;
+    scene_target_t targets[SCENE_MAX_TARGETS];
+} scene_t;
+
 #ifdef __cplusplus
 }
 #endif 
\ No newline at end of file
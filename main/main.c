@@ -1,14 +1,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <freertos/timers.h>
+#include "freertos/semphr.h"
 
 #include "driver/gpio.h"
 #include <sys/param.h>                          // min max functions
-#include <math.h>                               // pow function
 #include <string.h>
 
 #include "pwm.h"
-#define PWM_PERIOD_IN_US    1000                // in microseconds (1000us = 1kHz)
+#include "dimming_curve.h"                      // brightness to duty tables for PWM_PERIOD_IN_US (set in CMakeLists.txt)
+#include "fade.h"                               // every PWM channel fades from one frame timer
 
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -22,8 +23,12 @@
 #endif
 
 #include "esp_http_client.h"
-#include "cJSON.h"
-#define MAX_HTTP_OUTPUT_BUFFER 2048
+#include "remote_plan.h"                        // rem_cmd_%d compiled once at boot
+#include "hap_response.h"                       // remote responses read as they stream in
+#include "esp_timer.h"                          // esp_timer_get_time for per-press timing
+#define REMOTE_DIM_MIN_PERIOD_MS    100         // as fast as local dimming on a quick LAN
+#define REMOTE_DIM_MAX_PERIOD_MS    1000
+#define REMOTE_UDP_BACKOFF_MS       60000       // use HAP only for this long after a UDP command went unanswered
 
 #include "button.h"
 ESP_EVENT_DEFINE_BASE(BUTTON_EVENT);            // Convert button events into esp event system      
@@ -35,15 +40,32 @@ ESP_EVENT_DEFINE_BASE(HOMEKIT_EVENT);           // Convert esp-homekit events in
 #ifdef CONFIG_IDF_TARGET_ESP8266
 #include "mdns.h"                               // ESP8266 RTOS SDK mDNS needs legacy STATUS_EVENT to be sent to it
 #endif
+#include "mdns_cache.h"                         // resolve remote hosts without a blocking query per press
+#include "http_pool.h"                          // kept-alive connections to remote hosts
+#include "remote_shadow.h"                      // remote characteristic values kept current by EVENTs
+#include "remote_udp.h"                         // fast path between our own switches
+#include "socket_budget.h"                      // lwip sockets for remote light connections
+#include "latency_trace.h"                      // press-to-light latency per stage
+#include "scenes.h"                             // several lights set at once
+#include "notify.h"                             // characteristic events coalesced and rate limited
 
 #include "lights.h"                             // common struct used for NVS read/write of lights config
 
 #include "esp_log.h"
 static const char *TAG = "main";
 
+_Static_assert(sizeof(((remote_plan_t *) 0)->get_path) <= HTTP_POOL_PATH_SIZE, "remote GET path does not fit an http_pool request");
+
 // Have set lwip sockets from 10 to 16 (maximum allowed)
-//   5 for httpd (down from default of 7)
-//   12 for HomeKit (up from 8)
+//   13 for HomeKit: listener + 12 clients (up from 8), only if we have lights of our own
+//   8 for httpd: listener, 2 control + 5 open (down from default of 7)
+//   1 for remote_udp, once a udp_key is set
+// That is more than 16 only while every HomeKit client and browser is connected.
+// Remote lights take from a runtime budget instead, shared by http_pool and
+//   remote_shadow: a socket is counted when a connection opens and given back
+//   when it closes, so a switch without remote lights sets none aside
+#define REMOTE_SOCKETS              4           // http_pool wake + connections, event connections
+#define REMOTE_SOCKETS_NO_HOMEKIT   8           // all lights remote: the HomeKit server does not start
 
 static led_status_t led_status;
 static bool paired = false;
@@ -61,16 +83,28 @@ typedef struct _light {
     bool is_remote;
 
     uint8_t hk_service_idx;
+    uint8_t index;                  // in the NVS "config" blob, scenes refer to lights by it
 
-    TimerHandle_t dim_timer;
+    // remote lights: dim_direction, dimming and the dim_, update_, remote_ and
+    //   udp_ fields are shared by the remote_hk, http_pool, remote_udp and
+    //   timer tasks, take remote_mutex
     int8_t dim_direction;
+    volatile bool dimming;          // remote light: button held, remote_dim_frame sends updates
+    int fade_ms;                    // fade for the next change, -1 for the configured HomeKit fade
     uint8_t pwm_channel;            // only used with hardware PWM
-
-    int remote_brightness;          // save during BRIGHTNESS_START
-    cJSON *remote_resp;
-    cJSON *nvs_command;
+    dimming_curve_t curve;          // brightness to PWM duty
+
+    int remote_brightness;          // save during BRIGHTNESS_START, newest dim target after that
+    volatile bool update_pending;   // a BRIGHTNESS_UPDATE is queued, it will send remote_brightness
+    TickType_t update_requested;    // when the pending BRIGHTNESS_UPDATE was queued
+    uint32_t remote_rtt_ms;         // smoothed request round trip to the remote host, 0 if unknown
+    TickType_t dim_last_tick;
+    uint32_t dim_acc;               // brightness % * ms not yet applied (less than one step)
+    remote_plan_t *remote_plan;
     char host_ip[20];               
-    esp_http_client_handle_t client;
+    uint16_t udp_port;              // the host's remote_udp port, 0 if it has none
+    TickType_t udp_retry_after;     // after a UDP timeout, HAP only until then
+    latency_trace_t trace;          // the latest press, from its button edge
 
     struct _light *next;            // linked list
 } light_service_t;
@@ -82,6 +116,9 @@ static light_service_t *lights = NULL;
 bool light_gpio_inverted;
 bool led_gpio_inverted;
 
+// fade times, from the NVS "fade" blob
+static fade_config_t fade_config = FADE_CONFIG_DEFAULT;
+
 static homekit_accessory_t *accessories[2];
 
 
@@ -89,52 +126,24 @@ void status_led_identify(homekit_value_t _value) {
     led_status_signal(led_status, &identify);
 }
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt)
-{
-    static int output_len;       // Stores number of bytes read
-    switch(evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (esp_http_client_is_chunked_response(evt->client)) {
-                if (output_len + evt->data_len > MAX_HTTP_OUTPUT_BUFFER) {
-                    ESP_LOGE(TAG, "cannot store more data - buffer full");
-                }
-                else if (evt->user_data) {
-                    memcpy(evt->user_data + output_len, evt->data, evt->data_len);
-                }
-                output_len += evt->data_len;
-            }
+static QueueHandle_t q_remotehk_message_queue;
 
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
-            // null terminate string
-            char *user_data = evt->user_data;
-            user_data[output_len] = '\0';
-            // reset length counter
-            output_len = 0;
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
-    }
-    return ESP_OK;
-}
+// the remote fields of light_service_t and the remote stats below
+static SemaphoreHandle_t remote_mutex = NULL;
 
+// BRIGHTNESS_UPDATE mailbox stats
+static uint32_t remote_updates_sent;
+static uint32_t remote_updates_dropped;     // superseded by a newer target before being sent
+static uint32_t remote_update_latency_ms;   // total, queued until the PUT completed
+static uint32_t remote_update_latency_max_ms;
 
-static QueueHandle_t q_remotehk_message_queue;
+// per-press cost when the shadow had the values (no GET)
+static uint32_t remote_press_count;
+static uint64_t remote_press_us;
+static uint32_t remote_press_max_us;
+static int remote_press_heap_max;           // bytes still allocated when the PUT is queued
+
+static uint32_t remote_udp_fallbacks;       // UDP commands that went unanswered and were sent over HAP
 
 typedef enum {
     TOGGLE,
@@ -142,284 +151,518 @@ typedef enum {
     BRIGHTNESS_START,
     BRIGHTNESS_UPDATE,
     BRIGHTNESS_FINISHED,
+    SCENE,                      // on at brightness, or off
 } remote_hk_cmd_t;
 
 typedef struct {
     light_service_t *light;
     remote_hk_cmd_t command;
+    int brightness;                         // SCENE only, 0 for off
+    latency_trace_t trace;                  // TOGGLE and FULL_ON only
 } remote_hk_t;
 
+// A command handed to http_pool. Requests to different hosts are in flight
+//   at once, so a press on several remote lights takes about one round trip
+#define REMOTE_OPS  HTTP_POOL_SIZE
+
+typedef struct {
+    http_pool_req_t req;                    // first, the pool callbacks get &req
+    light_service_t *light;
+    char host_ip[16];
+    remote_hk_cmd_t command;
+    remote_plan_action_t action;
+    int values[REMOTE_PLAN_MAX_IDS];
+    bool values_known;                      // values were current before anything was sent
+    int brightness;                         // for REMOTE_PLAN_SET_BRIGHTNESS
+    TickType_t update_requested;
+    hap_response_t response;                // GET responses are tokenized as they arrive
+    remote_udp_req_t udp;                   // when the host is one of our switches
+    latency_trace_t trace;
+} remote_op_t;
+
+static remote_op_t remote_ops[REMOTE_OPS];
+static QueueHandle_t q_remote_ops;          // free remote_op_t pointers
+
+static bool remote_op_free(remote_op_t *op) {
+    xQueueSendToBack(q_remote_ops, &op, 0);
+    return false;
+}
+
+// take remote_mutex before calling
+static void remote_update_sent(const remote_op_t *op) {
+    uint32_t latency_ms = (xTaskGetTickCount() - op->update_requested) * portTICK_PERIOD_MS;
+    remote_updates_sent++;
+    remote_update_latency_ms += latency_ms;
+    remote_update_latency_max_ms = MAX(remote_update_latency_max_ms, latency_ms);
+}
+
+// Build the PUT for op->action into op->req. The values it sets are dropped
+//   from the shadow until it is answered, so a press queued right behind it
+//   reads them back rather than starting from the old ones
+static esp_err_t remote_op_set_put(remote_op_t *op) {
+    light_service_t *light = op->light;
+    remote_plan_t *plan = light->remote_plan;
+
+    if (remote_plan_build(plan, op->action, op->values, op->brightness, op->req.body, sizeof(op->req.body)) < 0) {
+        ESP_LOGE(TAG, "command too long for %s", plan->host);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_LOGW("COMMAND", "key: \"characteristics\" value: %s", op->req.body);
+
+    op->req.method = HTTP_METHOD_PUT;
+    strlcpy(op->req.path, "/characteristics", sizeof(op->req.path));
+    // the 204/207 body is not needed
+    op->req.on_data = NULL;
+
+    for (int i = 0; i < plan->num_items; i++) {
+        int value;
+        if (remote_plan_item_value(plan, i, op->action, op->values, op->brightness, &value)) {
+            remote_shadow_invalidate(op->host_ip, &plan->ids[i]);
+        }
+    }
+    return ESP_OK;
+}
+
+// The PUT built by remote_op_set_put() was answered with a 204: the
+//   accessory took every value. After a 207 (some were refused) or an error
+//   the shadow stays without them until an EVENT or GET brings them back
+static void remote_op_put_done(remote_op_t *op) {
+    remote_plan_t *plan = op->light->remote_plan;
+
+    for (int i = 0; i < plan->num_items; i++) {
+        int value;
+        if (remote_plan_item_value(plan, i, op->action, op->values, op->brightness, &value)) {
+            remote_shadow_set(op->host_ip, &plan->ids[i], value);
+        }
+    }
+}
+
+// http_pool_done_cb, runs in the http_pool task
+static bool remote_op_done(http_pool_req_t *req, esp_err_t err) {
+    remote_op_t *op = (remote_op_t *) req;
+    light_service_t *light = op->light;
+    remote_plan_t *plan = light->remote_plan;
+
+    xSemaphoreTake(remote_mutex, portMAX_DELAY);
+    light->remote_rtt_ms = req->rtt_ms;
+    xSemaphoreGive(remote_mutex);
+
+    if (req->method == HTTP_METHOD_GET) {
+        if (err == ESP_OK) {
+            err = hap_response_finish(&op->response);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "GET request failed: %s", esp_err_to_name(err));
+            // the host may have a new address, resolve again next time
+            mdns_cache_invalidate(plan->host);
+            remote_shadow_forget(op->host_ip);
+            led_status_signal(led_status, &remote_error);
+            return remote_op_free(op);
+        }
+
+        // **** read the response returned from the hk client device ****//
+        //   (only on a shadow miss; this also learns the characteristic kinds)
+        bool complete = remote_plan_read_response(plan, &op->response, op->values);
+        remote_shadow_update(op->host_ip, &op->response);
+        if (!complete) {
+            ESP_LOGE(TAG, "response is missing characteristics from %s", plan->get_path);
+            led_status_signal(led_status, &remote_error);
+            return remote_op_free(op);
+        }
+
+        if (op->command == BRIGHTNESS_START) {
+            // save the current brightness to be used in BRIGHTNESS_UPDATE commands
+            xSemaphoreTake(remote_mutex, portMAX_DELAY);
+            for (int i = 0; i < plan->num_items; i++) {
+                if (plan->items[i].kind == REMOTE_KIND_BRIGHTNESS) {
+                    light->remote_brightness = op->values[i];
+                }
+            }
+            int brightness = light->remote_brightness;
+            int direction = light->dim_direction;
+            xSemaphoreGive(remote_mutex);
+            ESP_LOGI(TAG, "BRIGHTNESS_START brightness %d direction %d", brightness, direction);
+            return remote_op_free(op);
+        }
+
+        // the PUT goes next on this connection, ahead of anything queued behind the GET
+        if (remote_op_set_put(op) != ESP_OK) {
+            led_status_signal(led_status, &remote_error);
+            return remote_op_free(op);
+        }
+        return true;
+    }
+
+    if (err == ESP_OK && req->status_code == 204) {
+        remote_op_put_done(op);
+    }
+
+    if (err == ESP_OK) {
+        LATENCY_MARK(&op->trace, LATENCY_DONE);
+        LATENCY_COMMIT(&op->trace);
+        ESP_LOGI(TAG, "HTTP POST Status = %d", req->status_code);
+
+        if (op->command == BRIGHTNESS_UPDATE) {
+            xSemaphoreTake(remote_mutex, portMAX_DELAY);
+            remote_update_sent(op);
+            xSemaphoreGive(remote_mutex);
+        }
+    } else {
+        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+        led_status_signal(led_status, &remote_error);
+    }
+    return remote_op_free(op);
+}
+
+// Send op over HAP: with fetch a GET first, and remote_op_done() queues the
+//   PUT once the values are in; otherwise the PUT built from op->values
+static esp_err_t remote_op_http(remote_op_t *op, bool fetch) {
+    remote_plan_t *plan = op->light->remote_plan;
+
+    memset(&op->req, 0, sizeof(op->req));
+    op->req.on_done = remote_op_done;
+    // a paired accessory: the pool verifies once and reuses the session
+    op->req.pairing = plan->paired ? &plan->pairing : NULL;
+
+    if (fetch) {
+        // HTTP GET request to retrieve charactereistics of remote HK client
+        op->req.method = HTTP_METHOD_GET;
+        strlcpy(op->req.path, plan->get_path, sizeof(op->req.path));
+        op->req.on_data = hap_response_on_data;
+        op->req.ctx = &op->response;
+    }
+    else {
+        esp_err_t err = remote_op_set_put(op);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // over the pooled connection (reconnects if the remote device restarted)
+    return http_pool_submit(op->host_ip, plan->port, &op->req);
+}
+
+// Whether light's host can take the command over remote_udp. Not for commands
+//   writing configured values (e.g. a switch identifier): our switches have none
+static bool remote_use_udp(light_service_t *light) {
+    remote_plan_t *plan = light->remote_plan;
+
+    xSemaphoreTake(remote_mutex, portMAX_DELAY);
+    bool backing_off = (int32_t)(xTaskGetTickCount() - light->udp_retry_after) < 0;
+    xSemaphoreGive(remote_mutex);
+
+    if (!remote_udp_enabled() || !light->udp_port || backing_off) {
+        return false;
+    }
+    for (int i = 0; i < plan->num_items; i++) {
+        if (plan->items[i].has_value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// remote_udp_done_cb, runs in the remote_udp task
+static void remote_op_udp_done(remote_udp_req_t *req, esp_err_t err) {
+    remote_op_t *op = (remote_op_t *) req->ctx;
+    light_service_t *light = op->light;
+    remote_plan_t *plan = light->remote_plan;
+
+    if (err == ESP_ERR_TIMEOUT) {
+        // the host may have stopped answering UDP: send this over HAP, and
+        //   keep doing so for a while
+        ESP_LOGW(TAG, "no UDP ack from %s, using HAP", plan->host);
+        xSemaphoreTake(remote_mutex, portMAX_DELAY);
+        light->udp_retry_after = xTaskGetTickCount() + pdMS_TO_TICKS(REMOTE_UDP_BACKOFF_MS);
+        remote_udp_fallbacks++;
+        xSemaphoreGive(remote_mutex);
+
+        // the command may have been applied and only the acks lost: a
+        //   TOGGLE goes over HAP only as the values it computed from the
+        //   state before it, never from a state read now, which could
+        //   already be toggled. Every other action writes absolute values
+        if (op->command != BRIGHTNESS_START && op->action == REMOTE_PLAN_TOGGLE &&
+            (!op->values_known || !plan->kinds_known)) {
+            ESP_LOGE(TAG, "TOGGLE of %s may not have been applied", plan->host);
+            led_status_signal(led_status, &remote_error);
+            remote_op_free(op);
+            return;
+        }
+        bool fetch = op->command == BRIGHTNESS_START || !plan->kinds_known;
+        err = remote_op_http(op, fetch);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "request to %s not queued: %s", op->host_ip, esp_err_to_name(err));
+            led_status_signal(led_status, &remote_error);
+            remote_op_free(op);
+        }
+        return;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s rejected the UDP command", plan->host);
+        led_status_signal(led_status, &remote_error);
+        remote_op_free(op);
+        return;
+    }
+
+    // the ack carries the values the host now has
+    remote_plan_set_kinds(plan, req->kinds);
+    for (int i = 0; i < plan->num_items; i++) {
+        remote_shadow_set(op->host_ip, &plan->ids[i], req->values[i]);
+    }
+
+    LATENCY_MARK(&op->trace, LATENCY_DONE);
+    LATENCY_COMMIT(&op->trace);
+
+    xSemaphoreTake(remote_mutex, portMAX_DELAY);
+    light->remote_rtt_ms = req->rtt_ms;
+    if (op->command == BRIGHTNESS_START) {
+        // save the current brightness to be used in BRIGHTNESS_UPDATE commands
+        for (int i = 0; i < plan->num_items; i++) {
+            if (req->kinds[i] == REMOTE_KIND_BRIGHTNESS) {
+                light->remote_brightness = req->values[i];
+            }
+        }
+    }
+    else if (op->command == BRIGHTNESS_UPDATE) {
+        remote_update_sent(op);
+    }
+    int brightness = light->remote_brightness;
+    int direction = light->dim_direction;
+    xSemaphoreGive(remote_mutex);
+
+    if (op->command == BRIGHTNESS_START) {
+        ESP_LOGI(TAG, "BRIGHTNESS_START brightness %d direction %d", brightness, direction);
+    }
+    remote_op_free(op);
+}
+
+// Send op to one of our own switches: the host applies the action to its
+//   current values itself, so no GET is ever needed
+static esp_err_t remote_op_udp(remote_op_t *op) {
+    remote_plan_t *plan = op->light->remote_plan;
+    remote_udp_req_t *udp = &op->udp;
+
+    memset(udp, 0, sizeof(*udp));
+    if (op->command == BRIGHTNESS_START) {
+        udp->action = REMOTE_UDP_READ;
+    }
+    else if (op->action == REMOTE_PLAN_SET_BRIGHTNESS) {
+        udp->action = REMOTE_UDP_SET_BRIGHTNESS;
+    }
+    else if (op->action == REMOTE_PLAN_OFF) {
+        udp->action = REMOTE_UDP_OFF;
+    }
+    else {
+        udp->action = op->action == REMOTE_PLAN_FULL_ON ? REMOTE_UDP_FULL_ON : REMOTE_UDP_TOGGLE;
+    }
+    udp->brightness = op->brightness;
+    memcpy(udp->ids, plan->ids, plan->num_items * sizeof(plan->ids[0]));
+    udp->num_ids = plan->num_items;
+    udp->on_done = remote_op_udp_done;
+    udp->ctx = op;
+
+    return remote_udp_submit(op->host_ip, op->light->udp_port, udp);
+}
+
+// remote_udp_apply_cb: another switch controls our lights. Runs in the remote_udp task
+static int remote_udp_apply(remote_udp_action_t action, int brightness,
+                            const struct http_hap_id *ids, int num_ids, uint8_t *kinds, int *values) {
+    homekit_characteristic_t *chs[REMOTE_UDP_MAX_IDS];
+
+    // check every id first, so a command with a bad one changes nothing
+    for (int i = 0; i < num_ids; i++) {
+        chs[i] = homekit_characteristic_by_aid_and_iid(accessories, ids[i].aid, ids[i].iid);
+        if (chs[i] && strcmp(chs[i]->type, HOMEKIT_CHARACTERISTIC_ON) == 0) {
+            kinds[i] = REMOTE_KIND_ON;
+        }
+        else if (chs[i] && strcmp(chs[i]->type, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
+            kinds[i] = REMOTE_KIND_BRIGHTNESS;
+        }
+        else {
+            ESP_LOGE(TAG, "UDP command for unknown %d.%d", ids[i].aid, ids[i].iid);
+            return -1;
+        }
+    }
+
+    // every light this command changes, in one PWM commit
+    fade_begin();
+    for (int i = 0; i < num_ids; i++) {
+        homekit_characteristic_t *ch = chs[i];
+
+        if (kinds[i] == REMOTE_KIND_ON) {
+            bool on = ch->value.bool_value;
+            if (action == REMOTE_UDP_TOGGLE) {
+                on = !on;
+            }
+            else if (action == REMOTE_UDP_OFF) {
+                on = false;
+            }
+            else if (action != REMOTE_UDP_READ) {
+                on = action == REMOTE_UDP_FULL_ON || brightness > 0;
+            }
+            if (action != REMOTE_UDP_READ) {
+                notify_value(ch, HOMEKIT_BOOL(on));
+            }
+            values[i] = on;
+        }
+        else {
+            int level = ch->value.int_value;
+            if (action == REMOTE_UDP_FULL_ON || action == REMOTE_UDP_SET_BRIGHTNESS) {
+                level = action == REMOTE_UDP_FULL_ON ? 100 : brightness;
+                notify_value(ch, HOMEKIT_INT(level));
+            }
+            values[i] = level;
+        }
+    }
+    fade_end();
+    return 0;
+}
+
+// Resolves the host and decides what to send, then hands the request to
+//   http_pool and goes on with the next command without waiting for it
 static void remote_hk_task(void * arg)
 {
     remote_hk_t hk_command;
 
-    // address saved in esp_http_client_handle_t client handle
-    char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
-
     while(1) {
         // receive a message from the queue to hold complete struct remote_hk_t structure.
         if (xQueueReceive(q_remotehk_message_queue, &(hk_command), portMAX_DELAY) == pdTRUE) {
+            LATENCY_MARK(&hk_command.trace, LATENCY_DEQUEUED);
 
-            cJSON *root_cmd = NULL;
+            light_service_t *light = hk_command.light;
+            remote_plan_t *plan = light->remote_plan;
+            int values[REMOTE_PLAN_MAX_IDS] = {0};
+            remote_plan_action_t action = REMOTE_PLAN_TOGGLE;
+            TickType_t update_requested = 0;
+            bool fetch = false;
 
-            char host_ip[20] = {0};
-            char url_string[100] = {0};           
+            // CPU time and heap use of the press itself, network waits excluded
+            int64_t press_start = esp_timer_get_time();
+            size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
 
             if (hk_command.command == BRIGHTNESS_FINISHED) {
-                ESP_LOGI(TAG, "BRIGHTNESS_FINISHED brightness %d direction %d", hk_command.light->remote_brightness, hk_command.light->dim_direction );
-                hk_command.light->dim_direction *= -1;
-                cJSON_Delete(hk_command.light->remote_resp);
+                xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                int brightness = light->remote_brightness;
+                int direction = light->dim_direction;
+                light->dim_direction *= -1;
+                xSemaphoreGive(remote_mutex);
+                ESP_LOGI(TAG, "BRIGHTNESS_FINISHED brightness %d direction %d", brightness, direction);
                 continue;
             }
 
             else if (hk_command.command == BRIGHTNESS_UPDATE) {
-                ESP_LOGI(TAG, "BRIGHTNESS_UPDATE brightness %d direction %d", hk_command.light->remote_brightness, hk_command.light->dim_direction );
-                // we saved the host and retrieved characteristics during BRIGHTNESS_START below
-                strcpy(host_ip, hk_command.light->host_ip);
-                cJSON *characteristics_json = cJSON_GetObjectItem(hk_command.light->remote_resp, "characteristics");
-
-                // construct the command to send to the hk client as we go
-                root_cmd = cJSON_CreateObject();
-                cJSON *characteristics_cmd_json = cJSON_CreateArray();
-                cJSON_AddItemToObject(root_cmd, "characteristics", characteristics_cmd_json);
-    
-                cJSON *characteristics_item;
-                cJSON_ArrayForEach(characteristics_item, characteristics_json) {
-                    cJSON *aid_key = cJSON_GetObjectItem(characteristics_item, "aid");
-                    cJSON *iid_key  = cJSON_GetObjectItem(characteristics_item, "iid");
-                    cJSON *type_key = cJSON_GetObjectItem(characteristics_item, "type");
-                    cJSON *fld;
-
-                    if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
-                        cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
-                        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
-                        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
-                        cJSON_AddItemToObject(fld, "value", cJSON_CreateNumber(hk_command.light->remote_brightness));
-                    }
-                    else if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_ON) == 0) {
-                        cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
-                        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
-                        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
-                        cJSON_AddItemToObject(fld, "value", cJSON_CreateBool(hk_command.light->remote_brightness > 0 ? true : false));
-                    }
+                // free the mailbox first: a target set from now on needs another update
+                xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                update_requested = light->update_requested;
+                light->update_pending = false;
+                int brightness = light->remote_brightness;
+                int direction = light->dim_direction;
+                xSemaphoreGive(remote_mutex);
+
+                ESP_LOGI(TAG, "BRIGHTNESS_UPDATE brightness %d direction %d", brightness, direction);
+                // we resolved the host and learned the characteristics during BRIGHTNESS_START below
+                if (!plan->kinds_known || !light->host_ip[0]) {
+                    continue;
                 }
+                action = REMOTE_PLAN_SET_BRIGHTNESS;
             }
 
-            // ******** TOGGLE, BRIGHTNESS_START, FULL_ON ********* //
+            // ******** TOGGLE, BRIGHTNESS_START, FULL_ON, SCENE ********* //
             else {
-                cJSON *host_json = cJSON_GetObjectItem(hk_command.light->nvs_command, "host");
-                cJSON *payload_json = cJSON_GetObjectItem(hk_command.light->nvs_command, "payload");
-
-    char *out = cJSON_PrintUnformatted(hk_command.light->nvs_command);
-    ESP_LOGW("NVS PAYLOAD", "key: \"payload\" value: %s", out);
-    free(out);
-
                 // use 'host' and resolve IP address
                 //    (bug esp-idf #5521) workaround: use mdns library to resolve hostname
+                //    cached, only a miss does the blocking mdns_query_a
                 struct ip4_addr mdns_addr;
                 mdns_addr.addr = 0;
-                esp_err_t err = mdns_query_a(host_json->valuestring, 2000,  &mdns_addr);
+                esp_err_t err = mdns_cache_resolve(plan->host, 2000,  &mdns_addr);
                 if(err) {
                     if(err == ESP_ERR_NOT_FOUND){
-                        ESP_LOGE(TAG, "mdns_query_a error: %s was not found!", host_json->valuestring);
+                        ESP_LOGE(TAG, "mdns_query_a error: %s was not found!", plan->host);
                     }
                     ESP_LOGE(TAG, "mdns_query_a error: query failed");
                     led_status_signal(led_status, &remote_error);
                     continue;
                 }
-                sprintf(host_ip, IPSTR, IP2STR(&mdns_addr));
+                sprintf(light->host_ip, IPSTR, IP2STR(&mdns_addr));
                 // end workaround **************************** //
+                LATENCY_MARK(&hk_command.trace, LATENCY_RESOLVED);
 
-    ESP_LOGW(TAG, "mdns address resolve %s", host_ip);
-
-                // create aid.iid csv to send to remote hk device
-                char aid_iid[20] = {0};
-                cJSON *payload_item;
-                cJSON_ArrayForEach(payload_item, payload_json) {
-                    cJSON *key = cJSON_GetObjectItem(payload_item, "aid");
-                    if (!cJSON_IsNumber(key)) { 
-                        ESP_LOGE(TAG, "error parsing \"key\" : \"aid\"");
-                        led_status_signal(led_status, &remote_error);
-                        continue;
-                    }
-                    sprintf(aid_iid + strlen(aid_iid), "%d.", key->valueint);
+                // one of our own switches if it advertises the UDP fast path
+                light->udp_port = mdns_cache_udp_port(plan->host);
 
-                    key = cJSON_GetObjectItem(payload_item, "iid");
-                    if (!cJSON_IsNumber(key)) { 
-                        ESP_LOGE(TAG, "error parsing \"key\" : \"iid\"");
-                        led_status_signal(led_status, &remote_error);
-                        continue;
-                    }
-                    sprintf(aid_iid + strlen(aid_iid), "%d,", key->valueint);
+                // current values come from the shadow while the event subscription
+                //   is up, so the press only needs the PUT
+                //   (the event connections are plain HTTP, so not for paired accessories)
+                if (!plan->paired) {
+                    remote_shadow_subscribe(plan->host, light->host_ip, plan->ids, plan->num_items);
                 }
-                // remove last ','
-                aid_iid[strlen(aid_iid)-1] = '\0';
-
-    ESP_LOGW(TAG, "aid_iid: %s", aid_iid);
-
-                strcpy(url_string, "http://");
-                strcat(url_string, host_ip);
-                strcat(url_string, ":5556/characteristics?id=");
-                strcat(url_string, aid_iid);
-                strcat(url_string, "&type=1");
-
-                if (!hk_command.light->client) {
-                    //ESP8266 RTOS does not support .host and .port, only .url
-                    esp_http_client_config_t config = {
-                        .url = url_string,
-                        .event_handler = _http_event_handler,
-                        .user_data = local_response_buffer,
-                    };
-                    hk_command.light->client = esp_http_client_init(&config);
-                    if (!hk_command.light->client) {
-                        ESP_LOGE(TAG, "error esp_http_client_init");
-                        led_status_signal(led_status, &remote_error);
-                        continue;
-                    }
-                }
-
-                esp_http_client_set_url(hk_command.light->client, url_string);
-                esp_http_client_set_post_field(hk_command.light->client, NULL, 0);
-                esp_http_client_set_method(hk_command.light->client, HTTP_METHOD_GET);
-    
-                // HTTP GET request to retrieve charactereistics of remote HK client
-                // if the remote device has since restarted, the first try will fail
-                err = esp_http_client_perform(hk_command.light->client);
-                if (err != ESP_OK) {
-                    esp_http_client_close(hk_command.light->client);
-
-                    // retry
-                    err = esp_http_client_perform(hk_command.light->client);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "GET request failed: 0x%x", err);
-                        led_status_signal(led_status, &remote_error);
-                        continue;
-                    }
-                }
-
-    ESP_LOGW("RESPONSE", "%s", local_response_buffer);
-
-                // **** parse the response returned from the hk client device ****//
-                cJSON *root_resp = cJSON_Parse(local_response_buffer);
-                cJSON *characteristics_json = cJSON_GetObjectItem(root_resp, "characteristics");
-                if (!characteristics_json || !cJSON_IsArray(characteristics_json)) {
-                    ESP_LOGE(TAG, "key: \"characteristics\" not found or is not a json array");
-                    cJSON_Delete(root_resp);
-                    led_status_signal(led_status, &remote_error);
-                    continue;
-                }
-
-                if (hk_command.command == BRIGHTNESS_START) {
-                    ESP_LOGI(TAG, "BRIGHTNESS_START brightness %d direction %d", hk_command.light->remote_brightness, hk_command.light->dim_direction );
-                    // save all the information to be used in BRIGHTNESS_UPDATE commands
-                    strcpy(hk_command.light->host_ip, host_ip);
-                    // free cJSON when finished in BRIGHTNESS_FINISHED
-                    hk_command.light->remote_resp = root_resp;
-                    
-                    cJSON *characteristics_item;
-                    cJSON_ArrayForEach(characteristics_item, characteristics_json) {
-                        cJSON *type_key = cJSON_GetObjectItem(characteristics_item, "type");
-                        cJSON *value_key = cJSON_GetObjectItem(characteristics_item, "value");
-
-                        if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
-                            hk_command.light->remote_brightness = value_key->valueint;
+                fetch = !plan->kinds_known || !remote_shadow_get_values(light->host_ip, plan->ids, plan->num_items, values);
+
+                if (hk_command.command == BRIGHTNESS_START && !fetch) {
+                    // save the current brightness to be used in BRIGHTNESS_UPDATE commands
+                    xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                    for (int i = 0; i < plan->num_items; i++) {
+                        if (plan->items[i].kind == REMOTE_KIND_BRIGHTNESS) {
+                            light->remote_brightness = values[i];
                         }
                     }
-                    // do not cJSON_Delete(root_resp) - will be cleaned up BRIGHTNESS_FINISHED
+                    int brightness = light->remote_brightness;
+                    int direction = light->dim_direction;
+                    xSemaphoreGive(remote_mutex);
+                    ESP_LOGI(TAG, "BRIGHTNESS_START brightness %d direction %d", brightness, direction);
                     continue;
                 }
-
-                // construct the command to send to the hk client as we go
-                root_cmd = cJSON_CreateObject();
-                cJSON *characteristics_cmd_json = cJSON_CreateArray();
-                cJSON_AddItemToObject(root_cmd, "characteristics", characteristics_cmd_json);
-
-                cJSON *characteristics_item;
-                cJSON_ArrayForEach(characteristics_item, characteristics_json) {
-                    cJSON *aid_key = cJSON_GetObjectItem(characteristics_item, "aid");
-                    cJSON *iid_key  = cJSON_GetObjectItem(characteristics_item, "iid");
-                    cJSON *type_key = cJSON_GetObjectItem(characteristics_item, "type");
-                    cJSON *value_key = cJSON_GetObjectItem(characteristics_item, "value");
-                    cJSON *fld;
-
-                    // OPTIONAL CHARACTERISTIC for remote switch identifier
-                    if (strcmp(type_key->valuestring, "02B77067-DA5D-493C-829D-F6C5DCFE5C28") == 0){
-                        // Go through the NVS payload and find what value to send to remote device;
-                        cJSON_ArrayForEach(payload_item, payload_json) {
-                            cJSON *nvs_aid = cJSON_GetObjectItem(payload_item, "aid");
-                            cJSON *nvs_iid = cJSON_GetObjectItem(payload_item, "iid");
-                            if (nvs_aid->valueint == aid_key->valueint &&
-                                  nvs_iid->valueint == iid_key->valueint) {
-                                cJSON *nvs_value = cJSON_GetObjectItem(payload_item, "value");
-                                if (!cJSON_IsNumber(nvs_value)) { 
-                                    ESP_LOGE(TAG, "error parsing \"key\" : \"nvs_value\"");
-                                } else {
-                                    cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
-                                    cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
-                                    cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
-                                    cJSON_AddItemToObject(fld, "value", cJSON_CreateNumber(nvs_value->valueint));
-                                }
-                            }
-                        }
-                    }
-
-                    else if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
-                        if (hk_command.command == FULL_ON) {
-                            cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
-                            cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
-                            cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
-                            cJSON_AddItemToObject(fld, "value", cJSON_CreateNumber(100));
-                        }
-                    }
-
-                    else if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_ON) == 0) {
-                        cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
-                        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
-                        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
-                        if (hk_command.command == FULL_ON) {
-                            cJSON_AddItemToObject(fld, "value", cJSON_CreateBool(true));
-                        } 
-                        else if (hk_command.command == TOGGLE) {
-                            cJSON_AddItemToObject(fld, "value", cJSON_CreateBool(!cJSON_IsTrue(value_key)));
-                        }
-                    }
+                if (hk_command.command == SCENE) {
+                    action = hk_command.brightness > 0 ? REMOTE_PLAN_SET_BRIGHTNESS : REMOTE_PLAN_OFF;
+                }
+                else {
+                    action = hk_command.command == FULL_ON ? REMOTE_PLAN_FULL_ON : REMOTE_PLAN_TOGGLE;
                 }
-                // finished with 'root_resp' | 'characteristic_json'
-                cJSON_Delete(root_resp);
             }
-                       
-            char *out = cJSON_PrintUnformatted(root_cmd);
-            cJSON_Delete(root_cmd);
-
-    ESP_LOGW("COMMAND", "key: \"characteristics\" value: %s", out);
-            
-            local_response_buffer[0] = '\0';
-
-            strcpy(url_string, "http://");
-            strcat(url_string, host_ip);
-            strcat(url_string, ":5556/characteristics");
-
-            esp_http_client_set_url(hk_command.light->client, url_string);
-            esp_http_client_set_method(hk_command.light->client, HTTP_METHOD_PUT);
-            esp_http_client_set_post_field(hk_command.light->client, out, strlen(out));
-            esp_err_t err = esp_http_client_perform(hk_command.light->client);
-
-            if (err == ESP_OK) {
-                ESP_LOGI(TAG, "HTTP POST Status = %d", esp_http_client_get_status_code(hk_command.light->client));
 
-    ESP_LOGW("HTTP POST FINISHED", "%s", local_response_buffer);
-
-            } else {
-                ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+            // all REMOTE_OPS in flight: wait, each ends within HTTP_POOL_TIMEOUT_MS per request
+            remote_op_t *op;
+            xQueueReceive(q_remote_ops, &op, portMAX_DELAY);
+
+            op->light = light;
+            strlcpy(op->host_ip, light->host_ip, sizeof(op->host_ip));
+            op->command = hk_command.command;
+            op->action = action;
+            // the dim target as it is now, a newer one gets its own BRIGHTNESS_UPDATE
+            xSemaphoreTake(remote_mutex, portMAX_DELAY);
+            op->brightness = hk_command.command == SCENE ? hk_command.brightness : light->remote_brightness;
+            xSemaphoreGive(remote_mutex);
+            op->update_requested = update_requested;
+            memcpy(op->values, values, sizeof(op->values));
+            op->values_known = hk_command.command != BRIGHTNESS_UPDATE && !fetch;
+            op->trace = hk_command.trace;
+
+            // our own switches apply the action themselves, a GET is never needed
+            bool udp = remote_use_udp(light);
+            // before submitting: the answer may be in before submit returns
+            LATENCY_MARK(&op->trace, LATENCY_SENT);
+            esp_err_t err = udp ? remote_op_udp(op) : remote_op_http(op, fetch);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "request to %s not queued: %s", op->host_ip, esp_err_to_name(err));
                 led_status_signal(led_status, &remote_error);
-            }    
-            free(out);
+                remote_op_free(op);
+                continue;
+            }
+
+            if (udp || !fetch) {
+                int64_t press_us = esp_timer_get_time() - press_start;
+                int heap_used = (int)heap_before - (int)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+                xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                remote_press_count++;
+                remote_press_us += press_us;
+                remote_press_max_us = MAX(remote_press_max_us, (uint32_t)press_us);
+                remote_press_heap_max = MAX(remote_press_heap_max, heap_used);
+                xSemaphoreGive(remote_mutex);
+            }
         }
     }
 }
 
-
-
 void lightbulb_on_callback(homekit_characteristic_t *_ch, homekit_value_t value, void *context) {
     if (value.format != homekit_format_bool) {
         ESP_LOGE(TAG, "Invalid value format: %d", value.format);
@@ -428,12 +671,18 @@ void lightbulb_on_callback(homekit_characteristic_t *_ch, homekit_value_t value,
 
     light_service_t *light = (light_service_t*) context;
 
+    // a held back value being sent: the light already has it
+    notify_written(_ch, value);
+    if (notify_is_echo()) {
+        return;
+    }
+
     if (light->is_dimmer) {
         homekit_characteristic_t *brightness_c = homekit_service_characteristic_by_type(
                     _ch->service, HOMEKIT_CHARACTERISTIC_BRIGHTNESS );
-        double gamma = pow(((brightness_c->value.int_value+25.0)/125.0),2.2)*100.0;
-        pwm_set_duty(light->pwm_channel, value.bool_value ? (uint32_t)(gamma * PWM_PERIOD_IN_US/100) : 0);
-        pwm_start();
+        fade_to(light->pwm_channel, value.bool_value, brightness_c->value.int_value,
+                light->fade_ms >= 0 ? light->fade_ms : fade_config.homekit_ms);
+        LATENCY_MARK(&light->trace, LATENCY_APPLIED);
 
         // if the light is turned off, set the direction up for the next time the light turns on
         //  it makes sense that, if it turns on greater than 50% brightness, that the next
@@ -444,6 +693,7 @@ void lightbulb_on_callback(homekit_characteristic_t *_ch, homekit_value_t value,
     }
     else {
         gpio_set_level(light->light_gpio, light_gpio_inverted ? !value.bool_value : value.bool_value); 
+        LATENCY_MARK(&light->trace, LATENCY_APPLIED);
     }
 }
 
@@ -454,54 +704,156 @@ void lightbulb_brightness_callback(homekit_characteristic_t *_ch, homekit_value_
     }
     light_service_t *light = (light_service_t*) context;
 
-    double gamma = pow(((value.int_value+25.0)/125.0),2.2)*100.0;
-    pwm_set_duty(light->pwm_channel, (uint32_t)(gamma * PWM_PERIOD_IN_US/100));
-    pwm_start();
+    notify_written(_ch, value);
+    if (notify_is_echo()) {
+        return;
+    }
 
+    homekit_characteristic_t *on_c = homekit_service_characteristic_by_type(
+                _ch->service, HOMEKIT_CHARACTERISTIC_ON );
+
+    // brightness can change while off, the light only follows it when on
+    fade_to(light->pwm_channel, on_c->value.bool_value, value.int_value,
+            light->fade_ms >= 0 ? light->fade_ms : fade_config.homekit_ms);
+    LATENCY_MARK(&light->trace, LATENCY_APPLIED);
 }
 
-static void light_dim_timer_callback(TimerHandle_t timer) {
-    light_service_t *light = (light_service_t*) pvTimerGetTimerID(timer);
+// notify_apply_cb: a value notify_value() holds back still changes the light now
+static void light_apply(homekit_characteristic_t *ch, homekit_value_t value) {
+    for (light_service_t *light = lights; light; light = light->next) {
+        if (light->is_remote || accessories[0]->services[light->hk_service_idx] != ch->service) {
+            continue;
+        }
+        if (strcmp(ch->type, HOMEKIT_CHARACTERISTIC_ON) == 0) {
+            lightbulb_on_callback(ch, value, light);
+        }
+        else if (strcmp(ch->type, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
+            lightbulb_brightness_callback(ch, value, light);
+        }
+        return;
+    }
+}
+
+// Runs every fade frame, in the timer task, while fade_wake() has been
+//   called and a remote light is dimming. Sends the newest target about once
+//   a round trip. Returns whether any remote light is still dimming
+static bool remote_dim_frame(TickType_t now) {
+    bool dimming = false;
+
+    // never block the timer task: a completion is recording its result, so
+    //   look again next frame
+    if (xSemaphoreTake(remote_mutex, 0) != pdTRUE) {
+        return true;
+    }
+
+    for (light_service_t *light = lights; light; light = light->next) {
+        if (!light->is_remote || !light->dimming) {
+            continue;
+        }
+        dimming = true;
 
-    int brightness = 0;
+        // send about once per round trip: faster only gets coalesced in the
+        //   mailbox below, slower makes the dimming visibly step
+        uint32_t period_ms = light->remote_rtt_ms ? light->remote_rtt_ms : 500;
+        period_ms = MIN(REMOTE_DIM_MAX_PERIOD_MS, MAX(REMOTE_DIM_MIN_PERIOD_MS, period_ms));
+        if (now - light->dim_last_tick < pdMS_TO_TICKS(period_ms)) {
+            continue;
+        }
+
+        // step by the time since the last send, so the sweep takes
+        //   dim_sweep_ms whatever the round trip is
+        light->dim_acc += (now - light->dim_last_tick) * portTICK_PERIOD_MS * (100 - 10);
+        light->dim_last_tick = now;
+        uint32_t sweep_ms = MAX(1, fade_config.dim_sweep_ms);
+        int step = light->dim_acc / sweep_ms;
+        light->dim_acc %= sweep_ms;
 
-    if (light->is_remote) {
         // remote_brightness is first updated/cached during BRIGHTNESS_START call
-        light->remote_brightness = MIN(100, light->remote_brightness + 5*light->dim_direction);
+        light->remote_brightness = MIN(100, light->remote_brightness + step*light->dim_direction);
         light->remote_brightness = MAX(10, light->remote_brightness);
-        brightness = light->remote_brightness;
 
+        // latest value wins: while an update is still queued it will pick up
+        //   the new target, so only queue one when the mailbox is empty
+        if (light->update_pending) {
+            remote_updates_dropped++;
+        }
+        else {
+            remote_hk_t remote_cmd = {
+                .light = light,
+                .command = BRIGHTNESS_UPDATE
+            };
+            light->update_requested = now;
+            light->update_pending = true;
+            // sizeof(struct remote_hk_t) bytes are copied from here into the queue
+            if (xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0) != pdTRUE) {
+                light->update_pending = false;
+                remote_updates_dropped++;
+            }
+        }
+
+        // don't continue if max/min has been reached
+        if (light->remote_brightness == 10 || light->remote_brightness == 100) {
+            light->dimming = false;
+        }
+    }
+    xSemaphoreGive(remote_mutex);
+    return dimming;
+}
+
+// scene_apply_cb: every light in one pass. The remote commands go out first,
+//   to run concurrently while the local lights change in one PWM commit and
+//   their notifications go out back to back
+static void scene_apply(const scene_t *scene) {
+    light_service_t *targets[SCENE_MAX_TARGETS] = {0};
+
+    for (int i = 0; i < scene->num_targets; i++) {
+        for (light_service_t *light = lights; light; light = light->next) {
+            if (light->index == scene->targets[i].light) {
+                targets[i] = light;
+            }
+        }
+        if (!targets[i]) {
+            ESP_LOGW(TAG, "scene %s: no light %d", scene->name, scene->targets[i].light);
+        }
+    }
+
+    for (int i = 0; i < scene->num_targets; i++) {
+        light_service_t *light = targets[i];
+        const scene_target_t *target = &scene->targets[i];
+        if (!light || !light->is_remote) {
+            continue;
+        }
         remote_hk_t remote_cmd = {
             .light = light,
-            .command = BRIGHTNESS_UPDATE
+            .command = SCENE,
+            .brightness = target->on ? (light->is_dimmer ? MAX(1, target->brightness) : 100) : 0
         };
         // sizeof(struct remote_hk_t) bytes are copied from here into the queue
-        xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0);
+        if (xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0) != pdTRUE) {
+            ESP_LOGE(TAG, "scene %s: remote queue full", scene->name);
+        }
     }
-    else {     
-        // Get the service and characteristics
+
+    fade_begin();
+    for (int i = 0; i < scene->num_targets; i++) {
+        light_service_t *light = targets[i];
+        const scene_target_t *target = &scene->targets[i];
+        if (!light || light->is_remote) {
+            continue;
+        }
+
         homekit_accessory_t *accessory = accessories[0];
         homekit_service_t *service = accessory->services[light->hk_service_idx];
         homekit_characteristic_t *on_c = service->characteristics[1];
-        homekit_characteristic_t *brightness_c = service->characteristics[2];
 
-        brightness = brightness_c->value.int_value;
-        brightness = MIN(100, brightness + 2*light->dim_direction);
-        brightness = MAX(10, brightness);
-
-        brightness_c->value = HOMEKIT_INT(brightness);
-        homekit_characteristic_notify(brightness_c, HOMEKIT_INT(brightness));
-
-        bool on = brightness > 0 ? true : false;
-        on_c->value = HOMEKIT_BOOL(on);
-        homekit_characteristic_notify(on_c, HOMEKIT_BOOL(on));
-    }
-
-    // don't continue if max/min has been reached
-    if ( brightness == 10 || brightness == 100) {
-        xTimerStop(light->dim_timer, 0);
+        // brightness first so the light comes on at it, notify_value skips what does not change
+        if (light->is_dimmer && target->on) {
+            homekit_characteristic_t *brightness_c = service->characteristics[2];
+            notify_value(brightness_c, HOMEKIT_INT(MIN(100, MAX(1, target->brightness))));
+        }
+        notify_value(on_c, HOMEKIT_BOOL(target->on));
     }
-
+    fade_end();
 }
 
 // Need to call this function from a task different to the button_callback (executing in Tmr Svc)
@@ -565,10 +917,15 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
 
         else if (event_id == BUTTON_EVENT_DOWN_HOLD) {
             if (light->is_dimmer) {
-                xTimerStart(light->dim_timer, 0);
-
                 // grab the current brightness from the remote device
                 if (light->is_remote) {
+                    xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                    light->dim_last_tick = xTaskGetTickCount();
+                    light->dim_acc = 0;
+                    light->dimming = true;
+                    xSemaphoreGive(remote_mutex);
+                    fade_wake();        // remote_dim_frame sends the updates
+
                     remote_hk_t remote_cmd = {
                         .light = light,
                         .command = BRIGHTNESS_START
@@ -576,11 +933,29 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
                     // sizeof(struct remote_hk_t) bytes are copied from here into the queue
                     xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0);
                 }
+                else {
+                    homekit_accessory_t *accessory = accessories[0];
+                    homekit_service_t *service = accessory->services[light->hk_service_idx];
+                    homekit_characteristic_t *on_c = service->characteristics[1];
+
+                    // on at its last brightness first, then dim from there
+                    if (!on_c->value.bool_value) {
+                        light->fade_ms = 0;
+                        notify_value(on_c, HOMEKIT_BOOL(true));
+                        light->fade_ms = -1;
+                    }
+
+                    // the whole hold is one fade, HomeKit hears the result on release
+                    fade_sweep(light->pwm_channel, light->dim_direction > 0 ? 100 : 10,
+                               fade_config.dim_sweep_ms * 100 / (100 - 10));
+                }
             }
         }
         else if (event_id == BUTTON_EVENT_UP_HOLD) {
             if (light->is_dimmer) {
-                xTimerStop(light->dim_timer, 0);
+                xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                light->dimming = false;
+                xSemaphoreGive(remote_mutex);
 
                 // clean up and set direction
                 if (light->is_remote) {
@@ -592,6 +967,16 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
                     xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0);
                 }
                 else {
+                    homekit_accessory_t *accessory = accessories[0];
+                    homekit_service_t *service = accessory->services[light->hk_service_idx];
+                    homekit_characteristic_t *brightness_c = service->characteristics[2];
+
+                    // already there, so no fade
+                    int brightness = MAX(10, fade_stop(light->pwm_channel));
+                    light->fade_ms = 0;
+                    notify_value(brightness_c, HOMEKIT_INT(brightness));
+                    light->fade_ms = -1;
+
                     light->dim_direction *= -1;
                 }
             }
@@ -605,10 +990,12 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
         else {
             // on/off
             if (event_id == 1) {
+                LATENCY_MARK(&light->trace, LATENCY_HANDLED);
                 if (light->is_remote) {
                     remote_hk_t remote_cmd = {
                         .light = light,
-                        .command = TOGGLE
+                        .command = TOGGLE,
+                        .trace = light->trace
                     };
                     // sizeof(struct remote_hk_t) bytes are copied from here into the queue
                     xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0);
@@ -622,16 +1009,21 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
                     
                     // Toggle ON
                     bool on = on_c->value.bool_value;
-                    on_c->value = HOMEKIT_BOOL(!on);
-                    homekit_characteristic_notify(on_c, HOMEKIT_BOOL(!on));
+                    light->fade_ms = fade_config.toggle_ms;
+                    notify_value(on_c, HOMEKIT_BOOL(!on));
+                    light->fade_ms = -1;
+                    // the light was set by lightbulb_on_callback, called from notify
+                    LATENCY_COMMIT(&light->trace);
                 }
             } 
             // turn on full brightness
             else if (event_id == 2 && light->is_dimmer) {
+                LATENCY_MARK(&light->trace, LATENCY_HANDLED);
                 if (light->is_remote) {
                     remote_hk_t remote_cmd = {
                         .light = light,
-                        .command = FULL_ON
+                        .command = FULL_ON,
+                        .trace = light->trace
                     };
                     // sizeof(struct remote_hk_t) bytes are copied from here into the queue
                     xQueueSendToBack(q_remotehk_message_queue, (void *) &remote_cmd, (TickType_t) 0);
@@ -643,15 +1035,24 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
                     homekit_characteristic_t *on_c = service->characteristics[1];
                     homekit_characteristic_t *brightness_c = service->characteristics[2];
                     
-                    // On and full brightness
-                    brightness_c->value = HOMEKIT_INT(100);
-                    homekit_characteristic_notify(brightness_c, HOMEKIT_INT(100));
-                    on_c->value = HOMEKIT_BOOL(true);
-                    homekit_characteristic_notify(on_c, HOMEKIT_BOOL(true));
+                    // On and full brightness, the two fades start together
+                    light->fade_ms = fade_config.toggle_ms;
+                    fade_begin();
+                    notify_value(brightness_c, HOMEKIT_INT(100));
+                    notify_value(on_c, HOMEKIT_BOOL(true));
+                    fade_end();
+                    light->fade_ms = -1;
+                    LATENCY_COMMIT(&light->trace);
 
                     light->dim_direction = -1;
                 }
             } 
+            // scene for this button
+            else if (event_id == 3) {
+                if (scenes_apply_button(light->index) != ESP_OK) {
+                    ESP_LOGI(TAG, "no scene for light %d", light->index);
+                }
+            }
             // restart 
             else if (event_id == 5) {
                 // use 'not_paired' flashing (fast flash) to indicate about to restart
@@ -666,6 +1067,68 @@ static void main_event_handler(void* arg, esp_event_base_t event_base,
                 char buffer[400];
                 vTaskList(buffer);
                 ESP_LOGI(TAG, "\n%s", buffer);
+
+                uint32_t hits, misses;
+                mdns_cache_get_stats(&hits, &misses);
+                ESP_LOGI(TAG, "mdns cache hits %u misses %u", (unsigned)hits, (unsigned)misses);
+
+                uint32_t events;
+                remote_shadow_get_stats(&hits, &misses, &events);
+                ESP_LOGI(TAG, "remote shadow hits %u misses %u events %u", (unsigned)hits, (unsigned)misses, (unsigned)events);
+
+                uint32_t pwm_commits, pwm_duties;
+                pwm_batch_get_stats(&pwm_commits, &pwm_duties);
+                ESP_LOGI(TAG, "pwm commits %u for %u duties", (unsigned)pwm_commits, (unsigned)pwm_duties);
+
+                uint32_t coalesced, unchanged;
+                notify_get_stats(&events, &coalesced, &unchanged);
+                ESP_LOGI(TAG, "homekit events sent %u coalesced %u unchanged %u",
+                        (unsigned)events, (unsigned)coalesced, (unsigned)unchanged);
+
+                xSemaphoreTake(remote_mutex, portMAX_DELAY);
+                uint32_t updates_sent = remote_updates_sent;
+                uint32_t updates_dropped = remote_updates_dropped;
+                uint32_t update_latency_ms = remote_update_latency_ms;
+                uint32_t update_latency_max_ms = remote_update_latency_max_ms;
+                uint32_t press_count = remote_press_count;
+                uint64_t press_us = remote_press_us;
+                uint32_t press_max_us = remote_press_max_us;
+                int press_heap_max = remote_press_heap_max;
+                uint32_t udp_fallbacks = remote_udp_fallbacks;
+                xSemaphoreGive(remote_mutex);
+
+                ESP_LOGI(TAG, "remote dim updates sent %u dropped %u latency avg %ums max %ums",
+                        (unsigned)updates_sent, (unsigned)updates_dropped,
+                        (unsigned)(updates_sent ? update_latency_ms / updates_sent : 0),
+                        (unsigned)update_latency_max_ms);
+
+                ESP_LOGI(TAG, "remote press cpu avg %uus max %uus heap max %d bytes (%u presses)",
+                        (unsigned)(press_count ? press_us / press_count : 0),
+                        (unsigned)press_max_us, press_heap_max, (unsigned)press_count);
+
+                http_pool_session_stats_t session;
+                http_pool_get_session_stats(&session);
+                ESP_LOGI(TAG, "hap sessions verified %u (avg %ums max %ums) failed %u, requests %u reused %u latency avg %ums max %ums",
+                        (unsigned)session.verifies,
+                        (unsigned)(session.verifies ? session.verify_ms_total / session.verifies : 0),
+                        (unsigned)session.verify_ms_max, (unsigned)session.verify_failures,
+                        (unsigned)session.requests, (unsigned)session.reused,
+                        (unsigned)(session.requests ? session.latency_ms_total / session.requests : 0),
+                        (unsigned)session.latency_ms_max);
+
+                latency_stage_stats_t stages[LATENCY_STAGES];
+                int num_stages = latency_trace_get_stats(stages, LATENCY_STAGES);
+                for (int i = 0; i < num_stages; i++) {
+                    ESP_LOGI(TAG, "latency %s p50 %uus p99 %uus max %uus (%u)", stages[i].name,
+                            (unsigned)stages[i].p50_us, (unsigned)stages[i].p99_us,
+                            (unsigned)stages[i].max_us, (unsigned)stages[i].count);
+                }
+
+                uint32_t sent, retransmits, received, rejected;
+                remote_udp_get_stats(&sent, &retransmits, &received, &rejected);
+                ESP_LOGI(TAG, "remote udp sent %u retransmits %u fallbacks %u received %u rejected %u",
+                        (unsigned)sent, (unsigned)retransmits, (unsigned)udp_fallbacks,
+                        (unsigned)received, (unsigned)rejected);
             } 
         }
     }
@@ -675,8 +1138,18 @@ void homekit_on_event(homekit_event_t event) {
     esp_event_post(HOMEKIT_EVENT, event, NULL, sizeof(NULL), 10);
 }
 void button_callback(button_event_t event, void* context) {
+    light_service_t *light = (light_service_t *) context;
+
+    // runs in the timer task that debounces the buttons, right as it decides
+    if (event == BUTTON_EVENT_DOWN) {
+        LATENCY_START(&light->trace);
+    }
+    else if (event == 1 || event == 2) {
+        LATENCY_MARK(&light->trace, LATENCY_POSTED);
+    }
+
     // esp_event_post sends a pointer to a COPY of the data. send address as uintptr_t data.
-    uintptr_t light_addr = (uintptr_t)context;
+    uintptr_t light_addr = (uintptr_t)light;
     esp_event_post(BUTTON_EVENT, event, &light_addr, sizeof(uintptr_t), 10);
 }
 
@@ -819,6 +1292,54 @@ int8_t configure_peripherals() {
         return -1;
     }
 
+    // dimming curve of each light, next to "config"; lights saved before
+    //   there was a choice have none, and keep the original gamma curve
+    uint8_t curves[num_lights];
+    memset(curves, DIMMING_CURVE_GAMMA, sizeof(curves));
+    size = sizeof(curves);
+    err = nvs_get_blob(lights_config_handle, "curves", curves, &size);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "nvs_get_blob curves err %d, using gamma", err);
+        memset(curves, DIMMING_CURVE_GAMMA, sizeof(curves));
+    }
+
+    // fade times; switches saved before there was a choice use the defaults
+    size = sizeof(fade_config);
+    err = nvs_get_blob(lights_config_handle, "fade", &fade_config, &size);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "nvs_get_blob fade err %d, using defaults", err);
+    }
+    if (err != ESP_OK) {
+        fade_config = (fade_config_t) FADE_CONFIG_DEFAULT;
+    }
+
+    // before the fade frames and the buttons, which use it for remote dimming
+    remote_mutex = xSemaphoreCreateMutex();
+    if (!remote_mutex) {
+        ESP_LOGE(TAG, "remote mutex create failed");
+        nvs_close(lights_config_handle);
+        return -1;
+    }
+
+    // before the buttons, which can start a fade or remote dimming
+    if (fade_init(remote_dim_frame) != ESP_OK) {
+        ESP_LOGE(TAG, "fade init failed");
+        nvs_close(lights_config_handle);
+        return -1;
+    }
+
+    // before the buttons, which notify their changes through it
+    if (notify_init(light_apply) != ESP_OK) {
+        ESP_LOGE(TAG, "notify init failed");
+        nvs_close(lights_config_handle);
+        return -1;
+    }
+
+    // before the buttons, which start tracing presses
+    if (latency_trace_init() != ESP_OK) {
+        ESP_LOGE(TAG, "latency trace init failed, press latency will not be recorded");
+    }
+
     // if there are ONLY remote switches, then homekit should not be started
     uint8_t num_remote_lights = 0;   
   
@@ -844,6 +1365,9 @@ int8_t configure_peripherals() {
         light->led_gpio = light_config[i].led_gpio;
         light->is_dimmer = light_config[i].is_dimmer; 
         light->is_remote = light_config[i].is_remote; 
+        light->index = i;
+        light->curve = curves[i] < DIMMING_CURVES ? curves[i] : DIMMING_CURVE_GAMMA;
+        light->fade_ms = -1;
     
         // hardware button 
         err = button_create(light_config[i].button_gpio, button_config, button_callback, light);
@@ -880,35 +1404,22 @@ int8_t configure_peripherals() {
             char *remote_cmd_val = malloc(required_size); 
             nvs_get_str(lights_config_handle, remote_cmd_key, remote_cmd_val, &required_size);
             
-            // nvs configuration will be stored as cJSON for life of light
-            light->nvs_command = cJSON_Parse(remote_cmd_val);
+            // compiled once here, a press only executes the plan
+            light->remote_plan = malloc(sizeof(remote_plan_t));
+            err = light->remote_plan ? remote_plan_compile(remote_cmd_val, light->remote_plan) : ESP_ERR_NO_MEM;
 
             free(remote_cmd_key);
             free(remote_cmd_val);
 
-            // parse 'host' and 'payload' and validate
-            cJSON *host_json = cJSON_GetObjectItem(light->nvs_command, "host");
-            cJSON *payload_json = cJSON_GetObjectItem(light->nvs_command, "payload");
-
-            if (!host_json || !payload_json) {
-                ESP_LOGE(TAG, "error button %d key: \"host\" or \"payload\" not found", i);
-                cJSON_Delete(light->nvs_command);
-                free(light);
-                continue;
-            }
-            else if (!cJSON_IsArray(payload_json)) {
-                ESP_LOGE(TAG, "error button %d \"payload\" was not a valid json array", i);
-                cJSON_Delete(light->nvs_command);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "error button %d remote command err %d", i, err);
+                free(light->remote_plan);
                 free(light);
                 continue;
             }
 
-            // Remote can still support the dimming (BRIGHTNESS) characteristic
-            //   create timer for long button hold - dimming function
-            // 500ms per 5% (increment value is set in the remote_hk task) is 5s
-            light->dim_timer = xTimerCreate(
-                "dim_timer", pdMS_TO_TICKS(500), pdTRUE, light, light_dim_timer_callback
-            );
+            // Remote can still support the dimming (BRIGHTNESS) characteristic,
+            //   remote_dim_frame sends it on the fade frames while the button is held
             light->dim_direction = -1;
 
             num_remote_lights++;
@@ -924,11 +1435,8 @@ int8_t configure_peripherals() {
             light->pwm_channel = i_pwm;
             i_pwm++;
 
-            // create timer for long button hold - dimming function
-            // 100ms per 2% is 5s
-            light->dim_timer = xTimerCreate(
-                "dim_timer", pdMS_TO_TICKS(100), pdTRUE, light, light_dim_timer_callback
-            );
+            // fades, including the long button hold - dimming function
+            fade_add_channel(light->pwm_channel, light->curve);
             light->dim_direction = -1;
         }
         else {
@@ -947,9 +1455,26 @@ int8_t configure_peripherals() {
         lights = light;
     }
 
+    // fast path to and from our other switches, only once a shared key is set
+    char udp_key[65];
+    size_t udp_key_size = sizeof(udp_key);
+    esp_err_t udp_err = nvs_get_str(lights_config_handle, "udp_key", udp_key, &udp_key_size);
+    if (udp_err == ESP_OK) {
+        // only answer commands when there are lights of our own
+        remote_udp_init(udp_key, num_lights > num_remote_lights ? remote_udp_apply : NULL);
+    }
+    else if (udp_err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "error nvs_get_str udp_key err %d", udp_err);
+    }
+
+    // once every light is in the list
+    if (scenes_init(lights_config_handle, scene_apply) != ESP_OK) {
+        ESP_LOGE(TAG, "scenes not loaded");
+    }
+
     nvs_close(lights_config_handle);
 
-    // configure PWM
+    // configure PWM, after this duties only change through fade (and its pwm_batch commits)
     if (i_pwm > 0) {
         err  = pwm_init(PWM_PERIOD_IN_US, duties, i_pwm, pins);    
         err |= pwm_set_channel_invert(pwm_invert_mask);        // parameter is a bit mask
@@ -963,9 +1488,38 @@ int8_t configure_peripherals() {
 
     // configure task to manage remote commands
     if (num_remote_lights > 0) {
+        // before http_pool and remote_shadow, which take their sockets from it
+        socket_budget_init(num_lights > num_remote_lights ? REMOTE_SOCKETS : REMOTE_SOCKETS_NO_HOMEKIT);
+
         // create the queue used to send complete struct remote_hk_t structures
         q_remotehk_message_queue = xQueueCreate(10, sizeof(remote_hk_t));
+        q_remote_ops = xQueueCreate(REMOTE_OPS, sizeof(remote_op_t *));
+        for (int i = 0; i < REMOTE_OPS; i++) {
+            remote_op_t *op = &remote_ops[i];
+            xQueueSendToBack(q_remote_ops, &op, 0);
+        }
         xTaskCreate(&remote_hk_task, "remote_hk", 5120, NULL, 5, NULL);
+
+        // one kept-alive connection per remote host, shared by all remote lights,
+        //   all driven by one task so different hosts are served concurrently
+        if (http_pool_init() != ESP_OK) {
+            ESP_LOGE(TAG, "http pool init failed, remote lights will not work");
+        }
+
+        // this switch as a HomeKit controller, for remote commands to paired accessories
+        if (hap_session_init_identity() != ESP_OK) {
+            ESP_LOGE(TAG, "controller identity init failed, paired accessories will not work");
+        }
+
+        // one event connection per remote host, so presses can skip the GET
+        if (remote_shadow_init() != ESP_OK) {
+            ESP_LOGE(TAG, "remote shadow init failed, every press will GET first");
+        }
+
+        // start browsing for the remote HomeKit hosts now, not on the first button press
+        if (mdns_cache_init() != ESP_OK) {
+            ESP_LOGE(TAG, "mdns cache init failed, remote hosts will be queried on every press");
+        }
     }
 
     ESP_LOGI(TAG, "num lights %d, PWM lights %d, num_remote_lights %d", num_lights, i_pwm, num_remote_lights);
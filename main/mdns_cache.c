@@ -0,0 +1,224 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>                            // strcasecmp
+
+#include "mdns.h"
+#include "lwip/ip_addr.h"
+
+#include "mdns_cache.h"
+#include "remote_udp.h"
+
+#include "esp_log.h"
+static const char *TAG = "mdns_cache";
+
+typedef struct {
+    char host[64];                              // empty if the slot is free
+    struct ip4_addr addr;
+    TickType_t expires;
+    uint16_t udp_port;                          // REMOTE_UDP_SERVICE port, 0 if not advertised
+} mdns_cache_entry_t;
+
+static mdns_cache_entry_t cache[MDNS_CACHE_SIZE];
+static SemaphoreHandle_t cache_mutex = NULL;
+static uint32_t cache_hits;
+static uint32_t cache_misses;
+
+static bool entry_expired(const mdns_cache_entry_t *entry, TickType_t now) {
+    // wrap-safe comparison of tick counts
+    return (int32_t)(entry->expires - now) <= 0;
+}
+
+static mdns_cache_entry_t *find_entry(const char *host) {
+    for (int i = 0; i < MDNS_CACHE_SIZE; i++) {
+        if (cache[i].host[0] && strcasecmp(cache[i].host, host) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// take cache_mutex before calling
+static void put_entry(const char *host, const struct ip4_addr *addr) {
+    TickType_t now = xTaskGetTickCount();
+    mdns_cache_entry_t *entry = find_entry(host);
+
+    if (!entry) {
+        // use a free or expired slot, otherwise evict the one closest to expiry
+        entry = &cache[0];
+        for (int i = 0; i < MDNS_CACHE_SIZE; i++) {
+            if (!cache[i].host[0] || entry_expired(&cache[i], now)) {
+                entry = &cache[i];
+                break;
+            }
+            if ((int32_t)(cache[i].expires - entry->expires) < 0) {
+                entry = &cache[i];
+            }
+        }
+        strlcpy(entry->host, host, sizeof(entry->host));
+        entry->udp_port = 0;
+    }
+
+    entry->addr = *addr;
+    entry->expires = now + pdMS_TO_TICKS(MDNS_CACHE_TTL_MS);
+}
+
+// Note the UDP port of hosts advertising a REMOTE_UDP_VERSION we speak. Only
+//   for hosts already found through _hap._tcp, as those are the ones we send to
+static void browse_udp(void) {
+    mdns_result_t *results = NULL;
+
+    if (mdns_query_ptr(REMOTE_UDP_SERVICE, "_udp", 1000, MDNS_CACHE_SIZE, &results) != ESP_OK) {
+        return;
+    }
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    for (mdns_result_t *r = results; r; r = r->next) {
+        mdns_cache_entry_t *entry = r->hostname ? find_entry(r->hostname) : NULL;
+        if (!entry) {
+            continue;
+        }
+        for (size_t i = 0; i < r->txt_count; i++) {
+            if (strcmp(r->txt[i].key, "v") == 0 && r->txt[i].value &&
+                atoi(r->txt[i].value) == REMOTE_UDP_VERSION) {
+                entry->udp_port = r->port;
+            }
+        }
+    }
+    xSemaphoreGive(cache_mutex);
+    mdns_query_results_free(results);
+}
+
+// Browse _hap._tcp so remote lights are resolved before the first button press,
+//   and keep re-browsing so entries are refreshed before their TTL runs out
+static void mdns_cache_browse_task(void *arg) {
+    uint32_t delay_ms = MDNS_CACHE_RETRY_MS;
+
+    while (1) {
+        mdns_result_t *results = NULL;
+        int found = 0;
+
+        esp_err_t err = mdns_query_ptr("_hap", "_tcp", 3000, MDNS_CACHE_SIZE, &results);
+        if (err == ESP_OK) {
+            xSemaphoreTake(cache_mutex, portMAX_DELAY);
+            for (mdns_result_t *r = results; r; r = r->next) {
+                if (!r->hostname) {
+                    continue;
+                }
+                for (mdns_ip_addr_t *a = r->addr; a; a = a->next) {
+                    if (IP_IS_V4(&a->addr)) {
+                        put_entry(r->hostname, ip_2_ip4(&a->addr));
+                        found++;
+                        break;
+                    }
+                }
+            }
+            xSemaphoreGive(cache_mutex);
+            mdns_query_results_free(results);
+        }
+        else {
+            // mDNS not up yet (no IP / HomeKit not started); keep trying quietly
+            ESP_LOGD(TAG, "browse _hap._tcp failed: %s", esp_err_to_name(err));
+        }
+
+        if (found) {
+            browse_udp();
+            ESP_LOGI(TAG, "browse found %d _hap._tcp hosts", found);
+            delay_ms = MDNS_CACHE_REFRESH_MS;
+        }
+        else {
+            // back off while there is nothing to find
+            delay_ms = MIN(delay_ms * 2, MDNS_CACHE_REFRESH_MS);
+        }
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+}
+
+esp_err_t mdns_cache_init(void) {
+    if (cache_mutex) {
+        return ESP_OK;
+    }
+
+    cache_mutex = xSemaphoreCreateMutex();
+    if (!cache_mutex) {
+        ESP_LOGE(TAG, "error creating mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(&mdns_cache_browse_task, "mdns_cache", 2560, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating browse task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mdns_cache_resolve(const char *host, uint32_t timeout_ms, struct ip4_addr *addr) {
+    if (!host || !addr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!cache_mutex) {
+        // mdns_cache_init() not called or failed
+        return mdns_query_a(host, timeout_ms, addr);
+    }
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    mdns_cache_entry_t *entry = find_entry(host);
+    if (entry && !entry_expired(entry, xTaskGetTickCount())) {
+        *addr = entry->addr;
+        cache_hits++;
+        xSemaphoreGive(cache_mutex);
+        return ESP_OK;
+    }
+    cache_misses++;
+    xSemaphoreGive(cache_mutex);
+
+    // blocking query without holding the mutex
+    ESP_LOGI(TAG, "cache miss for %s, querying", host);
+    esp_err_t err = mdns_query_a(host, timeout_ms, addr);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    put_entry(host, addr);
+    xSemaphoreGive(cache_mutex);
+    return ESP_OK;
+}
+
+void mdns_cache_invalidate(const char *host) {
+    if (!host || !cache_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    mdns_cache_entry_t *entry = find_entry(host);
+    if (entry) {
+        entry->host[0] = '\0';
+    }
+    xSemaphoreGive(cache_mutex);
+}
+
+uint16_t mdns_cache_udp_port(const char *host) {
+    uint16_t port = 0;
+
+    if (!host || !cache_mutex) {
+        return 0;
+    }
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    mdns_cache_entry_t *entry = find_entry(host);
+    if (entry) {
+        port = entry->udp_port;
+    }
+    xSemaphoreGive(cache_mutex);
+    return port;
+}
+
+void mdns_cache_get_stats(uint32_t *hits, uint32_t *misses) {
+    *hits = cache_hits;
+    *misses = cache_misses;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "lwip/ip4_addr.h"
+
+#define MDNS_CACHE_SIZE         8               // remote HomeKit hosts remembered
+#define MDNS_CACHE_TTL_MS       120000          // RFC 6762 TTL for host (A) records
+#define MDNS_CACHE_REFRESH_MS   (MDNS_CACHE_TTL_MS * 3 / 4)  // re-browse before entries expire
+#define MDNS_CACHE_RETRY_MS     5000            // re-browse interval while nothing is found
+
+// Create the cache and start the background _hap._tcp browse task
+esp_err_t mdns_cache_init(void);
+
+// Resolve host (without .local) from the cache, falling back to a blocking
+// mdns_query_a() of up to timeout_ms on a miss
+esp_err_t mdns_cache_resolve(const char *host, uint32_t timeout_ms, struct ip4_addr *addr);
+
+// Forget host, e.g. after requests to its cached address have failed
+void mdns_cache_invalidate(const char *host);
+
+// Port of host's UDP fast path (see remote_udp.h), 0 if it does not offer one
+uint16_t mdns_cache_udp_port(const char *host);
+
+void mdns_cache_get_stats(uint32_t *hits, uint32_t *misses);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,210 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <freertos/timers.h>
+
+#include <string.h>
+
+#include "notify.h"
+
+#include "esp_log.h"
+static const char *TAG = "notify";
+
+typedef struct {
+    homekit_characteristic_t *ch;               // NULL when free
+    homekit_value_t sent;                       // what the controllers have
+    bool has_sent;
+    homekit_value_t pending;                    // held back, ch->value already has it
+    bool has_pending;
+    TickType_t last_event;
+} notify_slot_t;
+
+static notify_slot_t slots[NOTIFY_SLOTS];
+static SemaphoreHandle_t slots_mutex = NULL;    // guards slots, never held while notifying
+static SemaphoreHandle_t serial_mutex = NULL;   // one notify_value() or flush at a time
+static TaskHandle_t serial_owner;               // holding serial_mutex, so its callbacks are ours
+static bool flushing;
+static TimerHandle_t flush_timer = NULL;
+static notify_apply_cb apply_cb;
+
+static uint32_t events_sent;
+static uint32_t values_coalesced;
+static uint32_t values_unchanged;
+
+static bool same_value(homekit_value_t a, homekit_value_t b) {
+    if (a.format != b.format || a.is_null != b.is_null) {
+        return false;
+    }
+    switch (a.format) {
+        case homekit_format_bool:
+            return a.bool_value == b.bool_value;
+        case homekit_format_int:
+            return a.int_value == b.int_value;
+        default:
+            // not used by the lights, always sent
+            return false;
+    }
+}
+
+// take slots_mutex before calling
+static notify_slot_t *find_slot(homekit_characteristic_t *ch, bool create) {
+    notify_slot_t *free_slot = NULL;
+    for (int i = 0; i < NOTIFY_SLOTS; i++) {
+        if (slots[i].ch == ch) {
+            return &slots[i];
+        }
+        if (!slots[i].ch && !free_slot) {
+            free_slot = &slots[i];
+        }
+    }
+    if (create && free_slot) {
+        memset(free_slot, 0, sizeof(*free_slot));
+        free_slot->ch = ch;
+        free_slot->last_event = xTaskGetTickCount() - pdMS_TO_TICKS(NOTIFY_MIN_INTERVAL_MS);
+        return free_slot;
+    }
+    return NULL;
+}
+
+static void flush_timer_callback(TimerHandle_t timer) {
+    // a notify_value() is running: try again next time
+    if (xSemaphoreTake(serial_mutex, 0) != pdTRUE) {
+        return;
+    }
+    serial_owner = xTaskGetCurrentTaskHandle();
+    flushing = true;
+
+    TickType_t now = xTaskGetTickCount();
+    bool waiting = false;
+
+    for (int i = 0; i < NOTIFY_SLOTS; i++) {
+        xSemaphoreTake(slots_mutex, portMAX_DELAY);
+        notify_slot_t *slot = &slots[i];
+        if (!slot->has_pending) {
+            xSemaphoreGive(slots_mutex);
+            continue;
+        }
+        if (now - slot->last_event < pdMS_TO_TICKS(NOTIFY_MIN_INTERVAL_MS)) {
+            waiting = true;
+            xSemaphoreGive(slots_mutex);
+            continue;
+        }
+
+        homekit_characteristic_t *ch = slot->ch;
+        homekit_value_t value = slot->pending;
+        slot->has_pending = false;
+        // e.g. on and back off again in between
+        if (slot->has_sent && same_value(slot->sent, value)) {
+            values_unchanged++;
+            xSemaphoreGive(slots_mutex);
+            continue;
+        }
+        slot->sent = value;
+        slot->has_sent = true;
+        slot->last_event = now;
+        events_sent++;
+        xSemaphoreGive(slots_mutex);
+
+        // the callbacks see notify_is_echo(), the light already has it
+        homekit_characteristic_notify(ch, value);
+    }
+
+    if (!waiting) {
+        xTimerStop(flush_timer, 0);
+    }
+
+    flushing = false;
+    serial_owner = NULL;
+    xSemaphoreGive(serial_mutex);
+}
+
+esp_err_t notify_init(notify_apply_cb apply) {
+    apply_cb = apply;
+
+    slots_mutex = xSemaphoreCreateMutex();
+    serial_mutex = xSemaphoreCreateMutex();
+    flush_timer = xTimerCreate("notify", pdMS_TO_TICKS(NOTIFY_FLUSH_MS), pdTRUE, NULL, flush_timer_callback);
+    if (!slots_mutex || !serial_mutex || !flush_timer) {
+        ESP_LOGE(TAG, "mutex or timer create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void notify_value(homekit_characteristic_t *ch, homekit_value_t value) {
+    xSemaphoreTake(serial_mutex, portMAX_DELAY);
+    serial_owner = xTaskGetCurrentTaskHandle();
+
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+    // with a value held back, ch->value is that value, so this covers it too
+    if (same_value(ch->value, value)) {
+        values_unchanged++;
+        xSemaphoreGive(slots_mutex);
+    }
+    else {
+        notify_slot_t *slot = find_slot(ch, true);
+        TickType_t now = xTaskGetTickCount();
+
+        if (!slot || (!slot->has_pending && now - slot->last_event >= pdMS_TO_TICKS(NOTIFY_MIN_INTERVAL_MS))) {
+            // quiet for long enough: send it now, the callback changes the light
+            if (slot) {
+                slot->sent = value;
+                slot->has_sent = true;
+                slot->last_event = now;
+            }
+            events_sent++;
+            xSemaphoreGive(slots_mutex);
+
+            ch->value = value;
+            homekit_characteristic_notify(ch, value);
+        }
+        else {
+            // hold it back, only the latest is sent
+            if (slot->has_pending) {
+                values_coalesced++;
+            }
+            slot->pending = value;
+            slot->has_pending = true;
+            xSemaphoreGive(slots_mutex);
+
+            ch->value = value;
+            if (apply_cb) {
+                apply_cb(ch, value);
+            }
+            xTimerStart(flush_timer, 0);
+        }
+    }
+
+    serial_owner = NULL;
+    xSemaphoreGive(serial_mutex);
+}
+
+bool notify_is_echo(void) {
+    return flushing && serial_owner == xTaskGetCurrentTaskHandle();
+}
+
+void notify_written(homekit_characteristic_t *ch, homekit_value_t value) {
+    // from notify_value() or the flush
+    if (serial_owner == xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+
+    // a controller wrote it, and esp-homekit told the others
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+    notify_slot_t *slot = find_slot(ch, false);
+    if (slot) {
+        slot->sent = value;
+        slot->has_sent = true;
+        slot->has_pending = false;
+        slot->last_event = xTaskGetTickCount();
+    }
+    xSemaphoreGive(slots_mutex);
+}
+
+void notify_get_stats(uint32_t *sent, uint32_t *coalesced, uint32_t *unchanged) {
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+    *sent = events_sent;
+    *coalesced = values_coalesced;
+    *unchanged = values_unchanged;
+    xSemaphoreGive(slots_mutex);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include <homekit/homekit.h>
+
+#define NOTIFY_MIN_INTERVAL_MS  250             // between events for one characteristic
+#define NOTIFY_FLUSH_MS         50              // how often held back values are checked
+#define NOTIFY_SLOTS            16              // characteristics tracked, two per light is plenty
+
+// Every homekit_characteristic_notify() sends an encrypted EVENT to each
+//   subscribed controller. Values set here change the light straight away,
+//   but a characteristic is only notified once per NOTIFY_MIN_INTERVAL_MS:
+//   values in between are held back, the latest replacing the one before,
+//   and the last is always sent. A value the controllers already have is
+//   not sent at all.
+
+// Change the light for ch to value without notifying, as the
+//   characteristic's own callback would
+typedef void (*notify_apply_cb)(homekit_characteristic_t *ch, homekit_value_t value);
+
+esp_err_t notify_init(notify_apply_cb apply);
+
+// Set ch to value, instead of setting ch->value and calling
+//   homekit_characteristic_notify()
+void notify_value(homekit_characteristic_t *ch, homekit_value_t value);
+
+// For the characteristic callbacks. True when the callback is only the
+//   held back value being sent, so the light already has it
+bool notify_is_echo(void);
+
+// For the characteristic callbacks, with every value they get: when it came
+//   from a controller, the controllers have it and a held back value is dropped
+void notify_written(homekit_characteristic_t *ch, homekit_value_t value);
+
+// Events sent, values replaced before they were sent, and values not sent
+//   because the controllers already had them
+void notify_get_stats(uint32_t *sent, uint32_t *coalesced, uint32_t *unchanged);
+
+#ifdef __cplusplus
+}
+#endif
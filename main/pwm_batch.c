@@ -0,0 +1,66 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "pwm.h"
+
+#include "pwm_batch.h"
+
+#include "esp_log.h"
+static const char *TAG = "pwm_batch";
+
+static uint32_t committed[PWM_BATCH_CHANNELS];  // pwm_init starts every channel at 0
+static uint32_t staged[PWM_BATCH_CHANNELS];
+static uint8_t staged_mask;
+static uint32_t commits;
+static uint32_t duties_committed;
+static SemaphoreHandle_t batch_mutex = NULL;
+
+esp_err_t pwm_batch_init(void) {
+    batch_mutex = xSemaphoreCreateMutex();
+    if (!batch_mutex) {
+        ESP_LOGE(TAG, "mutex create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void pwm_batch_set_duty(uint8_t channel, uint32_t duty) {
+    if (channel >= PWM_BATCH_CHANNELS) {
+        return;
+    }
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    if (duty == committed[channel]) {
+        staged_mask &= ~(1 << channel);
+    }
+    else {
+        staged[channel] = duty;
+        staged_mask |= 1 << channel;
+    }
+    xSemaphoreGive(batch_mutex);
+}
+
+bool pwm_batch_commit(void) {
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    uint8_t mask = staged_mask;
+    for (int i = 0; i < PWM_BATCH_CHANNELS; i++) {
+        if (mask & (1 << i)) {
+            pwm_set_duty(i, staged[i]);
+            committed[i] = staged[i];
+            duties_committed++;
+        }
+    }
+    if (mask) {
+        pwm_start();
+        commits++;
+    }
+    staged_mask = 0;
+    xSemaphoreGive(batch_mutex);
+    return mask != 0;
+}
+
+void pwm_batch_get_stats(uint32_t *commits_out, uint32_t *duties_out) {
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    *commits_out = commits;
+    *duties_out = duties_committed;
+    xSemaphoreGive(batch_mutex);
+}
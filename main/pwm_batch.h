@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define PWM_BATCH_CHANNELS      8               // as many as pwm_init takes
+
+// pwm_start() works out the phases and period for every channel, so setting
+//   several duties and starting after each one does that work, and can
+//   glitch the output, once per channel. Duties are staged here instead and
+//   committed together with one pwm_start().
+
+esp_err_t pwm_batch_init(void);
+
+// Stage a duty for channel (as given to pwm_init). Nothing changes until
+//   pwm_batch_commit(), and a duty the channel already has is dropped
+void pwm_batch_set_duty(uint8_t channel, uint32_t duty);
+
+// Set every staged duty and pwm_start() once. Returns whether there was
+//   anything to commit
+bool pwm_batch_commit(void);
+
+// pwm_start() calls so far, and duties they carried, to see the batching work
+void pwm_batch_get_stats(uint32_t *commits, uint32_t *duties);
+
+#ifdef __cplusplus
+}
+#endif
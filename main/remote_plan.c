@@ -0,0 +1,225 @@
+#include <string.h>
+
+#include <homekit/characteristics.h>
+
+#include "remote_plan.h"
+#include "cJSON.h"
+#include "json_writer.h"
+
+#include "esp_log.h"
+static const char *TAG = "remote_plan";
+
+// OPTIONAL CHARACTERISTIC for remote switch identifier
+#define REMOTE_CHARACTERISTIC_SWITCH_ID "02B77067-DA5D-493C-829D-F6C5DCFE5C28"
+
+static remote_kind_t kind_from_type(const char *type) {
+    if (strcmp(type, HOMEKIT_CHARACTERISTIC_ON) == 0) {
+        return REMOTE_KIND_ON;
+    }
+    if (strcmp(type, HOMEKIT_CHARACTERISTIC_BRIGHTNESS) == 0) {
+        return REMOTE_KIND_BRIGHTNESS;
+    }
+    if (strcmp(type, REMOTE_CHARACTERISTIC_SWITCH_ID) == 0) {
+        return REMOTE_KIND_SWITCH_ID;
+    }
+    return REMOTE_KIND_OTHER;
+}
+
+// 64 hex digits into a 32 byte key
+static bool parse_key(const char *hex, uint8_t *key) {
+    if (strlen(hex) != 2 * HAP_SESSION_KEY_SIZE) {
+        return false;
+    }
+    for (int i = 0; i < 2 * HAP_SESSION_KEY_SIZE; i++) {
+        char c = hex[i] | 0x20;
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) {
+            return false;
+        }
+        key[i / 2] = (key[i / 2] << 4) | digit;
+    }
+    return true;
+}
+
+static void update_kinds_known(remote_plan_t *plan) {
+    plan->kinds_known = true;
+    for (int i = 0; i < plan->num_items; i++) {
+        if (plan->items[i].kind == REMOTE_KIND_UNKNOWN) {
+            plan->kinds_known = false;
+        }
+    }
+}
+
+esp_err_t remote_plan_compile(const char *nvs_command, remote_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+
+    cJSON *root = cJSON_Parse(nvs_command);
+    cJSON *host_json = cJSON_GetObjectItem(root, "host");
+    cJSON *payload_json = cJSON_GetObjectItem(root, "payload");
+
+    if (!cJSON_IsString(host_json) || !payload_json) {
+        ESP_LOGE(TAG, "key: \"host\" or \"payload\" not found");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!cJSON_IsArray(payload_json)) {
+        ESP_LOGE(TAG, "\"payload\" was not a valid json array");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlcpy(plan->host, host_json->valuestring, sizeof(plan->host)) >= sizeof(plan->host)) {
+        ESP_LOGE(TAG, "\"host\" too long");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    cJSON *port_json = cJSON_GetObjectItem(root, "port");
+    plan->port = cJSON_IsNumber(port_json) ? port_json->valueint : REMOTE_PLAN_PORT;
+
+    cJSON *accessory_id_json = cJSON_GetObjectItem(root, "accessory_id");
+    cJSON *accessory_ltpk_json = cJSON_GetObjectItem(root, "accessory_ltpk");
+    if (cJSON_IsString(accessory_id_json) && cJSON_IsString(accessory_ltpk_json)) {
+        if (strlcpy(plan->pairing.accessory_id, accessory_id_json->valuestring, sizeof(plan->pairing.accessory_id))
+                >= sizeof(plan->pairing.accessory_id) ||
+            !parse_key(accessory_ltpk_json->valuestring, plan->pairing.accessory_ltpk)) {
+            ESP_LOGE(TAG, "\"accessory_id\" too long or \"accessory_ltpk\" not 64 hex digits");
+            cJSON_Delete(root);
+            return ESP_ERR_INVALID_ARG;
+        }
+        plan->paired = true;
+    }
+
+    cJSON *payload_item;
+    cJSON_ArrayForEach(payload_item, payload_json) {
+        cJSON *aid_key = cJSON_GetObjectItem(payload_item, "aid");
+        cJSON *iid_key = cJSON_GetObjectItem(payload_item, "iid");
+        if (!cJSON_IsNumber(aid_key) || !cJSON_IsNumber(iid_key)) {
+            ESP_LOGE(TAG, "error parsing \"key\" : \"aid\" or \"iid\", skipped");
+            continue;
+        }
+        if (plan->num_items == REMOTE_PLAN_MAX_IDS) {
+            ESP_LOGE(TAG, "more than %d aid.iid in payload, ignoring the rest", REMOTE_PLAN_MAX_IDS);
+            break;
+        }
+
+        remote_plan_item_t *item = &plan->items[plan->num_items];
+        item->id.aid = aid_key->valueint;
+        item->id.iid = iid_key->valueint;
+        cJSON *value_key = cJSON_GetObjectItem(payload_item, "value");
+        if (cJSON_IsNumber(value_key)) {
+            item->has_value = true;
+            item->value = value_key->valueint;
+        }
+        plan->ids[plan->num_items] = item->id;
+        plan->num_items++;
+    }
+    cJSON_Delete(root);
+
+    char aid_iid[HTTP_HAP_IDS_SIZE(REMOTE_PLAN_MAX_IDS)];
+    if (plan->num_items == 0 || http_format_hap_ids(aid_iid, sizeof(aid_iid), plan->ids, plan->num_items) <= 0) {
+        ESP_LOGE(TAG, "error creating aid.iid list");
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(plan->get_path, sizeof(plan->get_path), "/characteristics?id=%s&type=1", aid_iid);
+
+    ESP_LOGI(TAG, "%s:%u: %d aid.iid (%s)%s", plan->host, plan->port, plan->num_items, aid_iid,
+             plan->paired ? ", paired" : "");
+    return ESP_OK;
+}
+
+bool remote_plan_read_response(remote_plan_t *plan, const hap_response_t *response, int *values) {
+    int found = 0;
+
+    for (int i = 0; i < plan->num_items; i++) {
+        remote_plan_item_t *item = &plan->items[i];
+        const hap_char_t *c = hap_response_find(response, item->id.aid, item->id.iid);
+        if (!c) {
+            continue;
+        }
+        if (c->type[0]) {
+            item->kind = kind_from_type(c->type);
+        }
+        values[i] = c->has_value ? c->value : 0;
+        found++;
+    }
+
+    update_kinds_known(plan);
+    return found == plan->num_items;
+}
+
+void remote_plan_set_kinds(remote_plan_t *plan, const uint8_t *kinds) {
+    for (int i = 0; i < plan->num_items; i++) {
+        if (kinds[i] != REMOTE_KIND_UNKNOWN) {
+            plan->items[i].kind = kinds[i];
+        }
+    }
+    update_kinds_known(plan);
+}
+
+bool remote_plan_item_value(const remote_plan_t *plan, int i, remote_plan_action_t action, const int *values,
+                            int brightness, int *value) {
+    const remote_plan_item_t *item = &plan->items[i];
+
+    switch (item->kind) {
+        case REMOTE_KIND_ON:
+            if (action == REMOTE_PLAN_TOGGLE) {
+                *value = !values[i];
+            }
+            else if (action == REMOTE_PLAN_FULL_ON) {
+                *value = 1;
+            }
+            else if (action == REMOTE_PLAN_OFF) {
+                *value = 0;
+            }
+            else {
+                *value = brightness > 0;
+            }
+            return true;
+        case REMOTE_KIND_BRIGHTNESS:
+            if (action == REMOTE_PLAN_TOGGLE || action == REMOTE_PLAN_OFF) {
+                return false;
+            }
+            *value = action == REMOTE_PLAN_FULL_ON ? 100 : brightness;
+            return true;
+        case REMOTE_KIND_SWITCH_ID:
+            // Go through the NVS payload and find what value to send to remote device
+            if (action == REMOTE_PLAN_SET_BRIGHTNESS || !item->has_value) {
+                return false;
+            }
+            *value = item->value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+int remote_plan_build(const remote_plan_t *plan, remote_plan_action_t action, const int *values,
+                      int brightness, char *buf, size_t size) {
+    json_writer_t w;
+    json_writer_init(&w, buf, size);
+    json_write_object_start(&w, NULL);
+    json_write_array_start(&w, "characteristics");
+
+    for (int i = 0; i < plan->num_items; i++) {
+        int value;
+        if (!remote_plan_item_value(plan, i, action, values, brightness, &value)) {
+            continue;
+        }
+
+        const remote_plan_item_t *item = &plan->items[i];
+        json_write_object_start(&w, NULL);
+        json_write_int(&w, "aid", item->id.aid);
+        json_write_int(&w, "iid", item->id.iid);
+        if (item->kind == REMOTE_KIND_ON) {
+            json_write_bool(&w, "value", value);
+        }
+        else {
+            json_write_int(&w, "value", value);
+        }
+        json_write_object_end(&w);
+    }
+
+    json_write_array_end(&w);
+    json_write_object_end(&w);
+    return json_writer_finish(&w);
+}
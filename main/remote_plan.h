@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "hap_response.h"
+#include "http_parser.h"
+#include "hap_session.h"
+
+#define REMOTE_PLAN_MAX_IDS     4               // aid.iid pairs per remote light
+#define REMOTE_PLAN_BODY_SIZE   (REMOTE_PLAN_MAX_IDS * 48 + 24)  // largest PUT body
+#define REMOTE_PLAN_PORT        5556            // when the command has no "port"
+
+typedef enum {
+    REMOTE_KIND_UNKNOWN = 0,                    // until a GET with type=1 has been seen
+    REMOTE_KIND_ON,
+    REMOTE_KIND_BRIGHTNESS,
+    REMOTE_KIND_SWITCH_ID,                      // optional remote switch identifier, sent the configured value
+    REMOTE_KIND_OTHER,                          // never written
+} remote_kind_t;
+
+typedef enum {
+    REMOTE_PLAN_TOGGLE,
+    REMOTE_PLAN_FULL_ON,
+    REMOTE_PLAN_SET_BRIGHTNESS,
+    REMOTE_PLAN_OFF,                            // leaves the brightness as it is
+} remote_plan_action_t;
+
+typedef struct {
+    struct http_hap_id id;
+    uint8_t kind;                               // remote_kind_t
+    bool has_value;                             // "value" given in the NVS payload
+    int value;
+} remote_plan_item_t;
+
+// A rem_cmd_%d NVS command, compiled once at boot
+typedef struct {
+    char host[64];                              // mDNS host name, without .local
+    uint16_t port;
+    bool paired;                                // "accessory_id" and "accessory_ltpk" given: pair-verify first
+    hap_pairing_t pairing;
+    remote_plan_item_t items[REMOTE_PLAN_MAX_IDS];
+    int num_items;
+    bool kinds_known;                           // every item has a kind, so no GET is needed to build a PUT
+    struct http_hap_id ids[REMOTE_PLAN_MAX_IDS];
+    char get_path[sizeof("/characteristics?id=&type=1") + HTTP_HAP_IDS_SIZE(REMOTE_PLAN_MAX_IDS)];
+} remote_plan_t;
+
+// Compile {"host": "...", "payload": [{"aid", "iid", "value"}, ...]}, with
+//   optional "port", and "accessory_id" plus "accessory_ltpk" (64 hex digits)
+//   for an accessory this switch has been added to as a controller
+esp_err_t remote_plan_compile(const char *nvs_command, remote_plan_t *plan);
+
+// Take kinds and current values from a GET ...&type=1 response. values has
+//   one slot per plan item. Returns true if every item was in the response
+bool remote_plan_read_response(remote_plan_t *plan, const hap_response_t *response, int *values);
+
+// Take kinds (remote_kind_t, one per plan item) reported by the remote host
+//   some other way, e.g. in a remote_udp acknowledgement
+void remote_plan_set_kinds(remote_plan_t *plan, const uint8_t *kinds);
+
+// Write the PUT /characteristics body for action into buf. values are the
+//   current values (only read for TOGGLE). Returns its length, or -1 if it
+//   does not fit
+int remote_plan_build(const remote_plan_t *plan, remote_plan_action_t action, const int *values,
+                      int brightness, char *buf, size_t size);
+
+// The value action writes to item i (bools as 0/1), false if it leaves the
+//   item alone. remote_plan_build() is made of these, the shadow is updated with them
+bool remote_plan_item_value(const remote_plan_t *plan, int i, remote_plan_action_t action, const int *values,
+                            int brightness, int *value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,637 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/sockets.h"
+
+#include "remote_shadow.h"
+#include "socket_budget.h"                      // lwip sockets shared with http_pool
+#include "json_writer.h"
+
+#include "esp_log.h"
+static const char *TAG = "remote_shadow";
+
+typedef struct {
+    uint32_t aid;
+    uint32_t iid;
+    int value;                                  // bool characteristics are stored as 0/1
+    bool has_value;
+} remote_shadow_char_t;
+
+typedef enum {
+    SENT_PUT,                                   // the "ev" subscription
+    SENT_GET,                                   // a reconcile read
+} sent_request_t;
+
+typedef struct {
+    char host[64];                              // mDNS name, the slot follows it to a new address
+    char host_ip[16];                           // empty if the slot is free
+    TickType_t last_used;                       // last press that looked the host up
+    remote_shadow_char_t chars[REMOTE_SHADOW_IDS];
+    int num_chars;
+    int num_subscribed;                         // chars[0..num_subscribed) have been sent "ev":true
+
+    int sock;                                   // event connection, -1 if not connected
+    bool connecting;                            // sock is in a non-blocking connect
+    TickType_t connect_started;
+    bool live;                                  // subscription acknowledged, values are current
+    TickType_t last_rx;
+    TickType_t last_reconcile;
+    TickType_t next_connect;
+    uint32_t retry_ms;
+    uint8_t sent[4];                            // sent_request_t of the requests not answered yet, oldest first
+    int num_sent;
+
+    // only touched by the shadow task
+    http_parser parser;
+    hap_response_t response;                    // body of the message being received
+    bool has_body;
+} remote_shadow_host_t;
+
+static remote_shadow_host_t hosts[REMOTE_SHADOW_HOSTS];
+static SemaphoreHandle_t shadow_mutex = NULL;
+static http_parser_settings parser_settings;
+static uint32_t shadow_hits;
+static uint32_t shadow_misses;
+static uint32_t shadow_events;
+
+static uint32_t ms_since(TickType_t then) {
+    return (xTaskGetTickCount() - then) * portTICK_PERIOD_MS;
+}
+
+static remote_shadow_host_t *find_host(const char *host_ip) {
+    for (int i = 0; i < REMOTE_SHADOW_HOSTS; i++) {
+        if (hosts[i].host_ip[0] && strcmp(hosts[i].host_ip, host_ip) == 0) {
+            return &hosts[i];
+        }
+    }
+    return NULL;
+}
+
+static remote_shadow_char_t *find_char(remote_shadow_host_t *host, uint32_t aid, uint32_t iid) {
+    for (int i = 0; i < host->num_chars; i++) {
+        if (host->chars[i].aid == aid && host->chars[i].iid == iid) {
+            return &host->chars[i];
+        }
+    }
+    return NULL;
+}
+
+// take shadow_mutex before calling
+static void update_chars(remote_shadow_host_t *host, const hap_response_t *response) {
+    for (int i = 0; i < response->num_chars; i++) {
+        const hap_char_t *item = &response->chars[i];
+        // only characteristics that were subscribed are kept current by events
+        remote_shadow_char_t *c = find_char(host, item->aid, item->iid);
+        if (!c || !item->has_value) {
+            continue;
+        }
+        c->value = item->value;
+        c->has_value = true;
+    }
+}
+
+// take shadow_mutex before calling
+static void close_host(remote_shadow_host_t *host) {
+    if (host->sock >= 0) {
+        close(host->sock);
+        socket_budget_give();
+        host->sock = -1;
+    }
+    host->connecting = false;
+    // without events nothing tells us about changes made by other controllers
+    host->live = false;
+    host->num_subscribed = 0;
+    host->num_sent = 0;
+    for (int i = 0; i < host->num_chars; i++) {
+        host->chars[i].has_value = false;
+    }
+    host->next_connect = xTaskGetTickCount() + pdMS_TO_TICKS(host->retry_ms);
+    host->retry_ms = MIN(host->retry_ms * 2, REMOTE_SHADOW_RECONCILE_MS);
+}
+
+// Close the event connection and empty the slot
+// take shadow_mutex before calling
+static void free_host(remote_shadow_host_t *host) {
+    close_host(host);
+    memset(host, 0, sizeof(*host));
+    host->sock = -1;
+}
+
+static int on_message_begin(http_parser *parser) {
+    remote_shadow_host_t *host = parser->data;
+    hap_response_init(&host->response);
+    host->has_body = false;
+    return 0;
+}
+
+// tokenized as it arrives, so the body size is not limited
+static int on_body(http_parser *parser, const char *at, size_t length) {
+    remote_shadow_host_t *host = parser->data;
+    host->has_body = true;
+    if (hap_response_feed(&host->response, at, length) != ESP_OK) {
+        ESP_LOGE(TAG, "%s sent a malformed body", host->host_ip);
+        return -1;
+    }
+    return 0;
+}
+
+// EVENT/1.0 notifications and GET responses carry values; a 204 to the
+//   subscription PUT is what makes the shadow live. Anything else for the
+//   PUT (a 207 means some ids were refused) drops the connection, to
+//   subscribe again after retry_ms
+// the parser runs with shadow_mutex taken
+static int on_message_complete(http_parser *parser) {
+    remote_shadow_host_t *host = parser->data;
+    bool has_values = host->has_body && hap_response_finish(&host->response) == ESP_OK;
+
+    // "EVENT/1.0"; responses to our own requests are HTTP/1.1, in order
+    if (parser->http_major == 1 && parser->http_minor == 0) {
+        if (has_values) {
+            shadow_events++;
+            update_chars(host, &host->response);
+        }
+        return 0;
+    }
+    if (host->num_sent == 0) {
+        ESP_LOGE(TAG, "%s answered a request we did not send", host->host_ip);
+        return -1;
+    }
+    sent_request_t sent = host->sent[0];
+    memmove(host->sent, host->sent + 1, --host->num_sent);
+
+    if (sent == SENT_PUT) {
+        if (parser->status_code != 204) {
+            ESP_LOGW(TAG, "%s refused the subscription: %d", host->host_ip, parser->status_code);
+            return -1;
+        }
+        host->live = true;
+        host->retry_ms = REMOTE_SHADOW_RETRY_MS;
+    }
+    else if (has_values) {
+        update_chars(host, &host->response);
+    }
+    return 0;
+}
+
+// take shadow_mutex before calling
+static esp_err_t send_request(remote_shadow_host_t *host, const char *method, const char *path, const char *body) {
+    char request[384];
+    int len;
+
+    if (body) {
+        len = snprintf(request, sizeof(request),
+                "%s %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n%s",
+                method, path, host->host_ip, REMOTE_SHADOW_PORT, (int) strlen(body), body);
+    }
+    else {
+        len = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n",
+                method, path, host->host_ip, REMOTE_SHADOW_PORT);
+    }
+    if (len < 0 || len >= (int) sizeof(request)) {
+        ESP_LOGE(TAG, "%s request too long", method);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (host->num_sent == sizeof(host->sent)) {
+        ESP_LOGW(TAG, "%s is not answering", host->host_ip);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if (send(host->sock, request, len, 0) != len) {
+        ESP_LOGW(TAG, "send to %s failed", host->host_ip);
+        return ESP_FAIL;
+    }
+    host->sent[host->num_sent++] = body ? SENT_PUT : SENT_GET;
+    return ESP_OK;
+}
+
+// {"characteristics":[{"aid":1,"iid":9,"ev":true}, ...]} for the ids not subscribed yet
+static void write_subscribe_json(json_writer_t *w, const remote_shadow_host_t *host) {
+    json_write_object_start(w, NULL);
+    json_write_array_start(w, "characteristics");
+    for (int i = host->num_subscribed; i < host->num_chars; i++) {
+        json_write_object_start(w, NULL);
+        json_write_int(w, "aid", host->chars[i].aid);
+        json_write_int(w, "iid", host->chars[i].iid);
+        json_write_bool(w, "ev", true);
+        json_write_object_end(w);
+    }
+    json_write_array_end(w);
+    json_write_object_end(w);
+}
+
+// Subscribe any ids added since the last subscription, then read them all back
+//   so the shadow does not have to wait for the first event
+// take shadow_mutex before calling
+static esp_err_t subscribe_host(remote_shadow_host_t *host) {
+    json_writer_t w;
+
+    if (host->num_subscribed == host->num_chars) {
+        return ESP_OK;
+    }
+
+    // measure first, then one allocation of the exact size
+    json_writer_init(&w, NULL, 0);
+    write_subscribe_json(&w, host);
+    size_t out_size = w.len + 1;
+    char *out = malloc(out_size);
+    if (!out) {
+        return ESP_ERR_NO_MEM;
+    }
+    json_writer_init(&w, out, out_size);
+    write_subscribe_json(&w, host);
+    json_writer_finish(&w);
+
+    esp_err_t err = send_request(host, "PUT", "/characteristics", out);
+    free(out);
+    if (err != ESP_OK) {
+        return err;
+    }
+    host->num_subscribed = host->num_chars;
+    // have the task read the new ids back straight away
+    host->last_reconcile = xTaskGetTickCount() - pdMS_TO_TICKS(REMOTE_SHADOW_RECONCILE_MS);
+    return ESP_OK;
+}
+
+// take shadow_mutex before calling
+static esp_err_t reconcile_host(remote_shadow_host_t *host) {
+    struct http_hap_id ids[REMOTE_SHADOW_IDS];
+    for (int i = 0; i < host->num_chars; i++) {
+        ids[i].aid = host->chars[i].aid;
+        ids[i].iid = host->chars[i].iid;
+    }
+
+    char aid_iid[HTTP_HAP_IDS_SIZE(REMOTE_SHADOW_IDS)];
+    char path[sizeof("/characteristics?id=") + HTTP_HAP_IDS_SIZE(REMOTE_SHADOW_IDS)];
+    if (http_format_hap_ids(aid_iid, sizeof(aid_iid), ids, host->num_chars) <= 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    snprintf(path, sizeof(path), "/characteristics?id=%s", aid_iid);
+
+    host->last_reconcile = xTaskGetTickCount();
+    return send_request(host, "GET", path, NULL);
+}
+
+// The event connection is up: start parsing and subscribe
+// take shadow_mutex before calling
+static void on_connected(remote_shadow_host_t *host) {
+    ESP_LOGI(TAG, "event connection to %s", host->host_ip);
+    http_parser_init(&host->parser, HTTP_RESPONSE);
+    host->parser.data = host;
+
+    host->connecting = false;
+    host->last_rx = xTaskGetTickCount();
+    if (subscribe_host(host) != ESP_OK) {
+        close_host(host);
+    }
+}
+
+// Start a non-blocking connect; the task finishes it once select() reports
+//   the socket writable, so an unreachable host holds up no other host
+// take shadow_mutex before calling
+static void connect_host(remote_shadow_host_t *host) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(REMOTE_SHADOW_PORT),
+    };
+
+    if (inet_aton(host->host_ip, &addr.sin_addr) == 0) {
+        ESP_LOGE(TAG, "bad address %s", host->host_ip);
+        close_host(host);
+        return;
+    }
+    // presses only need http_pool, so events never take its last sockets
+    if (!socket_budget_take(REMOTE_SHADOW_KEEP_SOCKETS)) {
+        ESP_LOGD(TAG, "no socket left for %s, retrying later", host->host_ip);
+        close_host(host);
+        return;
+    }
+    host->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (host->sock < 0) {
+        socket_budget_give();
+        ESP_LOGE(TAG, "no socket for %s", host->host_ip);
+        close_host(host);
+        return;
+    }
+    fcntl(host->sock, F_SETFL, fcntl(host->sock, F_GETFL, 0) | O_NONBLOCK);
+
+    if (connect(host->sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        on_connected(host);
+    }
+    else if (errno == EINPROGRESS) {
+        host->connecting = true;
+        host->connect_started = xTaskGetTickCount();
+    }
+    else {
+        ESP_LOGW(TAG, "connect to %s failed", host->host_ip);
+        close_host(host);
+    }
+}
+
+// select() reported the connecting socket writable
+// take shadow_mutex before calling
+static void finish_connect(remote_shadow_host_t *host) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(host->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error) {
+        ESP_LOGW(TAG, "connect to %s failed", host->host_ip);
+        close_host(host);
+        return;
+    }
+    on_connected(host);
+}
+
+// Hold one event connection per host: subscribe, parse the EVENT/1.0 stream
+//   into the shadow and re-read everything every RECONCILE_MS in case an
+//   event was lost. Closing the connection drops the host's values.
+//   Another task may drop or reuse a slot at any time, so everything,
+//   recv() and the parser included, runs with shadow_mutex taken, and a
+//   socket select() reported on is only used if the slot still has it
+static void remote_shadow_task(void *arg) {
+    char buf[256];
+    int socks[REMOTE_SHADOW_HOSTS];
+
+    while (1) {
+        fd_set read_fds;
+        fd_set write_fds;
+        int max_fd = -1;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+
+        for (int i = 0; i < REMOTE_SHADOW_HOSTS; i++) {
+            remote_shadow_host_t *host = &hosts[i];
+            socks[i] = -1;
+
+            xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+            if (!host->host_ip[0]) {
+                xSemaphoreGive(shadow_mutex);
+                continue;
+            }
+            if (host->sock < 0 && (int32_t)(xTaskGetTickCount() - host->next_connect) >= 0) {
+                connect_host(host);
+            }
+            if (host->sock < 0) {
+                xSemaphoreGive(shadow_mutex);
+                continue;
+            }
+            if (host->connecting) {
+                if (ms_since(host->connect_started) > REMOTE_SHADOW_CONNECT_MS) {
+                    ESP_LOGW(TAG, "connect to %s timed out", host->host_ip);
+                    close_host(host);
+                }
+                else {
+                    socks[i] = host->sock;
+                    FD_SET(host->sock, &write_fds);
+                    max_fd = MAX(max_fd, host->sock);
+                }
+                xSemaphoreGive(shadow_mutex);
+                continue;
+            }
+
+            esp_err_t err = subscribe_host(host);
+            if (err == ESP_OK && ms_since(host->last_reconcile) >= REMOTE_SHADOW_RECONCILE_MS) {
+                err = reconcile_host(host);
+            }
+            if (err == ESP_OK && ms_since(host->last_rx) > 2 * REMOTE_SHADOW_RECONCILE_MS) {
+                // not even the reconcile GET was answered: half-open connection
+                ESP_LOGW(TAG, "%s stopped answering", host->host_ip);
+                err = ESP_ERR_TIMEOUT;
+            }
+            if (err != ESP_OK) {
+                close_host(host);
+            }
+            if (host->sock >= 0) {
+                socks[i] = host->sock;
+                FD_SET(host->sock, &read_fds);
+                max_fd = MAX(max_fd, host->sock);
+            }
+            xSemaphoreGive(shadow_mutex);
+        }
+
+        if (max_fd < 0) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout) <= 0) {
+            continue;
+        }
+
+        for (int i = 0; i < REMOTE_SHADOW_HOSTS; i++) {
+            remote_shadow_host_t *host = &hosts[i];
+            if (socks[i] < 0) {
+                continue;
+            }
+
+            xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+            if (host->sock != socks[i]) {
+                // dropped or reused meanwhile
+                xSemaphoreGive(shadow_mutex);
+                continue;
+            }
+            if (host->connecting || !FD_ISSET(host->sock, &read_fds)) {
+                if (host->connecting && FD_ISSET(host->sock, &write_fds)) {
+                    finish_connect(host);
+                }
+                xSemaphoreGive(shadow_mutex);
+                continue;
+            }
+
+            // non-blocking, and select() said there is something
+            int len = recv(host->sock, buf, sizeof(buf), 0);
+            size_t parsed = len > 0 ? http_parser_execute(&host->parser, &parser_settings, buf, len) : 0;
+
+            if (len <= 0) {
+                ESP_LOGI(TAG, "%s closed the event connection", host->host_ip);
+                close_host(host);
+            }
+            else if (parsed != (size_t) len) {
+                ESP_LOGE(TAG, "%s: %s", host->host_ip, http_errno_name(HTTP_PARSER_ERRNO(&host->parser)));
+                close_host(host);
+            }
+            else {
+                host->last_rx = xTaskGetTickCount();
+            }
+            xSemaphoreGive(shadow_mutex);
+        }
+    }
+}
+
+esp_err_t remote_shadow_init(void) {
+    if (shadow_mutex) {
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < REMOTE_SHADOW_HOSTS; i++) {
+        hosts[i].sock = -1;
+    }
+    http_parser_settings_init(&parser_settings);
+    parser_settings.on_message_begin = on_message_begin;
+    parser_settings.on_body = on_body;
+    parser_settings.on_message_complete = on_message_complete;
+
+    shadow_mutex = xSemaphoreCreateMutex();
+    if (!shadow_mutex) {
+        ESP_LOGE(TAG, "error creating mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(&remote_shadow_task, "remote_shadow", 3072, NULL, tskIDLE_PRIORITY + 2, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating event task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// The slot for host at host_ip: its own, the one it had at an address it
+//   has left, a free one, or the least recently used one taken over
+// take shadow_mutex before calling
+static remote_shadow_host_t *get_host(const char *host_name, const char *host_ip) {
+    remote_shadow_host_t *host = find_host(host_ip);
+    if (host) {
+        strlcpy(host->host, host_name, sizeof(host->host));
+        return host;
+    }
+
+    remote_shadow_host_t *lru = &hosts[0];
+    for (int i = 0; i < REMOTE_SHADOW_HOSTS; i++) {
+        if (hosts[i].host_ip[0] && strcmp(hosts[i].host, host_name) == 0) {
+            lru = &hosts[i];
+            break;
+        }
+        if (!hosts[i].host_ip[0]) {
+            lru = &hosts[i];
+        }
+        else if (lru->host_ip[0] && (int32_t)(hosts[i].last_used - lru->last_used) < 0) {
+            lru = &hosts[i];
+        }
+    }
+    if (lru->host_ip[0]) {
+        ESP_LOGI(TAG, "%s (%s) replaces %s (%s)", host_name, host_ip, lru->host, lru->host_ip);
+    }
+    free_host(lru);
+    strlcpy(lru->host, host_name, sizeof(lru->host));
+    strlcpy(lru->host_ip, host_ip, sizeof(lru->host_ip));
+    lru->next_connect = xTaskGetTickCount();
+    lru->retry_ms = REMOTE_SHADOW_RETRY_MS;
+    return lru;
+}
+
+esp_err_t remote_shadow_subscribe(const char *host_name, const char *host_ip, const struct http_hap_id *ids, int num_ids) {
+    if (!shadow_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = get_host(host_name, host_ip);
+    host->last_used = xTaskGetTickCount();
+
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < num_ids; i++) {
+        if (find_char(host, ids[i].aid, ids[i].iid)) {
+            continue;
+        }
+        if (host->num_chars == REMOTE_SHADOW_IDS) {
+            ESP_LOGW(TAG, "more than %d aid.iid on %s", REMOTE_SHADOW_IDS, host_ip);
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        remote_shadow_char_t *c = &host->chars[host->num_chars++];
+        memset(c, 0, sizeof(*c));
+        c->aid = ids[i].aid;
+        c->iid = ids[i].iid;
+    }
+    xSemaphoreGive(shadow_mutex);
+    return err;
+}
+
+void remote_shadow_forget(const char *host_ip) {
+    if (!shadow_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = find_host(host_ip);
+    if (host) {
+        free_host(host);
+    }
+    xSemaphoreGive(shadow_mutex);
+}
+
+bool remote_shadow_get_values(const char *host_ip, const struct http_hap_id *ids, int num_ids, int *values) {
+    if (!shadow_mutex) {
+        return false;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = find_host(host_ip);
+    bool hit = host && host->live;
+    for (int i = 0; hit && i < num_ids; i++) {
+        remote_shadow_char_t *c = find_char(host, ids[i].aid, ids[i].iid);
+        hit = c && c->has_value;
+        if (hit) {
+            values[i] = c->value;
+        }
+    }
+    if (hit) {
+        shadow_hits++;
+    }
+    else {
+        shadow_misses++;
+    }
+    xSemaphoreGive(shadow_mutex);
+    return hit;
+}
+
+void remote_shadow_set(const char *host_ip, const struct http_hap_id *id, int value) {
+    if (!shadow_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = find_host(host_ip);
+    remote_shadow_char_t *c = host ? find_char(host, id->aid, id->iid) : NULL;
+    if (c) {
+        c->value = value;
+        c->has_value = true;
+    }
+    xSemaphoreGive(shadow_mutex);
+}
+
+void remote_shadow_invalidate(const char *host_ip, const struct http_hap_id *id) {
+    if (!shadow_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = find_host(host_ip);
+    remote_shadow_char_t *c = host ? find_char(host, id->aid, id->iid) : NULL;
+    if (c) {
+        c->has_value = false;
+    }
+    xSemaphoreGive(shadow_mutex);
+}
+
+void remote_shadow_update(const char *host_ip, const hap_response_t *response) {
+    if (!shadow_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(shadow_mutex, portMAX_DELAY);
+    remote_shadow_host_t *host = find_host(host_ip);
+    if (host) {
+        update_chars(host, response);
+    }
+    xSemaphoreGive(shadow_mutex);
+}
+
+void remote_shadow_get_stats(uint32_t *hits, uint32_t *misses, uint32_t *events) {
+    *hits = shadow_hits;
+    *misses = shadow_misses;
+    *events = shadow_events;
+}
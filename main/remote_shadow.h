@@ -0,0 +1,51 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "esp_err.h"
+#include "hap_response.h"
+#include "http_parser.h"
+
+#define REMOTE_SHADOW_HOSTS         4               // remote hosts with an event subscription
+#define REMOTE_SHADOW_KEEP_SOCKETS  2               // connect only while this many remote sockets stay free for http_pool
+#define REMOTE_SHADOW_IDS           8               // aid.iid subscribed per host
+#define REMOTE_SHADOW_PORT          5556
+#define REMOTE_SHADOW_RECONCILE_MS  60000           // re-read all values on the event connection this often
+#define REMOTE_SHADOW_RETRY_MS      5000            // reconnect interval, doubled up to RECONCILE_MS
+#define REMOTE_SHADOW_CONNECT_MS    5000            // give up on a connect that has not completed
+
+// Create the shadow tables and start the task that holds the event connections.
+//   Each connection takes a socket from socket_budget; without one the host
+//   is retried later and its presses GET first
+esp_err_t remote_shadow_init(void);
+
+// Ask for EVENT notifications of ids on host_name, now at host_ip. Ids
+//   already subscribed are skipped, so this can be called on every button
+//   press. A host that moved to a new address gets a new subscription there;
+//   with all REMOTE_SHADOW_HOSTS taken, the least recently used one is dropped
+esp_err_t remote_shadow_subscribe(const char *host_name, const char *host_ip, const struct http_hap_id *ids, int num_ids);
+
+// Drop host_ip and its event connection, e.g. when its address is no longer trusted
+void remote_shadow_forget(const char *host_ip);
+
+// Current values of ids (bools as 0/1), one per id. false unless the host's
+//   event connection is up and every id has a value
+bool remote_shadow_get_values(const char *host_ip, const struct http_hap_id *ids, int num_ids, int *values);
+
+// Record a value written to host_ip, in case the next press comes before its EVENT
+void remote_shadow_set(const char *host_ip, const struct http_hap_id *id, int value);
+
+// Forget the value of id on host_ip, e.g. while a write to it is in flight or
+//   after one failed, so the next press reads it back
+void remote_shadow_invalidate(const char *host_ip, const struct http_hap_id *id);
+
+// Merge a {"characteristics":[...]} GET response from host_ip
+void remote_shadow_update(const char *host_ip, const hap_response_t *response);
+
+void remote_shadow_get_stats(uint32_t *hits, uint32_t *misses, uint32_t *events);
+
+#ifdef __cplusplus
+}
+#endif
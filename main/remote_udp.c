@@ -0,0 +1,565 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+#include <stdio.h>
+#include <string.h>
+
+#include "lwip/sockets.h"
+#include "mbedtls/md.h"
+#include "nvs.h"
+#include "mdns.h"
+#include "esp_system.h"                         // esp_read_mac for the sender id
+
+#include "remote_udp.h"
+
+#include "esp_log.h"
+static const char *TAG = "remote_udp";
+
+// header: magic (2) version (1) type (1) sender (4) seq (4), all integers big-endian
+//   command:  header action (1) brightness (1) num_ids (1) {aid (4) iid (4)}... mac
+//   ack:      header status (1) num_ids (1) {kind (1) value (4)}... mac
+// An ack repeats the sender and seq of the command it answers. A STALE ack
+//   has one value, the lowest seq the receiver accepts from that sender
+#define MAGIC_0         'M'
+#define MAGIC_1         'L'
+#define TYPE_COMMAND    1
+#define TYPE_ACK        2
+#define STATUS_OK       0
+#define STATUS_REJECTED 1
+#define STATUS_STALE    2
+#define HEADER_SIZE     12
+#define COMMAND_MAX     (HEADER_SIZE + 3 + REMOTE_UDP_MAX_IDS * 8 + REMOTE_UDP_MAC_SIZE)
+#define ACK_MAX         (HEADER_SIZE + 2 + REMOTE_UDP_MAX_IDS * 5 + REMOTE_UDP_MAC_SIZE)
+#define IDLE_MS         100                     // select() timeout with nothing to retransmit
+#define ADVERTISE_MS    30000                   // re-add the mDNS service in case it was dropped
+#define VERSION_TXT_(v) #v
+#define VERSION_TXT(v)  VERSION_TXT_(v)
+
+typedef struct {
+    bool used;
+    uint32_t sender;
+    uint32_t next_seq;                          // lowest seq accepted from now on
+    uint32_t saved_seq;                         // kept in NVS, next_seq stays at or below it
+    TickType_t last_seen;
+    uint32_t addr;                              // where last_seq came from
+    uint32_t last_seq;
+    uint8_t ack[ACK_MAX];                       // answer to last_seq, resent for a duplicate
+    uint8_t ack_len;                            // 0 until one is sent
+} remote_udp_peer_t;
+
+static uint8_t udp_key[64];
+static size_t udp_key_len;
+static int udp_sock = -1;
+static SemaphoreHandle_t udp_mutex = NULL;
+static remote_udp_apply_cb apply_cb;
+static uint32_t sender_id;                      // ours, from the station MAC
+static remote_udp_req_t *pending;               // waiting for an ack, in send order
+static uint32_t next_seq;
+static uint32_t seq_limit;                      // next_seq must stay below this, reserved in NVS
+static remote_udp_peer_t peers[REMOTE_UDP_PEERS];
+
+static uint32_t udp_sent;
+static uint32_t udp_retransmits;
+static uint32_t udp_received;
+static uint32_t udp_rejected;
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint8_t *put_header(uint8_t *p, uint8_t type, uint32_t sender, uint32_t seq) {
+    *p++ = MAGIC_0;
+    *p++ = MAGIC_1;
+    *p++ = REMOTE_UDP_VERSION;
+    *p++ = type;
+    p = put_u32(p, sender);
+    return put_u32(p, seq);
+}
+
+static void compute_mac(const uint8_t *data, size_t len, uint8_t *mac) {
+    uint8_t full[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), udp_key, udp_key_len, data, len, full);
+    memcpy(mac, full, REMOTE_UDP_MAC_SIZE);
+}
+
+// The mac is the last REMOTE_UDP_MAC_SIZE bytes of packet
+static bool mac_valid(const uint8_t *packet, size_t len) {
+    uint8_t mac[REMOTE_UDP_MAC_SIZE];
+    uint8_t diff = 0;
+
+    compute_mac(packet, len - REMOTE_UDP_MAC_SIZE, mac);
+    // constant time, so the mac cannot be guessed byte by byte
+    for (int i = 0; i < REMOTE_UDP_MAC_SIZE; i++) {
+        diff |= mac[i] ^ packet[len - REMOTE_UDP_MAC_SIZE + i];
+    }
+    return diff == 0;
+}
+
+// Reserve the next block of sequence numbers, so after a restart this switch
+//   never sends a number a receiver has seen before
+// take udp_mutex before calling
+static esp_err_t reserve_seq(void) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open("remote_udp", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u32(handle, "seq", seq_limit + REMOTE_UDP_SEQ_BLOCK);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err == ESP_OK) {
+        seq_limit += REMOTE_UDP_SEQ_BLOCK;
+    }
+    return err;
+}
+
+// A receiver told us it has seen sequence numbers up to floor: continue from
+//   there, in a block reserved for it
+// take udp_mutex before calling
+static esp_err_t skip_seq(uint32_t floor) {
+    if (floor <= next_seq) {
+        return ESP_OK;
+    }
+    next_seq = floor;
+    if (next_seq >= seq_limit) {
+        seq_limit = next_seq - next_seq % REMOTE_UDP_SEQ_BLOCK;
+        return reserve_seq();
+    }
+    return ESP_OK;
+}
+
+// take udp_mutex before calling
+static void transmit(remote_udp_req_t *req) {
+    uint8_t packet[COMMAND_MAX];
+    uint8_t *p = put_header(packet, TYPE_COMMAND, sender_id, req->seq);
+
+    *p++ = req->action;
+    *p++ = MIN(100, MAX(0, req->brightness));
+    *p++ = req->num_ids;
+    for (int i = 0; i < req->num_ids; i++) {
+        p = put_u32(p, req->ids[i].aid);
+        p = put_u32(p, req->ids[i].iid);
+    }
+    compute_mac(packet, p - packet, p);
+    p += REMOTE_UDP_MAC_SIZE;
+
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(req->port),
+        .sin_addr.s_addr = req->addr,
+    };
+    sendto(udp_sock, packet, p - packet, 0, (struct sockaddr *) &to, sizeof(to));
+
+    req->tries++;
+    req->next_tx = xTaskGetTickCount() + pdMS_TO_TICKS(REMOTE_UDP_RTO_MS << (req->tries - 1));
+}
+
+// Save a high-water mark ahead of seq, in whole blocks like the sender
+//   reserves them, so NVS is written once every REMOTE_UDP_SEQ_BLOCK commands
+// take udp_mutex before calling
+static esp_err_t save_peer(remote_udp_peer_t *peer, uint32_t seq) {
+    uint32_t saved_seq = seq - seq % REMOTE_UDP_SEQ_BLOCK + REMOTE_UDP_SEQ_BLOCK;
+    char key[10];                               // p<sender in hex>
+    nvs_handle handle;
+
+    snprintf(key, sizeof(key), "p%08x", (unsigned) peer->sender);
+    esp_err_t err = nvs_open("remote_udp", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u32(handle, key, saved_seq);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err == ESP_OK) {
+        peer->saved_seq = saved_seq;
+    }
+    return err;
+}
+
+// The peer for sender, loaded from NVS in place of the least recently seen
+//   one if it is not in RAM. Every seq below its saved mark may have been
+//   used, so they are all refused. NULL if NVS could not be read
+// take udp_mutex before calling
+static remote_udp_peer_t *get_peer(uint32_t sender) {
+    remote_udp_peer_t *lru = &peers[0];
+
+    for (int i = 0; i < REMOTE_UDP_PEERS; i++) {
+        if (peers[i].used && peers[i].sender == sender) {
+            return &peers[i];
+        }
+        if (!peers[i].used) {
+            lru = &peers[i];
+        }
+        else if (lru->used && (int32_t)(peers[i].last_seen - lru->last_seen) < 0) {
+            lru = &peers[i];
+        }
+    }
+
+    uint32_t saved_seq = 0;
+    char key[10];
+    nvs_handle handle;
+
+    snprintf(key, sizeof(key), "p%08x", (unsigned) sender);
+    esp_err_t err = nvs_open("remote_udp", NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        err = nvs_get_u32(handle, key, &saved_seq);
+        nvs_close(handle);
+    }
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "error reading seq of sender %08x", (unsigned) sender);
+        return NULL;
+    }
+
+    memset(lru, 0, sizeof(*lru));
+    lru->used = true;
+    lru->sender = sender;
+    lru->next_seq = saved_seq;
+    lru->saved_seq = saved_seq;
+    return lru;
+}
+
+// Tell the sender of a command the lowest seq we accept from it
+// take udp_mutex before calling
+static void send_stale(const remote_udp_peer_t *peer, uint32_t seq, const struct sockaddr_in *from) {
+    uint8_t ack[ACK_MAX];
+    uint8_t *p = put_header(ack, TYPE_ACK, peer->sender, seq);
+
+    *p++ = STATUS_STALE;
+    *p++ = 1;
+    *p++ = 0;
+    p = put_u32(p, peer->next_seq);
+    compute_mac(ack, p - ack, p);
+    p += REMOTE_UDP_MAC_SIZE;
+    sendto(udp_sock, ack, p - ack, 0, (const struct sockaddr *) from, sizeof(*from));
+}
+
+static void handle_command(const uint8_t *packet, size_t len, const struct sockaddr_in *from) {
+    uint32_t sender = get_u32(packet + 4);
+    uint32_t seq = get_u32(packet + 8);
+    int num_ids = packet[HEADER_SIZE + 2];
+
+    if (num_ids < 1 || num_ids > REMOTE_UDP_MAX_IDS || len != HEADER_SIZE + 3 + num_ids * 8 + REMOTE_UDP_MAC_SIZE ||
+        !mac_valid(packet, len)) {
+        udp_rejected++;
+        return;
+    }
+
+    xSemaphoreTake(udp_mutex, portMAX_DELAY);
+    remote_udp_peer_t *peer = get_peer(sender);
+    if (!peer) {
+        udp_rejected++;
+        xSemaphoreGive(udp_mutex);
+        return;
+    }
+    peer->last_seen = xTaskGetTickCount();
+
+    if (peer->ack_len && seq == peer->last_seq && from->sin_addr.s_addr == peer->addr) {
+        // our ack was lost and the command retransmitted: answer again, but
+        //   do not apply it twice (a toggle would undo itself)
+        sendto(udp_sock, peer->ack, peer->ack_len, 0, (const struct sockaddr *) from, sizeof(*from));
+        xSemaphoreGive(udp_mutex);
+        return;
+    }
+    if (seq < peer->next_seq) {
+        // already used by this sender, from whatever address: a replay, or
+        //   the sender lost track of its numbers. Only it can use the answer
+        udp_rejected++;
+        send_stale(peer, seq, from);
+        xSemaphoreGive(udp_mutex);
+        return;
+    }
+    // the mark must be saved before the command can take effect
+    if (seq >= peer->saved_seq && save_peer(peer, seq) != ESP_OK) {
+        ESP_LOGE(TAG, "error saving seq of sender %08x", (unsigned) sender);
+        udp_rejected++;
+        xSemaphoreGive(udp_mutex);
+        return;
+    }
+    peer->next_seq = seq + 1;
+    peer->addr = from->sin_addr.s_addr;
+    peer->last_seq = seq;
+    peer->ack_len = 0;
+    xSemaphoreGive(udp_mutex);
+
+    struct http_hap_id ids[REMOTE_UDP_MAX_IDS];
+    uint8_t kinds[REMOTE_UDP_MAX_IDS] = {0};
+    int values[REMOTE_UDP_MAX_IDS] = {0};
+    for (int i = 0; i < num_ids; i++) {
+        ids[i].aid = get_u32(packet + HEADER_SIZE + 3 + i * 8);
+        ids[i].iid = get_u32(packet + HEADER_SIZE + 3 + i * 8 + 4);
+    }
+    int status = apply_cb ? apply_cb(packet[HEADER_SIZE], packet[HEADER_SIZE + 1], ids, num_ids, kinds, values) : -1;
+    udp_received++;
+
+    xSemaphoreTake(udp_mutex, portMAX_DELAY);
+    uint8_t *p = put_header(peer->ack, TYPE_ACK, sender, seq);
+    *p++ = status ? STATUS_REJECTED : STATUS_OK;
+    *p++ = num_ids;
+    for (int i = 0; i < num_ids; i++) {
+        *p++ = kinds[i];
+        p = put_u32(p, values[i]);
+    }
+    compute_mac(peer->ack, p - peer->ack, p);
+    p += REMOTE_UDP_MAC_SIZE;
+    peer->ack_len = p - peer->ack;
+    sendto(udp_sock, peer->ack, peer->ack_len, 0, (const struct sockaddr *) from, sizeof(*from));
+    xSemaphoreGive(udp_mutex);
+}
+
+static void handle_ack(const uint8_t *packet, size_t len, const struct sockaddr_in *from) {
+    uint32_t sender = get_u32(packet + 4);
+    uint32_t seq = get_u32(packet + 8);
+    int num_ids = packet[HEADER_SIZE + 1];
+
+    if (num_ids > REMOTE_UDP_MAX_IDS || len != HEADER_SIZE + 2 + num_ids * 5 + REMOTE_UDP_MAC_SIZE ||
+        !mac_valid(packet, len)) {
+        udp_rejected++;
+        return;
+    }
+    // an answer to another switch
+    if (sender != sender_id) {
+        return;
+    }
+
+    xSemaphoreTake(udp_mutex, portMAX_DELAY);
+    remote_udp_req_t **link = &pending;
+    while (*link && ((*link)->seq != seq || (*link)->addr != from->sin_addr.s_addr)) {
+        link = &(*link)->next;
+    }
+    remote_udp_req_t *req = *link;
+
+    // the receiver has seen this seq before (it kept its mark through a
+    //   reboot we did not, or we lost ours): send again from its floor. The
+    //   task gives up on it after REMOTE_UDP_TRIES as usual
+    if (req && packet[HEADER_SIZE] == STATUS_STALE && num_ids == 1) {
+        uint32_t floor = get_u32(packet + HEADER_SIZE + 3);
+        if (req->tries < REMOTE_UDP_TRIES && skip_seq(floor) == ESP_OK) {
+            ESP_LOGW(TAG, "seq %u stale, sending again as %u", (unsigned) seq, (unsigned) next_seq);
+            req->seq = next_seq++;
+            transmit(req);
+            udp_retransmits++;
+        }
+        xSemaphoreGive(udp_mutex);
+        return;
+    }
+    if (req) {
+        *link = req->next;
+    }
+    xSemaphoreGive(udp_mutex);
+
+    // a late ack for a retransmission that was already answered
+    if (!req) {
+        return;
+    }
+
+    esp_err_t err = ESP_ERR_INVALID_RESPONSE;
+    if (packet[HEADER_SIZE] == STATUS_OK && num_ids == req->num_ids) {
+        for (int i = 0; i < num_ids; i++) {
+            req->kinds[i] = packet[HEADER_SIZE + 2 + i * 5];
+            req->values[i] = (int32_t) get_u32(packet + HEADER_SIZE + 2 + i * 5 + 1);
+        }
+        err = ESP_OK;
+    }
+    req->rtt_ms = MAX((xTaskGetTickCount() - req->sent) * portTICK_PERIOD_MS, portTICK_PERIOD_MS);
+    if (req->on_done) {
+        req->on_done(req, err);
+    }
+}
+
+// Let the other switches find this one (only if it has lights to control)
+static void advertise(void) {
+    mdns_txt_item_t txt[] = {
+        { (char *) "v", (char *) VERSION_TXT(REMOTE_UDP_VERSION) },
+    };
+    // fails with ESP_ERR_INVALID_ARG while it is still registered, and
+    //   ESP_ERR_INVALID_STATE until mdns has been started
+    esp_err_t err = mdns_service_add(NULL, REMOTE_UDP_SERVICE, "_udp", REMOTE_UDP_PORT, txt, 1);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "advertising %s._udp", REMOTE_UDP_SERVICE);
+    }
+}
+
+// Retransmit unacknowledged commands and give up on them after
+//   REMOTE_UDP_TRIES, and answer commands from other switches
+static void remote_udp_task(void *arg) {
+    uint8_t packet[MAX(COMMAND_MAX, ACK_MAX)];
+    TickType_t last_advertise = xTaskGetTickCount() - pdMS_TO_TICKS(ADVERTISE_MS);
+
+    while (1) {
+        if (apply_cb && (xTaskGetTickCount() - last_advertise) * portTICK_PERIOD_MS >= ADVERTISE_MS) {
+            advertise();
+            last_advertise = xTaskGetTickCount();
+        }
+
+        remote_udp_req_t *expired = NULL;
+        uint32_t timeout_ms = IDLE_MS;
+        TickType_t now = xTaskGetTickCount();
+
+        xSemaphoreTake(udp_mutex, portMAX_DELAY);
+        remote_udp_req_t **link = &pending;
+        while (*link) {
+            remote_udp_req_t *req = *link;
+            if ((int32_t)(req->next_tx - now) <= 0) {
+                if (req->tries >= REMOTE_UDP_TRIES) {
+                    *link = req->next;
+                    req->next = expired;
+                    expired = req;
+                    continue;
+                }
+                transmit(req);
+                udp_retransmits++;
+            }
+            timeout_ms = MIN(timeout_ms, (req->next_tx - now) * portTICK_PERIOD_MS);
+            link = &req->next;
+        }
+        xSemaphoreGive(udp_mutex);
+
+        while (expired) {
+            remote_udp_req_t *req = expired;
+            expired = req->next;
+            ESP_LOGW(TAG, "no ack for seq %u after %d tries", (unsigned) req->seq, req->tries);
+            if (req->on_done) {
+                req->on_done(req, ESP_ERR_TIMEOUT);
+            }
+        }
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(udp_sock, &read_fds);
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = MAX(timeout_ms, 1) * 1000 };
+        if (select(udp_sock + 1, &read_fds, NULL, NULL, &timeout) <= 0) {
+            continue;
+        }
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(udp_sock, packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+        if (len < HEADER_SIZE + 2 + REMOTE_UDP_MAC_SIZE || packet[0] != MAGIC_0 || packet[1] != MAGIC_1 ||
+            packet[2] != REMOTE_UDP_VERSION) {
+            continue;
+        }
+        if (packet[3] == TYPE_COMMAND) {
+            handle_command(packet, len, &from);
+        }
+        else if (packet[3] == TYPE_ACK) {
+            handle_ack(packet, len, &from);
+        }
+    }
+}
+
+esp_err_t remote_udp_init(const char *key, remote_udp_apply_cb apply) {
+    if (udp_mutex) {
+        return ESP_OK;
+    }
+    if (!key || !key[0]) {
+        ESP_LOGI(TAG, "no key, fast path off");
+        return ESP_ERR_INVALID_ARG;
+    }
+    udp_key_len = MIN(strlen(key), sizeof(udp_key));
+    memcpy(udp_key, key, udp_key_len);
+    apply_cb = apply;
+
+    // what receivers key their replay checks on, the same after every boot
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    sender_id = get_u32(mac + 2);
+
+    nvs_handle handle;
+    if (nvs_open("remote_udp", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, "seq", &seq_limit);
+        nvs_close(handle);
+    }
+    next_seq = seq_limit;
+    if (reserve_seq() != ESP_OK) {
+        ESP_LOGE(TAG, "error reserving sequence numbers");
+        return ESP_FAIL;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(REMOTE_UDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_sock < 0 || bind(udp_sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "error binding port %d", REMOTE_UDP_PORT);
+        return ESP_FAIL;
+    }
+
+    udp_mutex = xSemaphoreCreateMutex();
+    if (!udp_mutex) {
+        ESP_LOGE(TAG, "error creating mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(&remote_udp_task, "remote_udp", 3072, NULL, tskIDLE_PRIORITY + 3, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating task");
+        vSemaphoreDelete(udp_mutex);
+        udp_mutex = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool remote_udp_enabled(void) {
+    return udp_mutex != NULL;
+}
+
+esp_err_t remote_udp_submit(const char *host_ip, uint16_t port, remote_udp_req_t *req) {
+    struct in_addr addr;
+
+    if (!udp_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (req->num_ids < 1 || req->num_ids > REMOTE_UDP_MAX_IDS || inet_aton(host_ip, &addr) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(udp_mutex, portMAX_DELAY);
+    if (next_seq >= seq_limit && reserve_seq() != ESP_OK) {
+        xSemaphoreGive(udp_mutex);
+        ESP_LOGE(TAG, "error reserving sequence numbers");
+        return ESP_FAIL;
+    }
+    req->addr = addr.s_addr;
+    req->port = port;
+    req->seq = next_seq++;
+    req->tries = 0;
+    req->sent = xTaskGetTickCount();
+
+    // the first transmission goes out now, the task retransmits
+    transmit(req);
+    udp_sent++;
+
+    req->next = NULL;
+    remote_udp_req_t **link = &pending;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = req;
+    xSemaphoreGive(udp_mutex);
+    return ESP_OK;
+}
+
+void remote_udp_get_stats(uint32_t *sent, uint32_t *retransmits, uint32_t *received, uint32_t *rejected) {
+    *sent = udp_sent;
+    *retransmits = udp_retransmits;
+    *received = udp_received;
+    *rejected = udp_rejected;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "http_parser.h"                        // struct http_hap_id
+
+#define REMOTE_UDP_PORT         5557
+#define REMOTE_UDP_SERVICE      "_mylights"     // advertised as _mylights._udp, TXT v=REMOTE_UDP_VERSION
+#define REMOTE_UDP_VERSION      2
+#define REMOTE_UDP_MAX_IDS      4
+#define REMOTE_UDP_MAC_SIZE     8               // truncated HMAC-SHA256
+#define REMOTE_UDP_RTO_MS       50              // first retransmit, doubled for each one after
+#define REMOTE_UDP_TRIES        4               // transmissions before giving up
+#define REMOTE_UDP_PEERS        8               // senders kept in RAM for duplicate checks, all of them in NVS
+#define REMOTE_UDP_SEQ_BLOCK    256             // sequence numbers reserved in NVS at a time
+
+// A compact binary command protocol between our own switches. A command is
+//   one datagram carrying the action and the aid.iid list; the receiver
+//   applies it to its own characteristics and answers with their kinds and
+//   new values. Both are authenticated with a shared key. A command carries
+//   the sender's id and a sequence number that only ever grows; receivers
+//   keep a high-water mark per sender id in NVS, so a replay is dropped
+//   whatever address it comes from, and after a reboot too.
+
+typedef enum {
+    REMOTE_UDP_READ,                            // change nothing, only report the values
+    REMOTE_UDP_TOGGLE,
+    REMOTE_UDP_FULL_ON,
+    REMOTE_UDP_SET_BRIGHTNESS,
+    REMOTE_UDP_OFF,                             // leaves the brightness as it is
+} remote_udp_action_t;
+
+// Apply a command received from another switch to ids, and fill kinds
+//   (remote_kind_t) and values (bools as 0/1) for each. Return 0, or non-zero
+//   to reject it (e.g. an unknown id). Runs in the remote_udp task
+typedef int (*remote_udp_apply_cb)(remote_udp_action_t action, int brightness,
+                                   const struct http_hap_id *ids, int num_ids, uint8_t *kinds, int *values);
+
+typedef struct remote_udp_req remote_udp_req_t;
+
+// err is ESP_OK and kinds/values are set, ESP_ERR_TIMEOUT if no
+//   acknowledgement came back, or ESP_ERR_INVALID_RESPONSE if the receiver
+//   rejected the command. Runs in the remote_udp task
+typedef void (*remote_udp_done_cb)(remote_udp_req_t *req, esp_err_t err);
+
+// Owned by the caller, which must keep it valid until on_done is called
+struct remote_udp_req {
+    remote_udp_action_t action;
+    int brightness;                             // for SET_BRIGHTNESS
+    struct http_hap_id ids[REMOTE_UDP_MAX_IDS];
+    int num_ids;
+    remote_udp_done_cb on_done;
+    void *ctx;
+
+    // set from the acknowledgement
+    uint8_t kinds[REMOTE_UDP_MAX_IDS];
+    int values[REMOTE_UDP_MAX_IDS];
+    uint32_t rtt_ms;
+
+    // private
+    struct remote_udp_req *next;
+    uint32_t addr;
+    uint16_t port;
+    uint32_t seq;
+    int tries;
+    TickType_t sent;                            // first transmission
+    TickType_t next_tx;
+};
+
+// Start the task that sends, receives and advertises. key is the shared
+//   secret; without one (NULL or empty) the fast path stays off.
+//   apply handles commands from other switches, NULL if there are no lights here
+esp_err_t remote_udp_init(const char *key, remote_udp_apply_cb apply);
+
+// Whether remote_udp_init() succeeded, so commands can be sent
+bool remote_udp_enabled(void);
+
+// Send req to host_ip:port now and retransmit it until it is acknowledged
+esp_err_t remote_udp_submit(const char *host_ip, uint16_t port, remote_udp_req_t *req);
+
+void remote_udp_get_stats(uint32_t *sent, uint32_t *retransmits, uint32_t *received, uint32_t *rejected);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+#include <sys/param.h>                          // min max functions
+#include <string.h>
+
+#include "scenes.h"
+
+#include "esp_log.h"
+static const char *TAG = "scenes";
+
+// read once at boot, like the rest of the lights config
+static scene_t scenes[SCENE_MAX];
+static int num_scenes;
+static scene_apply_cb apply_cb;
+
+esp_err_t scenes_init(nvs_handle handle, scene_apply_cb apply) {
+    apply_cb = apply;
+    num_scenes = 0;
+
+    size_t size = sizeof(scenes);
+    esp_err_t err = nvs_get_blob(handle, "scenes", scenes, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK || size % sizeof(scene_t) != 0) {
+        ESP_LOGE(TAG, "nvs_get_blob scenes size %d err %d", size, err);
+        return err != ESP_OK ? err : ESP_ERR_INVALID_SIZE;
+    }
+
+    num_scenes = size / sizeof(scene_t);
+    for (int i = 0; i < num_scenes; i++) {
+        scenes[i].name[SCENE_NAME_SIZE - 1] = '\0';
+        scenes[i].num_targets = MIN(scenes[i].num_targets, SCENE_MAX_TARGETS);
+        ESP_LOGI(TAG, "scene %s: %d lights, button %d", scenes[i].name, scenes[i].num_targets, scenes[i].button);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t apply(const scene_t *scene) {
+    ESP_LOGI(TAG, "applying %s", scene->name);
+    if (apply_cb) {
+        apply_cb(scene);
+    }
+    return ESP_OK;
+}
+
+esp_err_t scenes_apply(const char *name) {
+    for (int i = 0; i < num_scenes; i++) {
+        if (strcmp(scenes[i].name, name) == 0) {
+            return apply(&scenes[i]);
+        }
+    }
+    ESP_LOGW(TAG, "no scene %s", name);
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t scenes_apply_button(uint8_t light) {
+    for (int i = 0; i < num_scenes; i++) {
+        if (scenes[i].button == light) {
+            return apply(&scenes[i]);
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "nvs.h"
+#include "lights.h"                             // scene_t, as stored in NVS
+
+// Named sets of light states, kept in NVS and applied all at once
+
+// Set every light in scene, in one pass. Runs in the task that triggered it
+typedef void (*scene_apply_cb)(const scene_t *scene);
+
+// Load the "scenes" blob from handle. No scenes is not an error
+esp_err_t scenes_init(nvs_handle handle, scene_apply_cb apply);
+
+// Apply the scene called name. ESP_ERR_NOT_FOUND if there is none
+esp_err_t scenes_apply(const char *name);
+
+// Apply the scene for a triple press of light's button
+esp_err_t scenes_apply_button(uint8_t light);
+
+#ifdef __cplusplus
+}
+#endif
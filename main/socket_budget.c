@@ -0,0 +1,69 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <sys/param.h>                          // min max functions
+
+#include "socket_budget.h"
+
+#include "esp_log.h"
+static const char *TAG = "socket_budget";
+
+static SemaphoreHandle_t budget_mutex = NULL;
+static int budget;
+static int in_use;
+static int in_use_max;
+
+esp_err_t socket_budget_init(int sockets) {
+    if (budget_mutex) {
+        return ESP_OK;
+    }
+
+    budget_mutex = xSemaphoreCreateMutex();
+    if (!budget_mutex) {
+        ESP_LOGE(TAG, "error creating mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    budget = sockets;
+    return ESP_OK;
+}
+
+bool socket_budget_take(int keep) {
+    bool taken = false;
+    if (!budget_mutex) {
+        return false;
+    }
+
+    xSemaphoreTake(budget_mutex, portMAX_DELAY);
+    if (budget - in_use > keep) {
+        in_use++;
+        in_use_max = MAX(in_use_max, in_use);
+        taken = true;
+    }
+    xSemaphoreGive(budget_mutex);
+    return taken;
+}
+
+void socket_budget_give(void) {
+    if (!budget_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(budget_mutex, portMAX_DELAY);
+    if (in_use > 0) {
+        in_use--;
+    }
+    xSemaphoreGive(budget_mutex);
+}
+
+void socket_budget_get_stats(int *sockets_in_use, int *sockets_in_use_max) {
+    *sockets_in_use = 0;
+    *sockets_in_use_max = 0;
+    if (!budget_mutex) {
+        return;
+    }
+
+    xSemaphoreTake(budget_mutex, portMAX_DELAY);
+    *sockets_in_use = in_use;
+    *sockets_in_use_max = in_use_max;
+    xSemaphoreGive(budget_mutex);
+}
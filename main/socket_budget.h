@@ -0,0 +1,28 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+// lwip sockets for remote lights, shared by http_pool and remote_shadow. Each
+//   one is taken just before socket() and given back after close(), so only
+//   connections actually open count against the budget
+
+// Set the budget; until this is called nothing can be taken
+esp_err_t socket_budget_init(int sockets);
+
+// Take a socket if more than keep would be left, so a user that can do
+//   without (e.g. event connections) leaves room for one that cannot
+bool socket_budget_take(int keep);
+
+void socket_budget_give(void);
+
+// Sockets taken, and the most ever taken at once
+void socket_budget_get_stats(int *sockets_in_use, int *sockets_in_use_max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+#
+# Writes the brightness (0-100%) to PWM duty tables used by main/dimming_curve.c.
+# Run by main/CMakeLists.txt at build time:
+#
+#   gen_dimming_curves.py <pwm period in us> <output header>
+
+import sys
+
+# same order as dimming_curve_t in main/dimming_curve.h
+CURVES = [
+    # the original curve: 2.2 gamma over 20%..100%, so the lowest steps stay visible
+    ('gamma', lambda b: ((b + 25.0) / 125.0) ** 2.2),
+    # CIE 1931 lightness: brightness is L*, duty is the luminance Y for it
+    ('cie1931', lambda b: b / 903.3 if b <= 8 else ((b + 16.0) / 116.0) ** 3),
+    ('linear', lambda b: b / 100.0),
+]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: gen_dimming_curves.py <pwm period in us> <output header>')
+    period = int(sys.argv[1])
+    if not 0 < period <= 0xffff:
+        sys.exit('pwm period %d does not fit the uint16_t tables' % period)
+
+    lines = [
+        '// Generated by tools/gen_dimming_curves.py, do not edit',
+        '#pragma once',
+        '',
+        '#include <stdint.h>',
+        '',
+        '#define DIMMING_CURVE_PERIOD_US %d' % period,
+        '#define DIMMING_CURVE_TABLES    %d' % len(CURVES),
+        '',
+        '// PWM duty in us for brightness 0..100, one row per curve',
+        'static const uint16_t dimming_curve_tables[DIMMING_CURVE_TABLES][101] = {',
+    ]
+    for name, curve in CURVES:
+        # truncated, as the duty was when it was worked out at run time
+        duties = [min(period, int(curve(b) * period + 1e-9)) for b in range(101)]
+        lines.append('    // %s' % name)
+        lines.append('    {')
+        for i in range(0, len(duties), 12):
+            lines.append('        ' + ' '.join('%4d,' % d for d in duties[i:i + 12]))
+        lines.append('    },')
+    lines.append('};')
+
+    with open(sys.argv[2], 'w') as header:
+        header.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
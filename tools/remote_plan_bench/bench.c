@@ -0,0 +1,249 @@
+/* Host benchmark: one remote press served from the shadow, built from the
+ * compiled remote_plan_t (main/remote_plan.c) and the way main.c built it
+ * before, walking cJSON trees. Reports time and heap allocations per press.
+ *
+ *   make bench && ./bench [iterations]
+ *   make bench CJSON_DIR=$IDF_PATH/components/json/cJSON
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <homekit/characteristics.h>
+
+#include "remote_plan.h"
+#include "cJSON.h"
+
+#define SWITCH_ID_TYPE "02B77067-DA5D-493C-829D-F6C5DCFE5C28"
+
+// rem_cmd_0: a dimmer plus the optional remote switch identifier
+static const char nvs_command[] =
+    "{\"host\":\"lamp\",\"payload\":[{\"aid\":1,\"iid\":9},{\"aid\":1,\"iid\":10},"
+    "{\"aid\":1,\"iid\":12,\"value\":3}]}";
+
+// TOGGLE with the light on: On goes false, Brightness is left alone
+static const char expected[] =
+    "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":false},{\"aid\":1,\"iid\":12,\"value\":3}]}";
+
+// the part of remote_shadow_host_t a press reads and writes
+typedef struct {
+    uint32_t aid;
+    uint32_t iid;
+    char type[40];
+    int value;
+    bool is_bool;
+} shadow_char_t;
+
+static shadow_char_t shadow[REMOTE_PLAN_MAX_IDS];
+static int shadow_chars;
+
+static unsigned long allocations;
+
+size_t bench_strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *counting_malloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+static shadow_char_t *find_char(uint32_t aid, uint32_t iid) {
+    for (int i = 0; i < shadow_chars; i++) {
+        if (shadow[i].aid == aid && shadow[i].iid == iid) {
+            return &shadow[i];
+        }
+    }
+    return NULL;
+}
+
+static void shadow_reset(void) {
+    static const shadow_char_t chars[] = {
+        {1, 9, HOMEKIT_CHARACTERISTIC_ON, 1, true},
+        {1, 10, HOMEKIT_CHARACTERISTIC_BRIGHTNESS, 75, false},
+        {1, 12, SWITCH_ID_TYPE, 3, false},
+    };
+    memcpy(shadow, chars, sizeof(chars));
+    shadow_chars = sizeof(chars) / sizeof(chars[0]);
+}
+
+/* Before remote_plan_t: the NVS command was kept as a cJSON tree, and each
+ * press turned the shadow into a GET-like response tree, walked it to
+ * build the command tree, printed that and fed it back to the shadow */
+
+static cJSON *nvs_root;
+
+static cJSON *cjson_shadow_get(const struct http_hap_id *ids, int num_ids) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *characteristics_json = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "characteristics", characteristics_json);
+    for (int i = 0; i < num_ids; i++) {
+        shadow_char_t *c = find_char(ids[i].aid, ids[i].iid);
+        cJSON *fld;
+        cJSON_AddItemToArray(characteristics_json, fld = cJSON_CreateObject());
+        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(c->aid));
+        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(c->iid));
+        cJSON_AddItemToObject(fld, "type", cJSON_CreateString(c->type));
+        cJSON_AddItemToObject(fld, "value", c->is_bool ? cJSON_CreateBool(c->value) : cJSON_CreateNumber(c->value));
+    }
+    return root;
+}
+
+static void cjson_shadow_update(const cJSON *root) {
+    cJSON *characteristics_json = cJSON_GetObjectItem(root, "characteristics");
+    cJSON *item;
+    cJSON_ArrayForEach(item, characteristics_json) {
+        cJSON *aid_key = cJSON_GetObjectItem(item, "aid");
+        cJSON *iid_key = cJSON_GetObjectItem(item, "iid");
+        shadow_char_t *c = find_char(aid_key->valueint, iid_key->valueint);
+        cJSON *value_key = cJSON_GetObjectItem(item, "value");
+        if (cJSON_IsBool(value_key)) {
+            c->value = cJSON_IsTrue(value_key) ? 1 : 0;
+        }
+        else if (cJSON_IsNumber(value_key)) {
+            c->value = value_key->valueint;
+        }
+    }
+}
+
+static size_t press_cjson(char *buf, size_t size) {
+    cJSON *payload_json = cJSON_GetObjectItem(nvs_root, "payload");
+
+    struct http_hap_id ids[REMOTE_PLAN_MAX_IDS];
+    int num_ids = 0;
+    cJSON *payload_item;
+    cJSON_ArrayForEach(payload_item, payload_json) {
+        ids[num_ids].aid = cJSON_GetObjectItem(payload_item, "aid")->valueint;
+        ids[num_ids].iid = cJSON_GetObjectItem(payload_item, "iid")->valueint;
+        num_ids++;
+    }
+    char aid_iid[HTTP_HAP_IDS_SIZE(REMOTE_PLAN_MAX_IDS)];
+    http_format_hap_ids(aid_iid, sizeof(aid_iid), ids, num_ids);
+
+    cJSON *root_resp = cjson_shadow_get(ids, num_ids);
+    cJSON *characteristics_json = cJSON_GetObjectItem(root_resp, "characteristics");
+
+    cJSON *root_cmd = cJSON_CreateObject();
+    cJSON *characteristics_cmd_json = cJSON_CreateArray();
+    cJSON_AddItemToObject(root_cmd, "characteristics", characteristics_cmd_json);
+
+    cJSON *characteristics_item;
+    cJSON_ArrayForEach(characteristics_item, characteristics_json) {
+        cJSON *aid_key = cJSON_GetObjectItem(characteristics_item, "aid");
+        cJSON *iid_key = cJSON_GetObjectItem(characteristics_item, "iid");
+        cJSON *type_key = cJSON_GetObjectItem(characteristics_item, "type");
+        cJSON *value_key = cJSON_GetObjectItem(characteristics_item, "value");
+        cJSON *fld;
+
+        if (strcmp(type_key->valuestring, SWITCH_ID_TYPE) == 0) {
+            cJSON_ArrayForEach(payload_item, payload_json) {
+                cJSON *nvs_aid = cJSON_GetObjectItem(payload_item, "aid");
+                cJSON *nvs_iid = cJSON_GetObjectItem(payload_item, "iid");
+                if (nvs_aid->valueint == aid_key->valueint && nvs_iid->valueint == iid_key->valueint) {
+                    cJSON *nvs_value = cJSON_GetObjectItem(payload_item, "value");
+                    if (cJSON_IsNumber(nvs_value)) {
+                        cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
+                        cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
+                        cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
+                        cJSON_AddItemToObject(fld, "value", cJSON_CreateNumber(nvs_value->valueint));
+                    }
+                }
+            }
+        }
+        else if (strcmp(type_key->valuestring, HOMEKIT_CHARACTERISTIC_ON) == 0) {
+            cJSON_AddItemToArray(characteristics_cmd_json, fld = cJSON_CreateObject());
+            cJSON_AddItemToObject(fld, "aid", cJSON_CreateNumber(aid_key->valueint));
+            cJSON_AddItemToObject(fld, "iid", cJSON_CreateNumber(iid_key->valueint));
+            cJSON_AddItemToObject(fld, "value", cJSON_CreateBool(!cJSON_IsTrue(value_key)));
+        }
+    }
+    cJSON_Delete(root_resp);
+
+    char *out = cJSON_PrintUnformatted(root_cmd);
+    cjson_shadow_update(root_cmd);
+    cJSON_Delete(root_cmd);
+
+    size_t len = strlen(out);
+    assert(len < size);
+    memcpy(buf, out, len + 1);
+    free(out);
+    return len;
+}
+
+/* remote_plan_t: what remote_shadow_get_values(), remote_op_set_put() and
+ * remote_shadow_set() do for the same press */
+
+static remote_plan_t plan;
+
+static size_t press_plan(char *buf, size_t size) {
+    int values[REMOTE_PLAN_MAX_IDS];
+    for (int i = 0; i < plan.num_items; i++) {
+        values[i] = find_char(plan.ids[i].aid, plan.ids[i].iid)->value;
+    }
+
+    int len = remote_plan_build(&plan, REMOTE_PLAN_TOGGLE, values, 0, buf, size);
+    assert(len > 0);
+
+    for (int i = 0; i < plan.num_items; i++) {
+        int value;
+        if (remote_plan_item_value(&plan, i, REMOTE_PLAN_TOGGLE, values, 0, &value)) {
+            find_char(plan.ids[i].aid, plan.ids[i].iid)->value = value;
+        }
+    }
+    return len;
+}
+
+static void run(const char *name, size_t (*press)(char *, size_t), long iterations) {
+    char buf[REMOTE_PLAN_BODY_SIZE];
+
+    shadow_reset();
+    assert(press(buf, sizeof(buf)) == sizeof(expected) - 1);
+    assert(strcmp(buf, expected) == 0);
+    assert(shadow[0].value == 0 && shadow[1].value == 75 && shadow[2].value == 3);
+
+    allocations = 0;
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+        press(buf, sizeof(buf));
+    }
+    double elapsed = now() - start;
+
+    printf("%-12s %8.1f ns/press %6.1f allocations/press\n", name,
+           elapsed * 1e9 / iterations, (double) allocations / iterations);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+    cJSON_Hooks hooks = { .malloc_fn = counting_malloc, .free_fn = free };
+    cJSON_InitHooks(&hooks);
+
+    // both done once at boot
+    nvs_root = cJSON_Parse(nvs_command);
+    assert(nvs_root);
+    assert(remote_plan_compile(nvs_command, &plan) == ESP_OK);
+    const uint8_t kinds[] = { REMOTE_KIND_ON, REMOTE_KIND_BRIGHTNESS, REMOTE_KIND_SWITCH_ID };
+    remote_plan_set_kinds(&plan, kinds);
+    assert(plan.kinds_known);
+
+    run("remote_plan", press_plan, iterations);
+    run("cJSON", press_cjson, iterations);
+
+    cJSON_Delete(nvs_root);
+    return 0;
+}
@@ -0,0 +1,7 @@
+// Included ahead of every source: newlib has strlcpy, glibc only from 2.38
+#pragma once
+
+#include <stddef.h>
+
+size_t bench_strlcpy(char *dst, const char *src, size_t size);
+#define strlcpy bench_strlcpy
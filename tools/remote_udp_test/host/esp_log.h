@@ -0,0 +1,9 @@
+// Host stand-in for the ESP-IDF header: only errors are shown
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...)  fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)  do { (void) (tag); } while (0)
+#define ESP_LOGI(tag, format, ...)  do { (void) (tag); } while (0)
+#define ESP_LOGD(tag, format, ...)  do { (void) (tag); } while (0)
@@ -0,0 +1,19 @@
+// Host stand-in for the FreeRTOS header: one task, ticks set by the test
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define portTICK_PERIOD_MS          1
+#define portMAX_DELAY               ((TickType_t) 0xffffffff)
+#define pdMS_TO_TICKS(ms)           ((TickType_t) (ms))
+#define pdTRUE                      1
+#define pdFALSE                     0
+#define pdPASS                      pdTRUE
+#define tskIDLE_PRIORITY            0
+
+extern TickType_t test_ticks;
+#define xTaskGetTickCount()         (test_ticks)
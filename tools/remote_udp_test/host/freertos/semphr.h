@@ -0,0 +1,24 @@
+// Host stand-in for the FreeRTOS header: the test is single threaded
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return &test_ticks;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    (void) sem;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+    (void) sem; (void) wait;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    (void) sem;
+    return pdTRUE;
+}
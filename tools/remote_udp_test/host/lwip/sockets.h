@@ -0,0 +1,12 @@
+// Host stand-in for the lwip header: the sockets of the host, with sendto
+//   captured by the test
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+ssize_t test_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen);
+#define sendto test_sendto
@@ -0,0 +1,14 @@
+// Host stand-in for the ESP8266 RTOS SDK header
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    char *key;
+    char *value;
+} mdns_txt_item_t;
+
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto,
+                           uint16_t port, mdns_txt_item_t txt[], size_t num_items);
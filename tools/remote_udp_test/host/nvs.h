@@ -0,0 +1,18 @@
+// Host stand-in for the ESP8266 RTOS SDK header, u32 values kept in memory
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *out_value);
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
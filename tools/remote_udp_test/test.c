@@ -0,0 +1,324 @@
+/* Host tests of the replay checks in main/remote_udp.c: make test
+ *
+ * The source is included so its static handlers can be fed packets
+ * directly; sendto(), NVS and the MAC are stand-ins from host/.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "remote_udp.c"
+
+#define SENDER_A    0x11223344
+#define SENDER_B    0x55667788
+#define HOST_IP     "10.0.0.2"
+
+TickType_t test_ticks;
+
+// the last datagram sent
+static uint8_t sent_packet[MAX(COMMAND_MAX, ACK_MAX)];
+static size_t sent_len;
+static struct sockaddr_in sent_to;
+
+static int applied;
+static int done_calls;
+static esp_err_t done_err;
+
+static struct {
+    char key[16];
+    uint32_t value;
+} nvs_values[32];
+static int nvs_count;
+
+ssize_t test_sendto(int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen) {
+    (void) s; (void) flags;
+    assert(size <= sizeof(sent_packet) && tolen == sizeof(sent_to));
+    memcpy(sent_packet, data, size);
+    sent_len = size;
+    memcpy(&sent_to, to, sizeof(sent_to));
+    return size;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+    (void) type;
+    static const uint8_t ours[6] = { 0x24, 0x0a, 0x11, 0x22, 0x33, 0x44 };
+    memcpy(mac, ours, sizeof(ours));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+    (void) name; (void) open_mode;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *out_value) {
+    (void) handle;
+    for (int i = 0; i < nvs_count; i++) {
+        if (strcmp(nvs_values[i].key, key) == 0) {
+            *out_value = nvs_values[i].value;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value) {
+    (void) handle;
+    int i = 0;
+    while (i < nvs_count && strcmp(nvs_values[i].key, key) != 0) {
+        i++;
+    }
+    if (i == nvs_count) {
+        assert(nvs_count < (int) (sizeof(nvs_values) / sizeof(nvs_values[0])));
+        snprintf(nvs_values[nvs_count++].key, sizeof(nvs_values[0].key), "%s", key);
+    }
+    nvs_values[i].value = value;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+    (void) handle;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle) {
+    (void) handle;
+}
+
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto,
+                           uint16_t port, mdns_txt_item_t txt[], size_t num_items) {
+    (void) instance_name; (void) service_type; (void) proto; (void) port; (void) txt; (void) num_items;
+    return ESP_OK;
+}
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created) {
+    (void) task; (void) name; (void) stack_depth; (void) arg; (void) priority; (void) created;
+    return pdPASS;
+}
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t md_type) {
+    (void) md_type;
+    return NULL;
+}
+
+// FNV-1a over key and input, not a MAC: enough to tell packets apart here
+int mbedtls_md_hmac(const mbedtls_md_info_t *md_info, const unsigned char *key, size_t keylen,
+                    const unsigned char *input, size_t ilen, unsigned char *output) {
+    (void) md_info;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < keylen; i++) {
+        h = (h ^ key[i]) * 0x100000001b3ULL;
+    }
+    for (size_t i = 0; i < ilen; i++) {
+        h = (h ^ input[i]) * 0x100000001b3ULL;
+    }
+    for (int i = 0; i < 32; i++) {
+        output[i] = h >> (8 * (i % 8));
+        h = (h ^ i) * 0x100000001b3ULL;
+    }
+    return 0;
+}
+
+static int apply(remote_udp_action_t action, int brightness, const struct http_hap_id *ids, int num_ids,
+                 uint8_t *kinds, int *values) {
+    (void) action; (void) brightness; (void) ids;
+    for (int i = 0; i < num_ids; i++) {
+        kinds[i] = 1;
+        values[i] = 1;
+    }
+    applied++;
+    return 0;
+}
+
+static void on_done(remote_udp_req_t *req, esp_err_t err) {
+    (void) req;
+    done_calls++;
+    done_err = err;
+}
+
+// remote_udp_init() without the socket and the task
+static void reset(void) {
+    memset(peers, 0, sizeof(peers));
+    memset(nvs_values, 0, sizeof(nvs_values));
+    nvs_count = 0;
+    udp_key_len = 4;
+    memcpy(udp_key, "test", udp_key_len);
+    apply_cb = apply;
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    sender_id = get_u32(mac + 2);
+    udp_mutex = xSemaphoreCreateMutex();
+    pending = NULL;
+    next_seq = seq_limit = 0;
+    assert(reserve_seq() == ESP_OK);
+    udp_received = udp_rejected = udp_sent = udp_retransmits = 0;
+    applied = done_calls = 0;
+    sent_len = 0;
+    test_ticks = 1000;
+}
+
+static struct sockaddr_in from_ip(const char *ip) {
+    struct sockaddr_in from = { .sin_family = AF_INET, .sin_port = htons(REMOTE_UDP_PORT) };
+    assert(inet_aton(ip, &from.sin_addr));
+    return from;
+}
+
+// A TOGGLE of 1.9 from sender, as transmit() would send it
+static size_t command(uint8_t *packet, uint32_t sender, uint32_t seq) {
+    uint8_t *p = put_header(packet, TYPE_COMMAND, sender, seq);
+    *p++ = REMOTE_UDP_TOGGLE;
+    *p++ = 0;
+    *p++ = 1;
+    p = put_u32(p, 1);
+    p = put_u32(p, 9);
+    compute_mac(packet, p - packet, p);
+    return p + REMOTE_UDP_MAC_SIZE - packet;
+}
+
+static size_t ack(uint8_t *packet, uint32_t sender, uint32_t seq, uint8_t status, uint32_t value) {
+    uint8_t *p = put_header(packet, TYPE_ACK, sender, seq);
+    *p++ = status;
+    *p++ = 1;
+    *p++ = 1;
+    p = put_u32(p, value);
+    compute_mac(packet, p - packet, p);
+    return p + REMOTE_UDP_MAC_SIZE - packet;
+}
+
+static void deliver(uint32_t sender, uint32_t seq, const char *ip) {
+    uint8_t packet[COMMAND_MAX];
+    size_t len = command(packet, sender, seq);
+    struct sockaddr_in from = from_ip(ip);
+    handle_command(packet, len, &from);
+}
+
+static uint8_t sent_status(void) {
+    assert(sent_len > HEADER_SIZE && sent_packet[3] == TYPE_ACK);
+    return sent_packet[HEADER_SIZE];
+}
+
+static void test_replay_from_other_address(void) {
+    reset();
+    deliver(SENDER_A, 5, "10.0.0.7");
+    assert(applied == 1 && sent_status() == STATUS_OK);
+    assert(get_u32(sent_packet + 4) == SENDER_A && get_u32(sent_packet + 8) == 5);
+
+    // the same datagram, and an older one, from somewhere else
+    deliver(SENDER_A, 5, "10.0.0.66");
+    deliver(SENDER_A, 4, "10.0.0.66");
+    assert(applied == 1 && udp_rejected == 2);
+    assert(sent_status() == STATUS_STALE && sent_to.sin_addr.s_addr == inet_addr("10.0.0.66"));
+    assert(get_u32(sent_packet + HEADER_SIZE + 3) == 6);
+
+    // another sender has its own numbers
+    deliver(SENDER_B, 5, "10.0.0.66");
+    assert(applied == 2 && sent_status() == STATUS_OK);
+}
+
+static void test_retransmission(void) {
+    reset();
+    deliver(SENDER_A, 5, "10.0.0.7");
+    uint8_t first[ACK_MAX];
+    size_t first_len = sent_len;
+    memcpy(first, sent_packet, sent_len);
+
+    // our ack was lost: the same answer again, without applying it twice
+    sent_len = 0;
+    deliver(SENDER_A, 5, "10.0.0.7");
+    assert(applied == 1 && udp_rejected == 0);
+    assert(sent_len == first_len && memcmp(sent_packet, first, first_len) == 0);
+}
+
+static void test_sender_covered_by_mac(void) {
+    reset();
+    uint8_t packet[COMMAND_MAX];
+    size_t len = command(packet, SENDER_A, 5);
+    packet[7] ^= 1;
+    struct sockaddr_in from = from_ip("10.0.0.7");
+    sent_len = 0;
+    handle_command(packet, len, &from);
+    assert(applied == 0 && udp_rejected == 1 && sent_len == 0);
+}
+
+static void test_replay_after_eviction(void) {
+    reset();
+    deliver(SENDER_A, 5, "10.0.0.7");
+
+    // enough other senders to push A out of RAM
+    for (int i = 0; i < REMOTE_UDP_PEERS; i++) {
+        test_ticks++;
+        deliver(SENDER_B + i, 0, "10.0.0.8");
+    }
+    assert(applied == 1 + REMOTE_UDP_PEERS);
+
+    deliver(SENDER_A, 5, "10.0.0.66");
+    assert(applied == 1 + REMOTE_UDP_PEERS && udp_rejected == 1);
+    assert(sent_status() == STATUS_STALE && get_u32(sent_packet + HEADER_SIZE + 3) == REMOTE_UDP_SEQ_BLOCK);
+}
+
+static void test_replay_after_reboot(void) {
+    reset();
+    deliver(SENDER_A, 5, "10.0.0.7");
+    deliver(SENDER_A, REMOTE_UDP_SEQ_BLOCK + 3, "10.0.0.7");
+    assert(applied == 2);
+
+    // RAM is gone, NVS is not
+    memset(peers, 0, sizeof(peers));
+    deliver(SENDER_A, REMOTE_UDP_SEQ_BLOCK + 3, "10.0.0.66");
+    deliver(SENDER_A, 5, "10.0.0.66");
+    assert(applied == 2 && udp_rejected == 2);
+
+    // the sender carries on from the floor it is told
+    deliver(SENDER_A, 2 * REMOTE_UDP_SEQ_BLOCK, "10.0.0.7");
+    assert(applied == 3 && sent_status() == STATUS_OK);
+}
+
+static void test_stale_ack_resends(void) {
+    reset();
+    remote_udp_req_t req = {
+        .action = REMOTE_UDP_TOGGLE,
+        .ids = { { .aid = 1, .iid = 9 } },
+        .num_ids = 1,
+        .on_done = on_done,
+    };
+    assert(remote_udp_submit(HOST_IP, REMOTE_UDP_PORT, &req) == ESP_OK);
+    assert(get_u32(sent_packet + 4) == sender_id && get_u32(sent_packet + 8) == 0);
+
+    uint8_t packet[ACK_MAX];
+    struct sockaddr_in from = from_ip(HOST_IP);
+
+    // meant for another switch with the same seq
+    size_t len = ack(packet, SENDER_B, 0, STATUS_STALE, 1000);
+    sent_len = 0;
+    handle_ack(packet, len, &from);
+    assert(sent_len == 0 && next_seq == 1);
+
+    // the receiver has seen up to 1000 from us: the command goes again as 1000
+    len = ack(packet, sender_id, 0, STATUS_STALE, 1000);
+    handle_ack(packet, len, &from);
+    assert(req.seq == 1000 && next_seq == 1001 && get_u32(sent_packet + 8) == 1000);
+    assert(seq_limit > next_seq && done_calls == 0 && pending == &req);
+    uint32_t saved;
+    assert(nvs_get_u32(1, "seq", &saved) == ESP_OK && saved == seq_limit);
+
+    // the answer to the first seq no longer counts, the one to the new does
+    len = ack(packet, sender_id, 0, STATUS_OK, 1);
+    handle_ack(packet, len, &from);
+    assert(done_calls == 0);
+    len = ack(packet, sender_id, 1000, STATUS_OK, 1);
+    handle_ack(packet, len, &from);
+    assert(done_calls == 1 && done_err == ESP_OK && req.values[0] == 1 && !pending);
+}
+
+int main(void) {
+    test_replay_from_other_address();
+    test_retransmission();
+    test_sender_covered_by_mac();
+    test_replay_after_eviction();
+    test_replay_after_reboot();
+    test_stale_ack_resends();
+    printf("remote_udp tests passed\n");
+    return 0;
+}